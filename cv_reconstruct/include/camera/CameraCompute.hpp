@@ -40,6 +40,13 @@ namespace Camera
         /// \return Updated stereo camera settings with rectification information for new projection and transform matrices
         Calib::StereoCalib GetRectifiedStereoSettings();
 
+        /// Scale a stereo calibration for images resized by the given factor.
+        /// Intrinsics, resolution, rectified projections, Q and the valid regions are rescaled, the baseline is unchanged
+        /// \param calib The stereo calibration at the original resolution
+        /// \param scale The image scale factor (e.g. 0.5 for half resolution)
+        /// \return The stereo calibration for the resized images
+        static Calib::StereoCalib ScaleStereoCalib(const Calib::StereoCalib& calib, float scale);
+
     private:
         void ComputeMatchingFeatures(const cv::Mat& leftImage, const cv::Mat& rightImage, std::vector<cv::Point2f>& pointsLeft, std::vector<cv::Point2f>& pointsRight);
         void Rectify(cv::Size imageSize);
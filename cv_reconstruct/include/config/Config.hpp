@@ -10,6 +10,7 @@
 
 #include "point_cloud/point_cloud_constants.hpp"
 #include "reconstruct/Reconstruct3DTypes.hpp"
+#include "pipeline/OpticalFlowTypes.hpp"
 
 namespace Config
 {
@@ -26,6 +27,13 @@ namespace Config
         struct Reconstruction
         {
             bool ShouldRectifyImages { true };
+
+            // processing resolution relative to the input images (disparity ranges are given at input resolution)
+            struct Scale {
+                float Disparity { 1.0f };
+                float DenseMapping { 1.0f };
+                float Texture { 1.0f };
+            } Scale;
             Reconstruct::StereoBlockMatcherType BlockMatcherType { Reconstruct::StereoBlockMatcherType::STEREO_BLOCK_MATCHER };
 
             struct SBM {
@@ -43,7 +51,100 @@ namespace Config
                 int MinDisparity { 0 };
             } SGBM;
 
+            struct CSGM {
+                int NumDisparities { 128 };
+                int MinDisparity { 0 };
+                int P1 { 10 };
+                int P2 { 120 };
+                int NumPaths { 8 };
+                int UniquenessRatio { 10 };
+                int Disp12MaxDiff { 1 };
+                int SpeckleRange { 2 };
+                int SpeckleWindowSize { 100 };
+            } CSGM;
+
+            // coarse-to-fine disparity: match at half resolution, refine at full resolution in a band around the estimate
+            struct Hierarchical {
+                bool Enabled { false };
+                int SearchBand { 2 };
+                int WindowRadius { 2 };
+            } Hierarchical;
+
+            // warp the previous frame's disparity with the frame motion and search only a band around it,
+            // with the census window matcher whatever the block matcher type
+            struct TemporalPrior {
+                bool Enabled { false };
+                int SearchBand { 3 };
+                int WindowRadius { 2 };
+                int RefreshInterval { 10 };
+            } TemporalPrior;
+
+            // triangulate only high gradient pixels, limited to a point budget per frame (0 for no limit)
+            struct SemiDense {
+                bool Enabled { false };
+                int GradientThreshold { 8 };
+                int PointBudget { 100000 };
+            } SemiDense;
+
+            // pruning of the matcher output
+            struct DisparityFilter {
+                float ConfidenceStdFactor { 1.3f };
+                bool LeftRightCheck { false };
+                int Disp12MaxDiff { 1 };
+                int SpeckleWindowSize { 0 };
+                int SpeckleRange { 2 };
+            } DisparityFilter;
+
         } Reconstruction;
+
+        // 2D features: grid bucketed FAST with ORB or BRISK descriptors
+        struct Features
+        {
+            std::string Descriptor { "brisk" };
+            int GridRows { 4 };
+            int GridCols { 8 };
+            int MaxFeatures { 2000 };
+            int FastThreshold { 20 };
+            float MatchRatio { 0.7f };
+            bool CrossCheck { true };
+
+        } Features;
+
+        // keyframe selection and frame tracking
+        struct Tracking
+        {
+            float MinTrackedOverlap { 0.5f };
+            float MinMedianParallax { 20.0f };
+            float MaxRotationDegrees { 10.0f };
+            float MatchSearchRadius { 20.0f };
+            bool SparseStereo { false };
+
+        } Tracking;
+
+        // correspondences for local optimisation
+        struct OpticalFlow
+        {
+            std::string Mode { "dense" };
+            ::Features::DenseFlowBackend DenseBackend { ::Features::DenseFlowBackend::DENSE_FLOW_FARNEBACK };
+            float DenseScale { 1.0f };
+            int FlowCacheSize { 8 };
+            int MaxTracks { 1500 };
+            int CellSize { 24 };
+            int WindowSize { 21 };
+            int PyramidLevels { 3 };
+            float MaxForwardBackwardError { 1.0f };
+
+        } OpticalFlow;
+
+        // keyframe images written to disk by a background writer
+        struct KeyFrameDatabase
+        {
+            bool PersistImages { true };
+            std::string ImageFormat { "png" };
+            int CompressionLevel { 1 };
+            int MaxQueuedWrites { 16 };
+
+        } KeyFrameDatabase;
     };
 }
 
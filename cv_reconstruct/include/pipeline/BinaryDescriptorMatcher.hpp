@@ -0,0 +1,81 @@
+//
+// BinaryDescriptorMatcher.hpp
+// Matches binary descriptors (ORB, BRISK) by Hamming distance with a multi-index hash for candidate generation,
+// a Lowe ratio test and an optional cross-check
+//
+
+#ifndef MASTER_THESIS_BINARYDESCRIPTORMATCHER_HPP
+#define MASTER_THESIS_BINARYDESCRIPTORMATCHER_HPP
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace Pipeline
+{
+    class BinaryDescriptorMatcher
+    {
+    public:
+        /// Create a binary descriptor matcher
+        /// \param ratio The Lowe ratio: a match is kept when its distance is below ratio * the distance of the second nearest neighbour
+        /// \param crossCheck Only keep matches where the query descriptor is also the nearest neighbour of its train descriptor
+        BinaryDescriptorMatcher(float ratio = 0.7f, bool crossCheck = true);
+
+        ~BinaryDescriptorMatcher() = default;
+
+        /// Match each query descriptor to its nearest train descriptor.
+        /// Query descriptors without a second neighbour to compare against fail the ratio test
+        /// \param query The query descriptors (CV_8U, one per row)
+        /// \param train The train descriptors (CV_8U, one per row, same width as the query)
+        /// \param matches Will be populated with the matches passing the ratio test (and cross-check)
+        /// \return The number of descriptor distances computed, e.g. to compare against a brute force search
+        size_t Match(const cv::Mat& query, const cv::Mat& train, std::vector<cv::DMatch>& matches) const;
+
+        /// Match each query descriptor to its nearest train descriptor among its candidates, e.g. the keypoints within a predicted window.
+        /// The ratio test is applied against the second nearest candidate, a single candidate is kept when within the maximum distance.
+        /// Each train descriptor is matched at most once, to its closest query
+        /// \param query The query descriptors (CV_8U, one per row)
+        /// \param train The train descriptors (CV_8U, one per row, same width as the query)
+        /// \param candidates The indices of the train descriptors to search for each query descriptor
+        /// \param maxDistance The maximum Hamming distance of a match
+        /// \param matches Will be populated with the matches
+        void MatchCandidates(const cv::Mat& query, const cv::Mat& train, const std::vector<std::vector<int>>& candidates, int maxDistance, std::vector<cv::DMatch>& matches) const;
+
+        /// Hamming distance between 2 binary descriptors
+        /// \param a The first descriptor
+        /// \param b The second descriptor
+        /// \param bytes The descriptor length in bytes
+        /// \return The number of differing bits
+        static int HammingDistance(const uchar* a, const uchar* b, int bytes);
+
+    private:
+        // descriptors bucketed by the value of each of their substrings (bytes or 16 bit words), one table per substring
+        struct Index
+        {
+            int Bytes { 0 };
+            int SubstringBytes { 1 };
+            int Substrings { 0 };
+            int Buckets { 0 };
+            std::vector<int> Offsets;
+            std::vector<int> Entries;
+        };
+
+        struct Neighbours
+        {
+            int Best { -1 };
+            int BestDistance { 0 };
+            int SecondDistance { 0 };
+        };
+
+        static void BuildIndex(const cv::Mat& descriptors, Index& index);
+
+        Neighbours FindNeighbours(const Index& index, const cv::Mat& descriptors, const uchar* query, bool needSecond, std::vector<int>& visited, int stamp, size_t& distancesComputed) const;
+        void LinearSearch(const cv::Mat& descriptors, const uchar* query, Neighbours& neighbours) const;
+
+    private:
+        float m_Ratio;
+        bool m_CrossCheck;
+    };
+}
+
+#endif //MASTER_THESIS_BINARYDESCRIPTORMATCHER_HPP
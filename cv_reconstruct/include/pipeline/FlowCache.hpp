@@ -0,0 +1,65 @@
+//
+// FlowCache.hpp
+// Bounded least recently used cache of the dense optical flow between pairs of keyframes
+//
+
+#ifndef MASTER_THESIS_FLOWCACHE_HPP
+#define MASTER_THESIS_FLOWCACHE_HPP
+
+#include <list>
+#include <map>
+#include <utility>
+
+#include <opencv2/core/core.hpp>
+
+namespace Features
+{
+    class FlowCache
+    {
+    public:
+        /// Create a cache
+        /// \param capacity The maximum number of flows held, 0 disables the cache
+        FlowCache(size_t capacity = 8);
+
+        ~FlowCache() = default;
+
+        /// Get the flow between two frames, marking it as most recently used
+        /// \param fromID The ID of the frame the flow starts from
+        /// \param toID The ID of the frame the flow goes to
+        /// \param flow Will be set to the cached flow (shares the cached data, which must not be modified)
+        /// \return True if the flow was cached
+        bool Get(size_t fromID, size_t toID, cv::Mat& flow);
+
+        /// Cache the flow between two frames, evicting the least recently used flow when full
+        /// \param fromID The ID of the frame the flow starts from
+        /// \param toID The ID of the frame the flow goes to
+        /// \param flow The flow
+        void Insert(size_t fromID, size_t toID, const cv::Mat& flow);
+
+        /// Evict the flows of frames that have left the active window, in O(log n) plus the number evicted
+        /// \param frameID Flows from or to a frame with a smaller ID are evicted
+        void EvictFramesBefore(size_t frameID);
+
+        /// \return The number of cached flows
+        size_t Size() const;
+
+    private:
+        typedef std::pair<size_t, size_t> FramePair;
+        typedef std::pair<size_t, FramePair> Key;    // ordered by the older frame first
+
+        static Key MakeKey(const FramePair& frames);
+
+        struct Entry
+        {
+            FramePair Frames;
+            cv::Mat Flow;
+        };
+
+    private:
+        size_t m_Capacity;
+        std::list<Entry> m_Entries;    // most recently used first
+        std::map<Key, std::list<Entry>::iterator> m_Lookup;
+    };
+}
+
+#endif //MASTER_THESIS_FLOWCACHE_HPP
@@ -10,6 +10,9 @@
 #include <opencv2/core/core.hpp>
 
 #include "StereoFrame.hpp"
+#include "BinaryDescriptorMatcher.hpp"
+#include "KeyPointGrid.hpp"
+#include "config/Config.hpp"
 
 namespace Pipeline
 {
@@ -19,6 +22,10 @@ namespace Pipeline
         /// Create a default instance of the feature extractor
         FrameFeatureExtractor();
 
+        /// Create a feature extractor with the detector, grid and feature budget from the config
+        /// \param config The config with the feature extraction settings
+        FrameFeatureExtractor(const Config::Config& config);
+
         ~FrameFeatureExtractor() = default;
 
         /// Compute correspondences given descriptors
@@ -26,6 +33,15 @@ namespace Pipeline
         /// \param d2 Descriptors for image 2
         /// \param matches Will be populated with matches
         void ComputeCorrespondences(const cv::Mat& d1, const cv::Mat& d2, std::vector<cv::DMatch>& matches) const;
+
+        /// Compute correspondences only between descriptors of image 1 and the keypoints of image 2 near their predicted position
+        /// \param d1 Descriptors for image 1
+        /// \param d2 Descriptors for image 2
+        /// \param predicted The predicted pixel in image 2 of each descriptor of image 1, non-finite where there is no prediction
+        /// \param grid2 The keypoint grid of image 2, index aligned with d2
+        /// \param radius The search radius around the predicted pixels
+        /// \param matches Will be populated with matches
+        void ComputeGuidedCorrespondences(const cv::Mat& d1, const cv::Mat& d2, const std::vector<cv::Point2f>& predicted, const KeyPointGrid& grid2, float radius, std::vector<cv::DMatch>& matches) const;
         
         /// Compute correspondences given descriptors
         /// \param image1 first image
@@ -36,6 +52,12 @@ namespace Pipeline
         /// \param mask2 Optional mask for image 2 to restrict keypoints
         void ComputeCorrespondences(const cv::Mat& image1, const cv::Mat& image2, std::vector<cv::KeyPoint>& kp1, std::vector<cv::KeyPoint>& kp2, cv::InputArray mask1 = cv::noArray(), cv::InputArray mask2 = cv::noArray()) const;
 
+        /// Compute the correspondences between each image and the next. Features of all images are computed in parallel
+        /// \param images The images
+        /// \param keypoints Will be set to the keypoints detected in each image
+        /// \param matches Will be set to the matches between each image and the next (one list less than images)
+        void ComputeCorrespondences(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::KeyPoint>>& keypoints, std::vector<std::vector<cv::DMatch>>& matches) const;
+
         /// Compute the correspondences between the 2 images
         /// \param image1 The first image
         /// \param image2 The second image
@@ -56,13 +78,57 @@ namespace Pipeline
         /// \param image The image to compute features from
         /// \param computedKeypoints Will be populated with computed keypoints in the left cam image
         /// \param computedDescriptors Will be populated with computed descriptors in the left cam image
-        void ComputeFeaturesFromImage(const cv::Mat& image, std::vector<cv::KeyPoint>& computedKeypoints, cv::Mat& computedDescriptors) const;
+        /// \param mask Optional mask to restrict keypoints
+        void ComputeFeaturesFromImage(const cv::Mat& image, std::vector<cv::KeyPoint>& computedKeypoints, cv::Mat& computedDescriptors, cv::InputArray mask = cv::noArray()) const;
+
+        /// Compute features from a greyscale pyramid (half scale per level) that has already been built, e.g. for tracking
+        /// \param pyramid The pyramid, level 0 is the image
+        /// \param computedKeypoints Will be populated with computed keypoints in level 0 coordinates, their octave is the level
+        /// \param computedDescriptors Will be populated with computed descriptors
+        /// \param mask Optional level 0 mask to restrict keypoints
+        void ComputeFeaturesFromPyramid(const std::vector<cv::Mat>& pyramid, std::vector<cv::KeyPoint>& computedKeypoints, cv::Mat& computedDescriptors, cv::InputArray mask = cv::noArray()) const;
+
+        /// Compute features from each of the images in parallel, across images, pyramid levels and grid cells. Results are in image order
+        /// \param images The images to compute features from
+        /// \param keypoints Will be set to the keypoints of each image
+        /// \param descriptors Will be set to the descriptors of each image
+        /// \param masks Optional masks to restrict keypoints, one per image (an empty list for no masks)
+        void ComputeFeaturesFromImages(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::KeyPoint>>& keypoints, std::vector<cv::Mat>& descriptors, const std::vector<cv::Mat>& masks = {}) const;
+
+        /// Compute features from each of the pyramids in parallel (see ComputeFeaturesFromPyramid). Results are in pyramid order
+        /// \param pyramids The greyscale pyramids
+        /// \param keypoints Will be set to the keypoints of each pyramid
+        /// \param descriptors Will be set to the descriptors of each pyramid
+        /// \param masks Optional level 0 masks to restrict keypoints, one per pyramid (an empty list for no masks)
+        void ComputeFeaturesFromPyramids(const std::vector<std::vector<cv::Mat>>& pyramids, std::vector<std::vector<cv::KeyPoint>>& keypoints, std::vector<cv::Mat>& descriptors, const std::vector<cv::Mat>& masks = {}) const;
+
+        /// Detect FAST keypoints in a grid of cells on each pyramid level (in parallel), keeping the strongest keypoints of each cell
+        /// up to its share of the level's budget. The budget halves with each level
+        /// \param image The image to detect keypoints in
+        /// \param keypoints Will be populated with the detected keypoints
+        /// \param mask Optional mask to restrict keypoints
+        void DetectKeypoints(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::InputArray mask = cv::noArray()) const;
 
     private:
-        void FilterForGoodMatches(const std::vector<std::vector<cv::DMatch>>& matches, std::vector<cv::DMatch>& goodMatches) const;
+        void DetectKeypoints(const std::vector<std::vector<cv::Mat>>& pyramids, std::vector<std::vector<cv::KeyPoint>>& keypoints, const std::vector<cv::Mat>& masks) const;
+        void DetectCellKeypoints(const cv::Mat& grey, const cv::Mat& mask, int level, int cell, int cellQuota, std::vector<cv::KeyPoint>& kept) const;
+        void ComputeOrientations(const std::vector<cv::Mat>& pyramid, std::vector<cv::KeyPoint>& keypoints) const;
+        void BuildPyramid(const cv::Mat& image, std::vector<cv::Mat>& pyramid) const;
+        int LevelQuota(int level, int levels) const;
+
     private:
         cv::Ptr<cv::Feature2D> m_FeatureExtractor;
-        cv::Ptr<cv::BFMatcher> m_BFMatcher;
+
+    private:
+        // grid bucketing
+        bool m_ComputeOrientation { true };
+        int m_GridRows;
+        int m_GridCols;
+        int m_MaxFeatures;
+        int m_FastThreshold;
+
+        // descriptor matching
+        BinaryDescriptorMatcher m_Matcher;
     };
 }
 
@@ -0,0 +1,50 @@
+//
+// KeyPointGrid.hpp
+// Spatial index over the keypoints of a frame for radius queries around predicted pixel positions
+//
+
+#ifndef MASTER_THESIS_KEYPOINTGRID_HPP
+#define MASTER_THESIS_KEYPOINTGRID_HPP
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace Pipeline
+{
+    class KeyPointGrid
+    {
+    public:
+        /// Create an empty grid
+        KeyPointGrid() = default;
+
+        /// Index the keypoints in square cells
+        /// \param keypoints The keypoints in level 0 pixel coordinates, their octave is the pyramid level
+        /// \param imageSize The size of the level 0 image
+        /// \param cellSize The cell width and height in pixels
+        KeyPointGrid(const std::vector<cv::KeyPoint>& keypoints, const cv::Size& imageSize, int cellSize = 16);
+
+        ~KeyPointGrid() = default;
+
+        /// Find the keypoints within the radius of the pixel
+        /// \param pixel The pixel in level 0 coordinates
+        /// \param radius The search radius in level 0 pixels
+        /// \param indices Will be set to the indices of the keypoints found
+        /// \param level Only keypoints detected at this pyramid level are returned, -1 for any level
+        void GetKeypointsInRadius(const cv::Point2f& pixel, float radius, std::vector<int>& indices, int level = -1) const;
+
+        /// \return The number of indexed keypoints
+        size_t Size() const;
+
+    private:
+        int m_CellSize { 16 };
+        int m_GridCols { 0 };
+        int m_GridRows { 0 };
+        std::vector<cv::Point2f> m_Points;
+        std::vector<int> m_Levels;
+        std::vector<int> m_CellOffsets;
+        std::vector<int> m_CellEntries;
+    };
+}
+
+#endif //MASTER_THESIS_KEYPOINTGRID_HPP
@@ -7,21 +7,44 @@
 #define OPTICAL_FLOW_ESTIMATOR_HPP
 
 #include <vector>
+#include <unordered_map>
 
 #include <opencv2/video/tracking.hpp>
 #include <opencv2/core/core.hpp>
 
+#include "config/Config.hpp"
+#include "pipeline/OpticalFlowTypes.hpp"
+#include "pipeline/FlowCache.hpp"
+
 namespace Features
 {
+    /// A feature tracked through consecutive frames
+    struct FeatureTrack
+    {
+        size_t ID;
+        size_t FirstFrame;                  // index of the first frame the feature was seen in, in tracking order
+        std::vector<cv::Point2f> Pixels;    // pixel in each frame from the first
+        bool IsAlive { true };
+    };
+
     class OpticalFlowEstimator
     {
     public:
-        /// Create default instance for flow estimation
+        /// Create default instance for flow estimation (full scale Farneback dense flow)
         OpticalFlowEstimator();
         
+        /// Create a dense flow estimator with the given backend
+        /// \param denseBackend The dense optical flow algorithm
+        /// \param denseScale The scale the flow is computed at. Below 1 the flow is upsampled guided by the image edges
+        OpticalFlowEstimator(DenseFlowBackend denseBackend, float denseScale = 1.0f);
+        
+        /// Create a flow estimator with the dense or sparse mode and the sparse tracking settings from the config
+        /// \param config The config
+        OpticalFlowEstimator(const Config::Config& config);
+        
         ~OpticalFlowEstimator() = default;
         
-        /// Compute pixel correspondences from dense optical flow from image 1 to 2
+        /// Compute pixel correspondences from dense optical flow from image 1 to 2. Images may be colour (BGR) or greyscale
         /// \param image1 The first image moving towards the second image
         /// \param image2 The second image
         /// \param points1 The computed points of the first image
@@ -34,10 +57,74 @@ namespace Features
         /// \param images A list of images to compute motion flowing from the first to the second and so on...
         /// \param trackedPoints Will be populated with the common pixels that were seen in ALL images
         /// \param An optional mask to apply on the first image before tracking the flow of pixels
-        void EstimateCorrespondingPixels(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::KeyPoint>>& trackedPoints, cv::InputArray mask = cv::noArray());
+        /// \param frameIDs Optional frame ID of each image, so the dense flow between the same frames is reused from the cache
+        void EstimateCorrespondingPixels(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::KeyPoint>>& trackedPoints, cv::InputArray mask = cv::noArray(), const std::vector<size_t>& frameIDs = {});
+        
+        /// Compute pixel correspondences from images in the list, as compact pixel positions. In sparse mode the pixels are
+        /// features of the first image tracked with pyramidal Lucas-Kanade instead of every pixel
+        /// \param images A list of images to compute motion flowing from the first to the second and so on...
+        /// \param trackedPixels Will be set to the positions in each image of the pixels that were seen in ALL images
+        /// \param mask An optional mask to apply on the first image before tracking the flow of pixels
+        /// \param frameIDs Optional frame ID of each image, so the dense flow between the same frames is reused from the cache
+        void EstimateCorrespondingPixels(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::Point2f>>& trackedPixels, cv::InputArray mask = cv::noArray(), const std::vector<size_t>& frameIDs = {});
+        
+        /// Evict the cached dense flows of frames that have left the active window
+        /// \param frameID Flows from or to a frame with a smaller ID are evicted
+        void EvictCachedFlowsBefore(size_t frameID);
+        
+        /// Track the persistent feature tracks into the next frame, with forward-backward validation, and start new tracks
+        /// in the grid cells without one
+        /// \param frameID The ID of the frame
+        /// \param image The frame's image
+        /// \param mask An optional mask of where new tracks may start
+        void TrackFrame(size_t frameID, const cv::Mat& image, cv::InputArray mask = cv::noArray());
+        
+        /// Whether a frame has been added to the feature tracks
+        /// \param frameID The ID of the frame
+        /// \return True if the frame was tracked
+        bool IsTracked(size_t frameID) const;
+        
+        /// Get the persistent feature tracks seen in all of the given tracked frames
+        /// \param frameIDs The IDs of the frames
+        /// \param trackedPixels Will be set to the pixel of each track in each frame
+        /// \param trackIDs Will be set to the ID of each track
+        void GetTracks(const std::vector<size_t>& frameIDs, std::vector<std::vector<cv::Point2f>>& trackedPixels, std::vector<size_t>& trackIDs) const;
+        
+        /// Whether correspondences come from sparse feature tracks instead of dense flow
+        /// \return True in sparse mode
+        bool IsSparse() const;
+        
+    private:
+        void ToGreyScale(const cv::Mat& image, cv::Mat& grey) const;
+        cv::Ptr<cv::DenseOpticalFlow> CreateDenseFlow() const;
+        void CalcDenseFlow(const cv::Ptr<cv::DenseOpticalFlow>& denseFlow, const cv::Mat& prev, const cv::Mat& next, cv::Mat& flow) const;
+        void GuidedUpsample(const cv::Mat& guide, cv::Mat& flow) const;
+        void EstimateSparseCorrespondingPixels(const std::vector<cv::Mat>& greyScaleImages, std::vector<std::vector<cv::Point2f>>& trackedPixels, const cv::Mat& mask) const;
+        void TrackPoints(const std::vector<cv::Mat>& previousPyramid, const std::vector<cv::Mat>& nextPyramid, const std::vector<cv::Point2f>& previousPoints,
+                         std::vector<cv::Point2f>& nextPoints, std::vector<uchar>& valid) const;
+        void DetectNewFeatures(const cv::Mat& grey, const cv::Mat& mask, const std::vector<cv::Point2f>& existing, int budget, std::vector<cv::Point2f>& features) const;
+        void BuildPyramid(const cv::Mat& grey, std::vector<cv::Mat>& pyramid) const;
+        
+    private:
+        cv::Ptr<cv::DenseOpticalFlow> m_DenseFlow;
+        DenseFlowBackend m_DenseBackend { DENSE_FLOW_FARNEBACK };
+        float m_DenseScale { 1.0f };
+        FlowCache m_FlowCache;
+        
+    private:
+        bool m_Sparse { false };
+        int m_MaxTracks { 1500 };
+        int m_CellSize { 32 };
+        int m_WindowSize { 21 };
+        int m_PyramidLevels { 3 };
+        float m_MaxForwardBackwardError { 1.0f };
         
     private:
-        cv::Ptr<cv::FarnebackOpticalFlow> m_FarnebackOF;
+        std::vector<FeatureTrack> m_Tracks;
+        std::unordered_map<size_t, size_t> m_FrameIndices;
+        std::vector<cv::Mat> m_PreviousPyramid;
+        size_t m_FrameCount { 0 };
+        size_t m_NextTrackID { 0 };
     };
 }
 
@@ -0,0 +1,20 @@
+//
+// OpticalFlowTypes.hpp
+// Types used by the optical flow estimator
+//
+
+#ifndef MASTER_THESIS_OPTICALFLOWTYPES_HPP
+#define MASTER_THESIS_OPTICALFLOWTYPES_HPP
+
+namespace Features
+{
+    // The dense optical flow algorithm
+    enum DenseFlowBackend {
+        DENSE_FLOW_FARNEBACK,
+        DENSE_FLOW_DIS_ULTRAFAST,
+        DENSE_FLOW_DIS_FAST,
+        DENSE_FLOW_DIS_MEDIUM
+    };
+}
+
+#endif //MASTER_THESIS_OPTICALFLOWTYPES_HPP
@@ -81,6 +81,7 @@ namespace PointCloud
     private:
         std::shared_ptr<Reconstruct::Reconstruct3D> m_3DReconstructor { nullptr };
         Pipeline::FrameFeatureExtractor m_2DFeatureExtractor;
+        float m_MatchSearchRadius;
         pcl::IterativeClosestPoint<pcl::PointXYZ, pcl::PointXYZ> m_ICP;
         pcl::IterativeClosestPoint<pcl::PointXYZRGB, pcl::PointXYZRGB> m_ICP2;
         TempData m_TargetData;
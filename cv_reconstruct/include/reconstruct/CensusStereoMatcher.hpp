@@ -0,0 +1,117 @@
+//
+// CensusStereoMatcher.hpp
+// Semi-global stereo matcher using census transform and Hamming distance costs
+// Cost aggregation is vectorised with OpenCV universal intrinsics where available
+//
+
+#ifndef MASTER_THESIS_CENSUSSTEREOMATCHER_HPP
+#define MASTER_THESIS_CENSUSSTEREOMATCHER_HPP
+
+#include <vector>
+#include <cstdint>
+
+#include <opencv2/core/core.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+namespace Reconstruct
+{
+    class CensusStereoMatcher : public cv::StereoMatcher
+    {
+    public:
+        /// Create a census semi-global matcher
+        /// \param minDisparity The minimum disparity searched
+        /// \param numDisparities The number of disparities searched (multiple of 16)
+        /// \param P1 The penalty for disparity changes of 1 between neighbouring pixels
+        /// \param P2 The penalty for disparity changes larger than 1 between neighbouring pixels
+        /// \param numPaths The number of aggregation paths (4 or 8)
+        /// \return Pointer to the created matcher
+        static cv::Ptr<CensusStereoMatcher> create(int minDisparity = 0, int numDisparities = 64, int P1 = 10, int P2 = 120, int numPaths = 8);
+
+        CensusStereoMatcher(int minDisparity, int numDisparities, int P1, int P2, int numPaths);
+
+        ~CensusStereoMatcher() override = default;
+
+        /// Compute the disparity for the left image as 16x fixed point (CV_16S), matching the OpenCV matchers.
+        /// Horizontal paths are aggregated in parallel across rows, vertical and diagonal paths across the columns of each row
+        /// \param left The left greyscale image (CV_8U)
+        /// \param right The right greyscale image (CV_8U)
+        /// \param disparity Will be set to the disparity image. Invalid pixels are set to (minDisparity - 1) * 16
+        void compute(cv::InputArray left, cv::InputArray right, cv::OutputArray disparity) override;
+
+        /// Compute the disparity searching only a per-pixel disparity range.
+        /// Census costs are summed over a local window and the best disparity in the range is selected (no path aggregation).
+        /// Costs are only evaluated for the disparities searched within each small image tile.
+        /// Pixels with an empty range (lower bound above upper bound) or an ambiguous best disparity are invalid
+        /// \param left The left greyscale image (CV_8U)
+        /// \param right The right greyscale image (CV_8U)
+        /// \param lowerBound The lowest disparity in pixels to search for each pixel (CV_16S)
+        /// \param upperBound The highest disparity in pixels to search for each pixel (CV_16S)
+        /// \param disparity Will be set to the 16x fixed point disparity image (CV_16S). Invalid pixels are set to (minDisparity - 1) * 16
+        /// \param windowRadius The radius of the window the census costs are summed over
+        /// \return The number of window costs evaluated (pixels times disparities), e.g. for profiling
+        size_t ComputeInRange(cv::InputArray left, cv::InputArray right, cv::InputArray lowerBound, cv::InputArray upperBound, cv::OutputArray disparity, int windowRadius = 2);
+
+        int getMinDisparity() const override;
+        void setMinDisparity(int minDisparity) override;
+
+        int getNumDisparities() const override;
+        void setNumDisparities(int numDisparities) override;
+
+        /// The census window is fixed at 9x7, the block size is kept for API compatibility only
+        int getBlockSize() const override;
+        void setBlockSize(int blockSize) override;
+
+        int getSpeckleWindowSize() const override;
+        void setSpeckleWindowSize(int speckleWindowSize) override;
+
+        int getSpeckleRange() const override;
+        void setSpeckleRange(int speckleRange) override;
+
+        int getDisp12MaxDiff() const override;
+        void setDisp12MaxDiff(int disp12MaxDiff) override;
+
+        /// Set the smoothness penalties
+        /// \param P1 The penalty for disparity changes of 1
+        /// \param P2 The penalty for disparity changes larger than 1 (must be larger than P1)
+        void SetPenalties(int P1, int P2);
+        int GetP1() const;
+        int GetP2() const;
+
+        /// Set the number of aggregation paths
+        /// \param numPaths 4 (horizontal and vertical) or 8 (including diagonals)
+        void SetNumPaths(int numPaths);
+        int GetNumPaths() const;
+
+        /// Set the uniqueness ratio (in percent) the best cost must win by
+        /// \param ratio The uniqueness ratio. 0 disables the check
+        void SetUniquenessRatio(int ratio);
+        int GetUniquenessRatio() const;
+
+    private:
+        void CensusTransform(const cv::Mat& image, std::vector<uint64_t>& census) const;
+        void ComputeRowCost(const uint64_t* censusLeft, const uint64_t* censusRight, int cols, uint8_t* cost) const;
+        void AccumulateRowCost(int row, int colStart, int numCols, int minDisparity, int numDisparities, int rows, int cols, int sign, int* columnSums) const;
+        void BoxFilterRow(const int* columnSums, int numDisparities, int cols, int windowRadius, int* windowCosts) const;
+        void SelectRowDisparity(const uint16_t* sum, int cols, short* disparity, int* leftDisparity, uint16_t* rightCost, int* rightDisparity) const;
+
+    private:
+        int m_MinDisparity;
+        int m_NumDisparities;
+        int m_P1;
+        int m_P2;
+        int m_NumPaths;
+        int m_BlockSize { 9 };
+        int m_UniquenessRatio { 10 };
+        int m_SpeckleWindowSize { 0 };
+        int m_SpeckleRange { 0 };
+        int m_Disp12MaxDiff { 1 };
+
+    private:
+        std::vector<uint64_t> m_CensusLeft;
+        std::vector<uint64_t> m_CensusRight;
+        std::vector<uint8_t> m_MatchingCost;
+        std::vector<uint16_t> m_AggregatedCost;
+    };
+}
+
+#endif //MASTER_THESIS_CENSUSSTEREOMATCHER_HPP
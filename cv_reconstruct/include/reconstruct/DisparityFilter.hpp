@@ -0,0 +1,50 @@
+//
+// DisparityFilter.hpp
+// Filters 16x fixed point disparity maps: speckle removal, left-right consistency, confidence masking
+// and output conversion in a single pass over the image
+//
+
+#ifndef MASTER_THESIS_DISPARITYFILTER_HPP
+#define MASTER_THESIS_DISPARITYFILTER_HPP
+
+#include <opencv2/core/core.hpp>
+
+namespace Reconstruct
+{
+    class DisparityFilter
+    {
+    public:
+        /// Create a disparity filter
+        /// \param minDisparity The minimum disparity of the matcher (pixels below it are invalid)
+        /// \param confidenceStdFactor Disparities more than this many standard deviations above the minimum are kept
+        /// \param speckleWindowSize The maximum size of speckles removed (0 disables speckle removal)
+        /// \param speckleRange The maximum disparity difference within a speckle (pixels)
+        /// \param disp12MaxDiff The maximum difference in pixels allowed by the left-right consistency check
+        DisparityFilter(int minDisparity = 0, float confidenceStdFactor = 1.3f, int speckleWindowSize = 0, int speckleRange = 2, int disp12MaxDiff = 1);
+
+        ~DisparityFilter() = default;
+
+        /// Filter the disparity within the region of interest. Pixels outside the region are rejected
+        /// \param disparity The 16x fixed point disparity (CV_16S). Speckles are removed in place
+        /// \param rightDisparity The disparity of the right image (CV_16S) for the left-right check, empty to skip the check
+        /// \param roi The region of interest processed
+        /// \param filtered Will be set to the filtered disparity, 0 where rejected
+        /// \param mask Will be set to the mask of kept pixels (CV_8U, 255 where kept)
+        /// \param outputDepth The depth of the filtered disparity: CV_16S (16x fixed point) or CV_32F (pixels)
+        void Apply(cv::Mat& disparity, const cv::Mat& rightDisparity, const cv::Rect& roi, cv::Mat& filtered, cv::Mat& mask, int outputDepth = CV_32F) const;
+
+        /// Compute the confidence threshold of the disparity: minimum + confidenceStdFactor * std deviation
+        /// \param disparity The 16x fixed point disparity (CV_16S)
+        /// \return The threshold in 16x fixed point
+        double ComputeConfidenceThreshold(const cv::Mat& disparity) const;
+
+    private:
+        int m_MinDisparity;
+        float m_ConfidenceStdFactor;
+        int m_SpeckleWindowSize;
+        int m_SpeckleRange;
+        int m_Disp12MaxDiff;
+    };
+}
+
+#endif //MASTER_THESIS_DISPARITYFILTER_HPP
@@ -10,6 +10,9 @@
 #include "pipeline/StereoFrame.hpp"
 #include "config/Config.hpp"
 #include "Localizer.hpp"
+#include "CensusStereoMatcher.hpp"
+#include "DisparityFilter.hpp"
+#include "SparseStereoMatcher.hpp"
 
 #include <opencv2/core/core.hpp>
 #include <opencv2/core/types.hpp>
@@ -19,14 +22,16 @@
 #include <pcl/point_types.h>
 
 #include <memory>
+#include <vector>
 
 namespace Reconstruct
 {
     class Reconstruct3D
     {
     public:
-        /// Create a 3D reconstructor for the given stereo rig
-        /// \param stereoSetup The calibrated, stereo rig setup with stereo rectification already applied
+        /// Create a 3D reconstructor for the given stereo rig.
+        /// Images are processed at the disparity scale from the config, the calibration is scaled to match
+        /// \param stereoSetup The calibrated, stereo rig setup with stereo rectification already applied (at input resolution)
         Reconstruct3D(const Camera::Calib::StereoCalib& stereoSetup, const Config::Config& config);
 
         /// Generate the disparity map for the given stereo images
@@ -34,15 +39,57 @@ namespace Reconstruct
         /// \param rightImage The right camera image
         /// \return The disparity map
         cv::Mat GenerateDisparityMap(const cv::Mat& leftImage, const cv::Mat& rightImage) const;
+
+        /// Generate the disparity map searching only a band around the previous frame's disparity warped into this frame.
+        /// Pixels the warp does not reach are searched over the full disparity range.
+        /// The band is searched with the census window matcher (CensusStereoMatcher::ComputeInRange) whatever the block matcher type,
+        /// as only it can search a per-pixel range
+        /// \param leftImage The left camera image
+        /// \param rightImage The right camera image
+        /// \param previousDisparity The disparity map of the previous frame (16x fixed point)
+        /// \param motion The camera motion from the previous frame to this frame (maps previous camera coords to current camera coords)
+        /// \return The disparity map
+        cv::Mat GenerateDisparityMap(const cv::Mat& leftImage, const cv::Mat& rightImage, const cv::Mat& previousDisparity, const Eigen::Matrix4f& motion) const;
+
+        /// Generate the disparity map of the right image (for left-right consistency checks) by matching the mirrored images
+        /// \param leftImage The left camera image
+        /// \param rightImage The right camera image
+        /// \return The right disparity map (16x fixed point)
+        cv::Mat GenerateRightDisparityMap(const cv::Mat& leftImage, const cv::Mat& rightImage) const;
+
+        /// Whether the disparity filter needs a right disparity map (left-right check enabled and not done by the matcher)
+        /// \return True if GenerateRightDisparityMap should be passed to FilterDisparity
+        bool RequiresRightDisparity() const;
+
+        /// Filter the matcher output within the valid region: speckles, left-right consistency and confidence
+        /// \param disparity The 16x fixed point disparity (CV_16S). Speckles are removed in place
+        /// \param rightDisparity The right disparity for the left-right check, empty to skip the check
+        /// \param filtered Will be set to the filtered disparity, 0 where rejected
+        /// \param mask Will be set to the mask of kept pixels
+        /// \param outputDepth The depth of the filtered disparity: CV_16S (16x fixed point) or CV_32F (pixels)
+        void FilterDisparity(cv::Mat& disparity, const cv::Mat& rightDisparity, cv::Mat& filtered, cv::Mat& mask, int outputDepth = CV_32F) const;
+
+        /// Warp a disparity map into a camera that has moved. Rows are warped in parallel into per-thread z-buffers that are then merged
+        /// \param disparity The disparity map (16x fixed point)
+        /// \param motion The camera motion (maps source camera coords to target camera coords)
+        /// \return The warped disparity map, pixels with no warped disparity are invalid
+        cv::Mat WarpDisparity(const cv::Mat& disparity, const Eigen::Matrix4f& motion) const;
         
         pcl::PointCloud<pcl::PointXYZRGB> GeneratePointCloud(const cv::Mat& disparity, const cv::Mat& cameraImage) const;
 
         /// Generate point cloud using triangulation method
-        /// \param disparity The disparity image (parallax map)
-        /// \param cameraImage The RGB camera image (rectified)
+        /// \param disparity The disparity image (parallax map), either in pixels (CV_32F) or 16x fixed point (CV_16S)
+        /// \param cameraImage The RGB camera image (rectified), at the disparity resolution or downscaled for texturing
         /// \return Returns the generated point cloud with RGB information
         pcl::PointCloud<pcl::PointXYZRGB> Triangulate3D(const cv::Mat& disparity, const cv::Mat& cameraImage, cv::InputArray& mask = cv::noArray()) const;
         
+        /// Select the pixels to triangulate in semi-dense mode: pixels with an image gradient above the threshold,
+        /// keeping the strongest gradients if there are more than the point budget
+        /// \param cameraImage The camera image (3 channel or grey 8 bit)
+        /// \param mask The mask of pixels with valid disparities
+        /// \return The mask of pixels to triangulate (the given mask if semi-dense mode is disabled)
+        cv::Mat SelectSemiDensePixels(const cv::Mat& cameraImage, const cv::Mat& mask) const;
+
         /// Triangulate the single image point to 3D space
         /// \param u The x coorindate in the image plane
         /// \param v The y coordinate in the image plane
@@ -58,12 +105,32 @@ namespace Reconstruct
         pcl::PointXYZ BackProjectPoint(float x, float y) const;
         
         /// Triangulate the list of 2D image points using the given dispartiy image
-        /// \param disparity The disparity image
-        /// \param cameraImage The camera image (3 channel 8 bit)
+        /// \param disparity The disparity image (CV_16S 16x fixed point or CV_32F)
+        /// \param cameraImage The camera image (3 channel 8 bit), at the disparity resolution or downscaled for texturing
         /// \param points The list of 2D image points
         /// \param triangulatedPoints Output vector that will be populated with 3D points corresponding to each 2D image point in points vector
         void TriangulatePoints(const cv::Mat& disparity, const cv::Mat& cameraImage, const std::vector<cv::KeyPoint>& points, std::vector<pcl::PointXYZRGB>& triangulatedPoints) const;
         
+        /// Triangulate left image features from sparse stereo matches with right image features along the rectified scanlines
+        /// \param leftImage The rectified left greyscale image at the processing scale
+        /// \param rightImage The rectified right greyscale image at the processing scale
+        /// \param cameraImage The camera image (3 channel 8 bit) for the point colours, may be downscaled for texturing
+        /// \param leftKeypoints The left image features
+        /// \param leftDescriptors The binary descriptors of the left features
+        /// \param rightKeypoints The right image features
+        /// \param rightDescriptors The binary descriptors of the right features
+        /// \param triangulatedPoints Will be set to the 3D points, index aligned with the left features. Non-finite where no match was found
+        void TriangulateStereoFeatures(const cv::Mat& leftImage, const cv::Mat& rightImage, const cv::Mat& cameraImage,
+                                       const std::vector<cv::KeyPoint>& leftKeypoints, const cv::Mat& leftDescriptors,
+                                       const std::vector<cv::KeyPoint>& rightKeypoints, const cv::Mat& rightDescriptors,
+                                       std::vector<pcl::PointXYZRGB>& triangulatedPoints) const;
+        
+        /// Transform 3D points in camera space (y-up) and project them into the left image
+        /// \param points The 3D points
+        /// \param transform The rigid body transform applied to the points before projection
+        /// \param pixels Will be set to the projected pixels, index aligned with points. Non-finite for points without a valid depth
+        void ProjectPoints(const std::vector<pcl::PointXYZRGB>& points, const Eigen::Matrix4f& transform, std::vector<cv::Point2f>& pixels) const;
+        
         /// Get camera itrinsics for selected camera number
         /// \param fx The horizontal focal length
         /// \param fy The vertical focal length
@@ -72,13 +139,33 @@ namespace Reconstruct
         /// \param camNumber The camera number, default is 0 - left camera
         void GetCameraParameters(float& fx, float& fy, float& cx, float& cy, int camNumber = 0) const;
 
-        /// Apply stereo rectification to the images
+        /// Apply stereo rectification to the images. The rectified images are at the processing scale
         /// \param leftImage The left camera image (rectified)
         /// \param rightImage The right camera image (rectified)
         /// \param rectLeftImage Will be updated with the rectified image for the left camera
         /// \param rectRightImage Will be updated with the rectified image for the right camera
         void RectifyImages(const cv::Mat& leftImage, const cv::Mat& rightImage, cv::Mat& rectLeftImage, cv::Mat& rectRightImage) const;
 
+        /// Resize an already rectified input image to the processing scale
+        /// \param image The image at input resolution
+        /// \param scaledImage Will be set to the image at processing resolution (shares data if the scale is 1)
+        void ResizeToProcessingScale(const cv::Mat& image, cv::Mat& scaledImage) const;
+
+        /// Get the scale images are processed at relative to the input images
+        /// \return The processing scale
+        float GetProcessingScale() const;
+
+        /// Resize a processing resolution colour image to the resolution kept for texturing point clouds
+        /// \param image The image at processing resolution
+        /// \param scaledImage Will be set to the image at texture resolution (shares data if no resizing is needed)
+        void ResizeToTextureScale(const cv::Mat& image, cv::Mat& scaledImage) const;
+
+        /// Get the region of the left image where the stereo matcher can produce valid disparities.
+        /// This is the valid rectified region, less the columns on the left that have no match within the disparity range
+        /// \param imageSize The size of the (rectified) left image
+        /// \return The valid region of interest
+        cv::Rect GetValidDisparityROI(const cv::Size& imageSize) const;
+
         /// Set the window size for the block matcher for computing disparity
         /// \param size The window size (odd number)
         void SetStereoBMWindowSize(int size);
@@ -91,15 +178,67 @@ namespace Reconstruct
         /// \param type The type of block matcher to use
         void SetBlockMatcherType(StereoBlockMatcherType type);
 
+        /// Enable coarse-to-fine disparity computation.
+        /// Disparity is computed at half resolution and refined at full resolution within a band around the upsampled estimate
+        /// \param enabled Whether hierarchical disparity is used
+        /// \param searchBand The number of pixels either side of the estimate that are searched at full resolution
+        /// \param windowRadius The radius of the matching window used for the refinement
+        void SetHierarchicalDisparity(bool enabled, int searchBand = 2, int windowRadius = 2);
+
     private:
         void ConfigureSteoreoMatcher(const Config::Config& config);
+        void ConfigureRefinementMatchers();
+        void GetMatchingRegion(const cv::Size& imageSize, cv::Rect& validROI, cv::Rect& inputRegion) const;
+        cv::Mat PasteValidRegion(const cv::Mat& disparity, const cv::Rect& validROI, const cv::Rect& inputRegion, const cv::Size& imageSize) const;
+        cv::Mat GenerateDisparityMapHierarchical(const cv::Mat& leftImageGrey, const cv::Mat& rightImageGrey) const;
+        void BuildSearchRanges(const cv::Mat& prior, int band, bool searchInvalid, cv::Mat& lowerBound, cv::Mat& upperBound) const;
+        void BuildDepthLUT();
+        void BuildRectificationMaps(const cv::Size& inputSize, cv::Mat& mapLeft1, cv::Mat& mapLeft2, cv::Mat& mapRight1, cv::Mat& mapRight2) const;
+        int ScaleDisparityCount(int numDisparities) const;
+        float GetDisparityAt(const cv::Mat& disparity, int row, int col) const;
         float GetNearestNeighbourDisparity(const cv::Mat& disparity, int row, int col, int n) const;
 
     private:
         cv::Mat m_Q;
+        Camera::Calib::StereoCalib m_InputStereoCameraSetup;
         Camera::Calib::StereoCalib m_StereoCameraSetup;
+        float m_ProcessingScale { 1.0f };
+        int m_DenseSampleStep { 1 };
+        float m_TextureScale { 1.0f };
+
+        // rectification maps from input images to rectified images at processing scale
+        cv::Size m_RectificationInputSize;
+        cv::Mat m_RectifyMapLeft1, m_RectifyMapLeft2;
+        cv::Mat m_RectifyMapRight1, m_RectifyMapRight2;
         cv::Ptr<cv::StereoMatcher> m_StereoMatcher { nullptr };
         StereoBlockMatcherType m_StereoBlockMatcherType { STEREO_BLOCK_MATCHER };
+
+        // valid rectified region of the left image (empty if unknown)
+        cv::Rect m_ValidRectifiedRegion;
+
+        // pruning of the matcher output
+        DisparityFilter m_DisparityFilter;
+
+        // feature depths for tracking without a dense disparity
+        SparseStereoMatcher m_SparseStereoMatcher;
+        bool m_LeftRightCheck { false };
+
+        // depth for each 16x fixed point disparity value
+        std::vector<float> m_DisparityDepthLUT;
+
+        // coarse-to-fine disparity
+        bool m_HierarchicalEnabled { false };
+        int m_HierarchicalSearchBand { 2 };
+        int m_HierarchicalWindowRadius { 2 };
+        int m_TemporalSearchBand { 3 };
+        int m_TemporalWindowRadius { 2 };
+
+        // semi-dense triangulation
+        bool m_SemiDenseEnabled { false };
+        int m_SemiDenseGradientThreshold { 8 };
+        int m_SemiDensePointBudget { 0 };
+        cv::Ptr<cv::StereoMatcher> m_CoarseStereoMatcher { nullptr };
+        cv::Ptr<CensusStereoMatcher> m_RangeStereoMatcher { nullptr };
     };
 }
 
@@ -11,7 +11,8 @@ namespace Reconstruct
     // The type of stereo matcher
     enum StereoBlockMatcherType {
         STEREO_BLOCK_MATCHER,
-        STEREO_SEMI_GLOBAL_BLOCK_MATCHER
+        STEREO_SEMI_GLOBAL_BLOCK_MATCHER,
+        STEREO_CENSUS_SEMI_GLOBAL_MATCHER
     };
 }
 
@@ -0,0 +1,56 @@
+//
+// SparseStereoMatcher.hpp
+// Matches left image features to right image features along the rectified scanline, with sub-pixel refinement
+// of the disparity by patch correlation
+//
+
+#ifndef MASTER_THESIS_SPARSESTEREOMATCHER_HPP
+#define MASTER_THESIS_SPARSESTEREOMATCHER_HPP
+
+#include <vector>
+
+#include <opencv2/core/core.hpp>
+
+namespace Reconstruct
+{
+    class SparseStereoMatcher
+    {
+    public:
+        /// Create a sparse stereo matcher
+        /// \param minDisparity The minimum disparity searched
+        /// \param numDisparities The number of disparities searched
+        /// \param maxDescriptorDistance The maximum Hamming distance of a left-right feature match
+        /// \param rowTolerance Right features up to this many rows from the left feature's row are searched
+        /// \param windowRadius The radius of the patches correlated for sub-pixel refinement
+        /// \param refineRadius The patch correlation is searched this many pixels either side of the matched right feature
+        SparseStereoMatcher(int minDisparity = 0, int numDisparities = 64, int maxDescriptorDistance = 75, int rowTolerance = 1, int windowRadius = 5, int refineRadius = 5);
+
+        ~SparseStereoMatcher() = default;
+
+        /// Compute the disparity of each left feature
+        /// \param leftImage The rectified left greyscale image (CV_8U)
+        /// \param rightImage The rectified right greyscale image (CV_8U)
+        /// \param leftKeypoints The left image features
+        /// \param leftDescriptors The binary descriptors of the left features (CV_8U, one per row)
+        /// \param rightKeypoints The right image features
+        /// \param rightDescriptors The binary descriptors of the right features (CV_8U, one per row)
+        /// \param disparities Will be set to the sub-pixel disparity of each left feature, 0 where no match was found
+        void Compute(const cv::Mat& leftImage, const cv::Mat& rightImage,
+                     const std::vector<cv::KeyPoint>& leftKeypoints, const cv::Mat& leftDescriptors,
+                     const std::vector<cv::KeyPoint>& rightKeypoints, const cv::Mat& rightDescriptors,
+                     std::vector<float>& disparities) const;
+
+    private:
+        bool RefineDisparity(const cv::Mat& leftImage, const cv::Mat& rightImage, const cv::Point2f& left, float rightX, float& disparity, int& cost) const;
+
+    private:
+        int m_MinDisparity;
+        int m_NumDisparities;
+        int m_MaxDescriptorDistance;
+        int m_RowTolerance;
+        int m_WindowRadius;
+        int m_RefineRadius;
+    };
+}
+
+#endif //MASTER_THESIS_SPARSESTEREOMATCHER_HPP
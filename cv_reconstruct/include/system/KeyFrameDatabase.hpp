@@ -7,6 +7,10 @@
 #define KEYFRAME_DATABASE_HPP
 
 #include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <deque>
+#include <vector>
 #include <string>
 #include <unordered_map>
 #include <memory>
@@ -14,18 +18,21 @@
 #include <eigen3/Eigen/Eigen>
 
 #include "TrackingFrame.hpp"
+#include "config/Config.hpp"
 
 namespace System
 {
     class KeyFrameDatabase
     {
     public:
-        /// Construct the default instance of the keyframe database
-        KeyFrameDatabase() = default;
+        /// Construct the keyframe database. Keyframe images are written to disk on a background thread if enabled in the config
+        /// \param config The config with the keyframe persistence settings
+        KeyFrameDatabase(const Config::Config& config);
         
-        ~KeyFrameDatabase() = default;
+        /// Writes all queued keyframe images before returning
+        ~KeyFrameDatabase();
         
-        /// Insert a keyframe into the database
+        /// Insert a keyframe into the database. The camera image is queued for writing and only blocks if the write queue is full
         /// \param frame The keyframe to insert
         /// \return The ID of the newly inserted keyframe
         size_t InsertKeyFrame(std::shared_ptr<TrackingFrame> frame);
@@ -60,11 +67,27 @@ namespace System
         /// Dump keyframe poses to CSV file
         void DumpPosesToCSV();
         
+    private:
+        void RunImageWriter();
+        
     private:
         size_t m_NextUsableID { 0 };
         size_t m_LastInsertedID { 0 };
         std::unordered_map<size_t, std::shared_ptr<TrackingFrame>> m_KeyFrames;
         std::mutex m_DatabaseMutex;
+        
+    private:
+        // background keyframe image writer
+        bool m_PersistImages;
+        std::string m_ImageExtension;
+        std::vector<int> m_ImageWriteParams;
+        size_t m_MaxQueuedWrites;
+        std::deque<std::pair<std::string, cv::Mat>> m_WriteQueue;
+        std::mutex m_WriteQueueMutex;
+        std::condition_variable m_WriteQueued;
+        std::condition_variable m_WriteCompleted;
+        bool m_StopWriter { false };
+        std::thread m_WriterThread;
     };
 }
 
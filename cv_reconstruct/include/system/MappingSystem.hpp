@@ -31,7 +31,7 @@ namespace System
     {
     public:
         /// Create default instance of mapping system.
-        MappingSystem(std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor, std::shared_ptr<KeyFrameDatabase> keyFrameDB);
+        MappingSystem(std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor, std::shared_ptr<KeyFrameDatabase> keyFrameDB, const Config::Config& config);
 
         /// Start the optimisation thread
         void StartOptimisationThread();
@@ -65,13 +65,23 @@ namespace System
         
         std::shared_ptr<KeyFrameDatabase> GetKeyFrameDataBase() const;
 
+    private:
+        cv::Mat ComputeDisparity(const cv::Mat& leftImage, const cv::Mat& rightImage, bool tracked);
+        cv::Mat ComputeRightDisparity(const cv::Mat& leftImage, const cv::Mat& rightImage) const;
+
     private:
         Config::Config m_Config;
         std::atomic_bool m_RequestedShutdown { false };
 
+    private:
+        // temporal disparity prior
+        cv::Mat m_PreviousDisparity;
+        Eigen::Matrix4f m_PreviousFramePose = Eigen::Matrix4f::Identity();
+        int m_FramesSincePriorRefresh { 0 };
+
     private:
         std::unique_ptr<Tracker> m_Tracker;
-        std::shared_ptr<Pipeline::FrameFeatureExtractor> m_FeatureExtractor = std::make_shared<Pipeline::FrameFeatureExtractor>();
+        std::shared_ptr<Pipeline::FrameFeatureExtractor> m_FeatureExtractor;
         std::shared_ptr<Reconstruct::Reconstruct3D> m_3DReconstructor;
         std::shared_ptr<MappingSystem> m_MappingSystem;
         std::shared_ptr<KeyFrameDatabase> m_KeyFrameDatabase;
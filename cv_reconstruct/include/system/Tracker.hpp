@@ -6,19 +6,16 @@
 #ifndef MASTER_THESIS_TRACKER_HPP
 #define MASTER_THESIS_TRACKER_HPP
 
-#include <string>
 #include <memory>
-#include <unordered_map>
 
 #include <eigen3/Eigen/Eigen>
 
 #include "pipeline/FrameFeatureExtractor.hpp"
-#include "pipeline/OpticalFlowEstimator.hpp"
 #include "reconstruct/Reconstruct3D.hpp"
 #include "system/TrackingFrame.hpp"
-#include "system/OptimisationGraph.hpp"
 #include "system/MappingSystem.hpp"
 #include "system/KeyFrameDatabase.hpp"
+#include "config/Config.hpp"
 
 namespace System
 {
@@ -28,20 +25,45 @@ namespace System
         Tracker(std::shared_ptr<Pipeline::FrameFeatureExtractor> featureExtractor,
                 std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor,
                 std::shared_ptr<MappingSystem> mappingSystem,
-                std::shared_ptr<KeyFrameDatabase> keyFrameDB);
+                std::shared_ptr<KeyFrameDatabase> keyFrameDB,
+                const Config::Config& config);
 
         ~Tracker() = default;
 
-        /// Track the given frame
+        /// Track the given frame against the most recent keyframe. Every frame is tracked, a frame that fails to track
+        /// keeps the constant velocity prediction and is never inserted as a keyframe
         /// \param frame The frame to be tracked
-        void TrackFrame(std::shared_ptr<TrackingFrame> frame);
+        /// \return True if the frame should be inserted as a new keyframe (see InsertKeyFrame)
+        bool TrackFrame(std::shared_ptr<TrackingFrame> frame);
+        
+        /// Insert the tracked frame as a keyframe and send it to the mapper. The frame must have its dense disparity
+        /// \param frame The tracked frame
+        void InsertKeyFrame(std::shared_ptr<TrackingFrame> frame);
         
         /// Get the pose matrix of the current tracked frame
         /// \return The 4x4 pose matrix
         Eigen::Matrix4d GetPose() const;
         
+        /// Predict the pose of the next frame with a constant velocity motion model
+        /// \return The predicted 4x4 pose matrix
+        Eigen::Matrix4d PredictPose() const;
+        
+        /// Whether tracking has failed for too many consecutive frames and the camera needs relocalising
+        /// \return True if tracking is lost
+        bool IsLost() const;
+        
     private:
-        void TrackFrame(std::shared_ptr<TrackingFrame> currentFrame, std::shared_ptr<TrackingFrame> recentKeyFrame);
+        struct TrackingResult {
+            Eigen::Matrix4f RelativePose = Eigen::Matrix4f::Identity();
+            float Overlap { 0.0f };
+            float MedianParallax { 0.0f };
+        };
+        
+    private:
+        bool TrackFrame(std::shared_ptr<TrackingFrame> currentFrame, std::shared_ptr<TrackingFrame> recentKeyFrame);
+        bool EstimateRelativePose(const TrackingFrame& keyFrame, const TrackingFrame& frame, const Eigen::Matrix4f& predictedPose, TrackingResult& result) const;
+        void MatchFeatures(const TrackingFrame& keyFrame, const TrackingFrame& frame, const Eigen::Matrix4f& predictedPose, std::vector<cv::DMatch>& matches) const;
+        bool NeedsNewKeyFrame(const TrackingResult& result) const;
         Eigen::Matrix4f PoseFromCVRT(const cv::Mat& R, const cv::Mat t) const;
 
     private:
@@ -50,18 +72,17 @@ namespace System
         std::shared_ptr<MappingSystem> m_MappingSystem;
         std::shared_ptr<KeyFrameDatabase> m_KeyFrameDatabase;
         
-    private:
-        std::unordered_map<size_t, int> m_KeyFramePoseVertexIDs;
-        std::unordered_map<size_t, std::tuple<int, int>> m_KeyFrame3DPointVertexIDs;
-        
     private:
         Eigen::Matrix4d m_CurrentPose = Eigen::Matrix4d::Identity();
-        std::unique_ptr<OptimisationGraph> m_OptimisationGraph;
-        std::unique_ptr<Features::OpticalFlowEstimator> m_OpticalFlowEstimator;
+        Eigen::Matrix4d m_Velocity = Eigen::Matrix4d::Identity();
+        size_t m_ConsecutiveTrackingFailures { 0 };
         
     private:
-        std::vector<std::shared_ptr<TrackingFrame>> m_TrackedKeyFrames;
-        std::vector<std::string> m_KeyFrameImagePaths;
+        // keyframe selection thresholds
+        float m_MinTrackedOverlap;
+        float m_MinMedianParallax;
+        float m_MaxRotation;
+        float m_MatchSearchRadius;
     };
 }
 
@@ -8,6 +8,8 @@
 #define MASTER_THESIS_TRACKINGFRAME_HPP
 
 #include <memory>
+#include <mutex>
+#include <vector>
 #include <cmath>
 
 #include <pcl/point_cloud.h>
@@ -16,6 +18,7 @@
 
 #include "reconstruct/Reconstruct3D.hpp"
 #include "pipeline/FrameFeatureExtractor.hpp"
+#include "pipeline/KeyPointGrid.hpp"
 
 namespace System
 {
@@ -61,20 +64,78 @@ namespace System
         /// \param disparity The disparity image used for depth estimation
         /// \param featureExtractor Shared ptr to a 2D feature extractor
         /// \param reconstructor Shared ptr to a set-up 3D reconstructor
-        TrackingFrame(const cv::Mat& cameraImage, const cv::Mat& disparity, std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor, const GPS& gps);
+        /// \param rightDisparity Optional right disparity image for the left-right consistency check
+        TrackingFrame(const cv::Mat& cameraImage, const cv::Mat& disparity, std::shared_ptr<Pipeline::FrameFeatureExtractor> featureExtractor,
+                      std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor, const GPS& gps, const cv::Mat& rightDisparity = cv::Mat());
+
+        /// Construct a frame for sparse stereo tracking. Feature depths come from matching the features of the right image,
+        /// the dense disparity is only set if the frame becomes a keyframe (see SetDisparity)
+        /// \param cameraImage The rectified left camera image (RGB)
+        /// \param featureExtractor Shared ptr to a 2D feature extractor
+        /// \param reconstructor Shared ptr to a set-up 3D reconstructor
+        /// \param rightImage The rectified right camera image
+        TrackingFrame(const cv::Mat& cameraImage, std::shared_ptr<Pipeline::FrameFeatureExtractor> featureExtractor,
+                      std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor, const GPS& gps, const cv::Mat& rightImage);
 
         ~TrackingFrame() = default;
         
+        TrackingFrame(const TrackingFrame&) = delete;
+        TrackingFrame& operator=(const TrackingFrame&) = delete;
+        
         size_t GetID() const;
         
-        pcl::PointCloud<pcl::PointXYZRGB>::Ptr GetDensePointCloud() const;
+        /// Set the dense disparity of a frame constructed for sparse tracking, e.g. once it is selected as a keyframe
+        /// \param disparity The disparity image used for depth estimation
+        /// \param rightDisparity Optional right disparity image for the left-right consistency check
+        void SetDisparity(const cv::Mat& disparity, const cv::Mat& rightDisparity = cv::Mat());
+        
+        /// \return True if the frame has a dense disparity
+        bool HasDisparity() const;
+        
+        /// Dense point cloud of the frame in camera space. Triangulated on first use and cached until released
+        /// \return The cached dense point cloud
+        pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr GetDensePointCloud() const;
+        
+        /// Release the cached dense point cloud, e.g. once it has been inserted into the map
+        void ReleaseDensePointCloud();
         
+        /// Release the right image and its features of a frame constructed for sparse tracking, e.g. once it has been tracked
+        /// without becoming a keyframe. The feature depths can no longer be computed from the right image afterwards
+        void ReleaseRightImage() const;
+        
+        /// \return The mask of pixels with a valid disparity (CV_8U, 255 where valid), unpacked from the stored bit mask
         cv::Mat GetCameraImageMask() const;
         
+        /// \return The colour camera image kept for texturing (may be downscaled from the disparity resolution)
         cv::Mat GetCameraImage() const;
         
+        /// \param level The pyramid level (0 is the disparity resolution)
+        /// \return The greyscale image used for tracking at the given pyramid level
+        cv::Mat GetGreyImage(int level = 0) const;
+        
+        /// \return The greyscale tracking pyramid
+        const std::vector<cv::Mat>& GetGreyPyramid() const;
+        
+        /// \return The pruned disparity in 16x fixed point (CV_16S), 0 where rejected
         cv::Mat GetDisparity() const;
         
+        /// Keypoints detected within the valid disparity mask. Computed on first use and cached
+        /// \return The cached keypoints
+        const std::vector<cv::KeyPoint>& GetFeatureKeypoints() const;
+        
+        /// Descriptors of the cached keypoints, one row per keypoint
+        /// \return The cached descriptors
+        cv::Mat GetFeatureDescriptors() const;
+        
+        /// Grid index of the cached keypoints for matching within predicted windows
+        /// \return The cached keypoint grid
+        const Pipeline::KeyPointGrid& GetFeatureGrid() const;
+        
+        /// Stereo triangulated 3D points of the cached keypoints in camera space (y-up), from the right image features for frames
+        /// constructed for sparse tracking, otherwise from the dense disparity. Computed on first use and cached
+        /// \return The 3D points, index aligned with GetFeatureKeypoints
+        const std::vector<pcl::PointXYZRGB>& GetFeaturePoints3D() const;
+        
         float DistanceFrom(const TrackingFrame& other);
         
         void SetTrackedPose(const Eigen::Matrix4f& pose);
@@ -88,19 +149,44 @@ namespace System
         bool operator==(const TrackingFrame& other) const;
 
     private:
-        void PruneDisparityImage(cv::Mat& disparity, cv::Mat& mask) const;
-        void SetupFrame();
+        void SetupFrame(const cv::Mat& disparity, const cv::Mat& rightDisparity);
+        void ComputeFeatures() const;
+        void ComputeFeaturePoints3D() const;
+        void BuildGreyPyramid(const cv::Mat& cameraImage);
+        static cv::Mat PackMask(const cv::Mat& mask);
+        static cv::Mat UnpackMask(const cv::Mat& packedMask, int cols);
 
     private:
+        std::shared_ptr<Pipeline::FrameFeatureExtractor> m_FeatureExtractor;
         std::shared_ptr<Reconstruct::Reconstruct3D> m_3DReconstructor;
 
     private:
         size_t m_ID { 0 };
+        std::vector<cv::Mat> m_GreyPyramid;
         cv::Mat m_CameraImage;
         cv::Mat m_Disparity;
-        cv::Mat m_Mask;
+        cv::Mat m_PackedMask;
+        
+        // right image and features for sparse stereo, released once the feature depths are computed
+        mutable cv::Mat m_RightGreyImage;
+        mutable std::vector<cv::KeyPoint> m_RightFeatureKeypoints;
+        mutable cv::Mat m_RightFeatureDescriptors;
         GPS m_GPSLocation;
         
+    private:
+        // dense point cloud, triangulated on demand
+        mutable std::mutex m_DenseCloudMutex;
+        mutable pcl::PointCloud<pcl::PointXYZRGB>::Ptr m_DenseCloud;
+        
+    private:
+        // lazily computed feature cache
+        mutable std::once_flag m_FeaturesComputed;
+        mutable std::once_flag m_FeaturePoints3DComputed;
+        mutable std::vector<cv::KeyPoint> m_FeatureKeypoints;
+        mutable cv::Mat m_FeatureDescriptors;
+        mutable Pipeline::KeyPointGrid m_FeatureGrid;
+        mutable std::vector<pcl::PointXYZRGB> m_FeaturePoints3D;
+        
     private:
         Eigen::Matrix4f m_EstimatedPose = Eigen::Matrix4f::Identity();
     };
@@ -8,6 +8,10 @@
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/calib3d/calib3d.hpp>
 #include <opencv2/core/eigen.hpp>
+#include <opencv2/core/utility.hpp>
+
+#include <algorithm>
+#include <cmath>
 
 namespace Camera
 {
@@ -65,14 +69,22 @@ namespace Camera
         // use ORB feature descriptor
         cv::Ptr<cv::ORB> orb = cv::ORB::create();
 
-        std::vector<cv::KeyPoint> keypointsLeft;
-        std::vector<cv::KeyPoint> keypointsRight;
+        const cv::Mat images[2] = { leftImage, rightImage };
+        std::vector<cv::KeyPoint> keypoints[2];
+        cv::Mat descriptors[2];
 
-        cv::Mat descLeft; cv::Mat descRight;
+        // detect keypoints in both images in parallel
+        cv::parallel_for_(cv::Range(0, 2), [&](const cv::Range& range)
+        {
+            for (int i = range.start; i < range.end; i++) {
+                orb->detectAndCompute(images[i], cv::noArray(), keypoints[i], descriptors[i]);
+            }
+        });
 
-        // detect keypoints
-        orb->detectAndCompute(leftImage, cv::noArray(), keypointsLeft, descLeft);
-        orb->detectAndCompute(leftImage, cv::noArray(), keypointsRight, descRight);
+        const std::vector<cv::KeyPoint>& keypointsLeft = keypoints[0];
+        const std::vector<cv::KeyPoint>& keypointsRight = keypoints[1];
+        const cv::Mat& descLeft = descriptors[0];
+        const cv::Mat& descRight = descriptors[1];
 
         // form correspondences based on 2 nearest neighbours in matches
         cv::BFMatcher matcher(cv::NORM_HAMMING);
@@ -83,6 +95,10 @@ namespace Camera
 
         for (size_t i = 0; i < matches.size(); i++)
         {
+            if (matches[i].size() < 2) {
+                continue;
+            }
+
             cv::DMatch firstMatch = matches[i][0];
 
             float distance1 = matches[i][0].distance;
@@ -136,4 +152,63 @@ namespace Camera
     {
         return m_StereoSettings;
     }
+
+    // Scale stereo calib to a new image resolution
+    // pixel centres map as u' = s * u + (s - 1) / 2, as done by cv::resize
+    Calib::StereoCalib CameraCompute::ScaleStereoCalib(const Calib::StereoCalib& calib, float scale)
+    {
+        Calib::StereoCalib scaled = calib;
+        if (scale == 1.0f) {
+            return scaled;
+        }
+
+        const double s = scale;
+        const double offset = (s - 1.0) / 2.0;
+
+        // image point transform (A) and its inverse applied to the (u, v, d) inputs of Q
+        cv::Mat A = (cv::Mat_<double>(3, 3) << s, 0, offset, 0, s, offset, 0, 0, 1);
+        cv::Mat B = (cv::Mat_<double>(4, 4) << 1 / s, 0, 0, -offset / s, 0, 1 / s, 0, -offset / s, 0, 0, 1 / s, 0, 0, 0, 0, 1);
+
+        Eigen::Matrix3f AEigen;
+        cv::cv2eigen(A, AEigen);
+
+        for (Calib::CameraCalib* camera : { &scaled.LeftCameraCalib, &scaled.RightCameraCalib })
+        {
+            camera->K = AEigen * camera->K;
+            camera->ImageResolutionInPixels(0) = static_cast<int>(std::lround(camera->ImageResolutionInPixels(0) * s));
+            camera->ImageResolutionInPixels(1) = static_cast<int>(std::lround(camera->ImageResolutionInPixels(1) * s));
+        }
+
+        // rectified projections and disparity-to-depth mapping (new matrices, not shared with the input calib)
+        Calib::StereoRectification& rectification = scaled.Rectification;
+        cv::Mat matrix;
+        if (!rectification.PL.empty()) {
+            calib.Rectification.PL.convertTo(matrix, CV_64F);
+            rectification.PL = A * matrix;
+        }
+        if (!rectification.PR.empty()) {
+            calib.Rectification.PR.convertTo(matrix, CV_64F);
+            rectification.PR = A * matrix;
+        }
+        if (!rectification.Q.empty()) {
+            calib.Rectification.Q.convertTo(matrix, CV_64F);
+            rectification.Q = matrix * B;
+        }
+
+        // valid regions shrink inwards so they stay valid
+        for (cv::Rect* rect : { &rectification.ValidRectLeft, &rectification.ValidRectRight })
+        {
+            if (rect->area() == 0) {
+                continue;
+            }
+
+            int x0 = static_cast<int>(std::ceil(rect->x * s));
+            int y0 = static_cast<int>(std::ceil(rect->y * s));
+            int x1 = static_cast<int>(std::floor((rect->x + rect->width) * s));
+            int y1 = static_cast<int>(std::floor((rect->y + rect->height) * s));
+            *rect = cv::Rect(x0, y0, std::max(0, x1 - x0), std::max(0, y1 - y0));
+        }
+
+        return scaled;
+    }
 }
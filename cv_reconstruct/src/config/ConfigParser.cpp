@@ -38,6 +38,12 @@ namespace Config
         nlohmann::json reconstructionConfig = json["config"]["reconstruction"];
         config.Reconstruction.ShouldRectifyImages = reconstructionConfig["requires_rectification"];
 
+        // processing scales
+        nlohmann::json scaleConfig = reconstructionConfig.value("scale", nlohmann::json::object());
+        config.Reconstruction.Scale.Disparity = scaleConfig.value("disparity", config.Reconstruction.Scale.Disparity);
+        config.Reconstruction.Scale.DenseMapping = scaleConfig.value("dense_mapping", config.Reconstruction.Scale.DenseMapping);
+        config.Reconstruction.Scale.Texture = scaleConfig.value("texture", config.Reconstruction.Scale.Texture);
+
         // block matcher parsed into enum
         std::string bmTypeString = reconstructionConfig["block_matcher"];
         if (bmTypeString == "stereo_bm") {
@@ -46,6 +52,9 @@ namespace Config
         else if (bmTypeString == "stereo_sgbm") {
             config.Reconstruction.BlockMatcherType = Reconstruct::StereoBlockMatcherType::STEREO_SEMI_GLOBAL_BLOCK_MATCHER;
         }
+        else if (bmTypeString == "stereo_csgm") {
+            config.Reconstruction.BlockMatcherType = Reconstruct::StereoBlockMatcherType::STEREO_CENSUS_SEMI_GLOBAL_MATCHER;
+        }
         else {
             config.Reconstruction.BlockMatcherType = Reconstruct::StereoBlockMatcherType::STEREO_BLOCK_MATCHER;
         }
@@ -63,6 +72,100 @@ namespace Config
         config.Reconstruction.SGBM.MinDisparity = reconstructionConfig["SGBM"]["min_disparity"];
         config.Reconstruction.SGBM.NumDisparities = reconstructionConfig["SGBM"]["num_disparities"];
 
+        // census semi-global stereo matcher
+        nlohmann::json csgmConfig = reconstructionConfig.value("CSGM", nlohmann::json::object());
+        config.Reconstruction.CSGM.NumDisparities = csgmConfig.value("num_disparities", config.Reconstruction.CSGM.NumDisparities);
+        config.Reconstruction.CSGM.MinDisparity = csgmConfig.value("min_disparity", config.Reconstruction.CSGM.MinDisparity);
+        config.Reconstruction.CSGM.P1 = csgmConfig.value("p1", config.Reconstruction.CSGM.P1);
+        config.Reconstruction.CSGM.P2 = csgmConfig.value("p2", config.Reconstruction.CSGM.P2);
+        config.Reconstruction.CSGM.NumPaths = csgmConfig.value("num_paths", config.Reconstruction.CSGM.NumPaths);
+        config.Reconstruction.CSGM.UniquenessRatio = csgmConfig.value("uniqueness_ratio", config.Reconstruction.CSGM.UniquenessRatio);
+        config.Reconstruction.CSGM.Disp12MaxDiff = csgmConfig.value("disp12_max_diff", config.Reconstruction.CSGM.Disp12MaxDiff);
+        config.Reconstruction.CSGM.SpeckleRange = csgmConfig.value("speckle_range", config.Reconstruction.CSGM.SpeckleRange);
+        config.Reconstruction.CSGM.SpeckleWindowSize = csgmConfig.value("speckle_window_size", config.Reconstruction.CSGM.SpeckleWindowSize);
+
+        // coarse-to-fine disparity
+        nlohmann::json hierarchicalConfig = reconstructionConfig.value("hierarchical", nlohmann::json::object());
+        config.Reconstruction.Hierarchical.Enabled = hierarchicalConfig.value("enabled", config.Reconstruction.Hierarchical.Enabled);
+        config.Reconstruction.Hierarchical.SearchBand = hierarchicalConfig.value("search_band", config.Reconstruction.Hierarchical.SearchBand);
+        config.Reconstruction.Hierarchical.WindowRadius = hierarchicalConfig.value("window_radius", config.Reconstruction.Hierarchical.WindowRadius);
+
+        // temporal disparity prior
+        nlohmann::json temporalPriorConfig = reconstructionConfig.value("temporal_prior", nlohmann::json::object());
+        config.Reconstruction.TemporalPrior.Enabled = temporalPriorConfig.value("enabled", config.Reconstruction.TemporalPrior.Enabled);
+        config.Reconstruction.TemporalPrior.SearchBand = temporalPriorConfig.value("search_band", config.Reconstruction.TemporalPrior.SearchBand);
+        config.Reconstruction.TemporalPrior.WindowRadius = temporalPriorConfig.value("window_radius", config.Reconstruction.TemporalPrior.WindowRadius);
+        config.Reconstruction.TemporalPrior.RefreshInterval = temporalPriorConfig.value("refresh_interval", config.Reconstruction.TemporalPrior.RefreshInterval);
+
+        // semi-dense triangulation
+        nlohmann::json semiDenseConfig = reconstructionConfig.value("semi_dense", nlohmann::json::object());
+        config.Reconstruction.SemiDense.Enabled = semiDenseConfig.value("enabled", config.Reconstruction.SemiDense.Enabled);
+        config.Reconstruction.SemiDense.GradientThreshold = semiDenseConfig.value("gradient_threshold", config.Reconstruction.SemiDense.GradientThreshold);
+        config.Reconstruction.SemiDense.PointBudget = semiDenseConfig.value("point_budget", config.Reconstruction.SemiDense.PointBudget);
+
+        // disparity filter
+        nlohmann::json disparityFilterConfig = reconstructionConfig.value("disparity_filter", nlohmann::json::object());
+        config.Reconstruction.DisparityFilter.ConfidenceStdFactor = disparityFilterConfig.value("confidence_std_factor", config.Reconstruction.DisparityFilter.ConfidenceStdFactor);
+        config.Reconstruction.DisparityFilter.LeftRightCheck = disparityFilterConfig.value("left_right_check", config.Reconstruction.DisparityFilter.LeftRightCheck);
+        config.Reconstruction.DisparityFilter.Disp12MaxDiff = disparityFilterConfig.value("disp12_max_diff", config.Reconstruction.DisparityFilter.Disp12MaxDiff);
+        config.Reconstruction.DisparityFilter.SpeckleWindowSize = disparityFilterConfig.value("speckle_window_size", config.Reconstruction.DisparityFilter.SpeckleWindowSize);
+        config.Reconstruction.DisparityFilter.SpeckleRange = disparityFilterConfig.value("speckle_range", config.Reconstruction.DisparityFilter.SpeckleRange);
+
+        // 2D feature extraction
+        nlohmann::json featuresConfig = json["config"].value("features", nlohmann::json::object());
+        config.Features.Descriptor = featuresConfig.value("descriptor", config.Features.Descriptor);
+        config.Features.GridRows = featuresConfig.value("grid_rows", config.Features.GridRows);
+        config.Features.GridCols = featuresConfig.value("grid_cols", config.Features.GridCols);
+        config.Features.MaxFeatures = featuresConfig.value("max_features", config.Features.MaxFeatures);
+        config.Features.FastThreshold = featuresConfig.value("fast_threshold", config.Features.FastThreshold);
+        config.Features.MatchRatio = featuresConfig.value("match_ratio", config.Features.MatchRatio);
+        config.Features.CrossCheck = featuresConfig.value("cross_check", config.Features.CrossCheck);
+
+        // keyframe selection
+        nlohmann::json trackingConfig = json["config"].value("tracking", nlohmann::json::object());
+        config.Tracking.MinTrackedOverlap = trackingConfig.value("min_tracked_overlap", config.Tracking.MinTrackedOverlap);
+        config.Tracking.MinMedianParallax = trackingConfig.value("min_median_parallax", config.Tracking.MinMedianParallax);
+        config.Tracking.MaxRotationDegrees = trackingConfig.value("max_rotation_degrees", config.Tracking.MaxRotationDegrees);
+        config.Tracking.MatchSearchRadius = trackingConfig.value("match_search_radius", config.Tracking.MatchSearchRadius);
+        config.Tracking.SparseStereo = trackingConfig.value("sparse_stereo", config.Tracking.SparseStereo);
+
+        // optical flow
+        nlohmann::json opticalFlowConfig = json["config"].value("optical_flow", nlohmann::json::object());
+        config.OpticalFlow.Mode = opticalFlowConfig.value("mode", config.OpticalFlow.Mode);
+        config.OpticalFlow.DenseScale = opticalFlowConfig.value("dense_scale", config.OpticalFlow.DenseScale);
+        config.OpticalFlow.FlowCacheSize = opticalFlowConfig.value("flow_cache_size", config.OpticalFlow.FlowCacheSize);
+
+        // dense flow backend parsed into enum
+        std::string denseBackendString = opticalFlowConfig.value("dense_backend", std::string("farneback"));
+        if (denseBackendString == "farneback") {
+            config.OpticalFlow.DenseBackend = Features::DenseFlowBackend::DENSE_FLOW_FARNEBACK;
+        }
+        else if (denseBackendString == "dis_ultrafast") {
+            config.OpticalFlow.DenseBackend = Features::DenseFlowBackend::DENSE_FLOW_DIS_ULTRAFAST;
+        }
+        else if (denseBackendString == "dis_fast") {
+            config.OpticalFlow.DenseBackend = Features::DenseFlowBackend::DENSE_FLOW_DIS_FAST;
+        }
+        else if (denseBackendString == "dis_medium") {
+            config.OpticalFlow.DenseBackend = Features::DenseFlowBackend::DENSE_FLOW_DIS_MEDIUM;
+        }
+        else {
+            config.OpticalFlow.DenseBackend = Features::DenseFlowBackend::DENSE_FLOW_FARNEBACK;
+        }
+
+        config.OpticalFlow.MaxTracks = opticalFlowConfig.value("max_tracks", config.OpticalFlow.MaxTracks);
+        config.OpticalFlow.CellSize = opticalFlowConfig.value("cell_size", config.OpticalFlow.CellSize);
+        config.OpticalFlow.WindowSize = opticalFlowConfig.value("window_size", config.OpticalFlow.WindowSize);
+        config.OpticalFlow.PyramidLevels = opticalFlowConfig.value("pyramid_levels", config.OpticalFlow.PyramidLevels);
+        config.OpticalFlow.MaxForwardBackwardError = opticalFlowConfig.value("max_forward_backward_error", config.OpticalFlow.MaxForwardBackwardError);
+
+        // keyframe persistence
+        nlohmann::json keyFrameConfig = json["config"].value("keyframe_database", nlohmann::json::object());
+        config.KeyFrameDatabase.PersistImages = keyFrameConfig.value("persist_images", config.KeyFrameDatabase.PersistImages);
+        config.KeyFrameDatabase.ImageFormat = keyFrameConfig.value("image_format", config.KeyFrameDatabase.ImageFormat);
+        config.KeyFrameDatabase.CompressionLevel = keyFrameConfig.value("compression_level", config.KeyFrameDatabase.CompressionLevel);
+        config.KeyFrameDatabase.MaxQueuedWrites = keyFrameConfig.value("max_queued_writes", config.KeyFrameDatabase.MaxQueuedWrites);
+
         return config;
     }
 }
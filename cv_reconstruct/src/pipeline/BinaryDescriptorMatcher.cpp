@@ -0,0 +1,328 @@
+//
+// BinaryDescriptorMatcher.cpp
+// Matches binary descriptors (ORB, BRISK) by Hamming distance with a multi-index hash for candidate generation,
+// a Lowe ratio test and an optional cross-check
+//
+
+#include "pipeline/BinaryDescriptorMatcher.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <limits>
+
+#include <opencv2/core/utility.hpp>
+#include <opencv2/core/hal/hal.hpp>
+
+// descriptors are hashed by substrings of about log2(count) bits: bytes below this count, 16 bit words from it
+#define WIDE_SUBSTRING_MIN_DESCRIPTORS 1024
+
+// distance used when there is no neighbour
+#define NO_DISTANCE std::numeric_limits<int>::max()
+
+// largest Hamming radius searched around each query substring before falling back to a linear scan
+#define MAX_SUBSTRING_RADIUS 2
+
+namespace Pipeline
+{
+    namespace
+    {
+        // The substring masks of each Hamming radius up to the largest searched, for 8 (bytes = 1) or 16 (bytes = 2) bit substrings
+        const std::vector<std::vector<int>>& SubstringMasksByRadius(int bytes)
+        {
+            auto build = [](int bits)
+            {
+                std::vector<std::vector<int>> byRadius(MAX_SUBSTRING_RADIUS + 1);
+                for (int v = 0; v < (1 << bits); v++)
+                {
+                    const int radius = __builtin_popcount(v);
+                    if (radius <= MAX_SUBSTRING_RADIUS) {
+                        byRadius[radius].push_back(v);
+                    }
+                }
+                return byRadius;
+            };
+
+            static const std::vector<std::vector<int>> byteMasks = build(8);
+            static const std::vector<std::vector<int>> wordMasks = build(16);
+
+            return (bytes == 1) ? byteMasks : wordMasks;
+        }
+
+        // Value of a substring of the descriptor
+        inline int Substring(const uchar* descriptor, int substring, int bytes) {
+            return (bytes == 1) ? descriptor[substring] : (descriptor[2 * substring] | (descriptor[2 * substring + 1] << 8));
+        }
+    }
+
+    // Constructor
+    BinaryDescriptorMatcher::BinaryDescriptorMatcher(float ratio, bool crossCheck) : m_Ratio(ratio), m_CrossCheck(crossCheck)
+    {
+
+    }
+
+    // Popcount of the xor, vectorised by OpenCV
+    int BinaryDescriptorMatcher::HammingDistance(const uchar* a, const uchar* b, int bytes)
+    {
+        return cv::hal::normHamming(a, b, bytes);
+    }
+
+    // Match with ratio test and cross-check
+    size_t BinaryDescriptorMatcher::Match(const cv::Mat& query, const cv::Mat& train, std::vector<cv::DMatch>& matches) const
+    {
+        matches.clear();
+
+        if (query.empty() || train.empty()) {
+            return 0;
+        }
+
+        CV_Assert(query.type() == CV_8U && train.type() == CV_8U && query.cols == train.cols);
+
+        Index trainIndex;
+        BuildIndex(train, trainIndex);
+
+        Index queryIndex;
+        if (m_CrossCheck) {
+            BuildIndex(query, queryIndex);
+        }
+
+        std::vector<cv::DMatch> queryMatches(query.rows);
+        std::atomic<size_t> distancesComputed { 0 };
+
+        cv::parallel_for_(cv::Range(0, query.rows), [&](const cv::Range& range)
+        {
+            std::vector<int> visitedTrain(train.rows, 0);
+            std::vector<int> visitedQuery(m_CrossCheck ? query.rows : 0, 0);
+            int stamp = 0;
+            size_t distances = 0;
+
+            for (int q = range.start; q < range.end; q++)
+            {
+                const Neighbours neighbours = FindNeighbours(trainIndex, train, query.ptr<uchar>(q), true, visitedTrain, ++stamp, distances);
+
+                // a match without a second neighbour can't be shown to be distinctive
+                if (neighbours.Best < 0 || neighbours.SecondDistance == NO_DISTANCE || neighbours.BestDistance >= m_Ratio * neighbours.SecondDistance) {
+                    continue;
+                }
+
+                // the query must also be the nearest neighbour of its match
+                if (m_CrossCheck) {
+                    const Neighbours reverse = FindNeighbours(queryIndex, query, train.ptr<uchar>(neighbours.Best), false, visitedQuery, stamp, distances);
+                    if (reverse.Best != q) {
+                        continue;
+                    }
+                }
+
+                queryMatches[q] = cv::DMatch(q, neighbours.Best, static_cast<float>(neighbours.BestDistance));
+            }
+
+            distancesComputed += distances;
+        });
+
+        for (const cv::DMatch& match : queryMatches)
+        {
+            if (match.trainIdx >= 0) {
+                matches.push_back(match);
+            }
+        }
+
+        return distancesComputed;
+    }
+
+    // Windowed matching
+    void BinaryDescriptorMatcher::MatchCandidates(const cv::Mat& query, const cv::Mat& train, const std::vector<std::vector<int>>& candidates, int maxDistance, std::vector<cv::DMatch>& matches) const
+    {
+        matches.clear();
+
+        if (query.empty() || train.empty()) {
+            return;
+        }
+
+        CV_Assert(query.type() == CV_8U && train.type() == CV_8U && query.cols == train.cols);
+        CV_Assert(candidates.size() == static_cast<size_t>(query.rows));
+
+        std::vector<cv::DMatch> queryMatches(query.rows);
+
+        cv::parallel_for_(cv::Range(0, query.rows), [&](const cv::Range& range)
+        {
+            for (int q = range.start; q < range.end; q++)
+            {
+                Neighbours neighbours;
+                neighbours.BestDistance = NO_DISTANCE;
+                neighbours.SecondDistance = NO_DISTANCE;
+
+                for (int i : candidates[q])
+                {
+                    const int distance = HammingDistance(query.ptr<uchar>(q), train.ptr<uchar>(i), query.cols);
+                    if (distance < neighbours.BestDistance) {
+                        neighbours.SecondDistance = neighbours.BestDistance;
+                        neighbours.BestDistance = distance;
+                        neighbours.Best = i;
+                    }
+                    else if (distance < neighbours.SecondDistance) {
+                        neighbours.SecondDistance = distance;
+                    }
+                }
+
+                if (neighbours.Best < 0 || neighbours.BestDistance > maxDistance) {
+                    continue;
+                }
+
+                if (neighbours.SecondDistance != NO_DISTANCE && neighbours.BestDistance >= m_Ratio * neighbours.SecondDistance) {
+                    continue;
+                }
+
+                queryMatches[q] = cv::DMatch(q, neighbours.Best, static_cast<float>(neighbours.BestDistance));
+            }
+        });
+
+        // one match per train descriptor, the closest query wins
+        std::vector<int> trainMatch(train.rows, -1);
+        for (int q = 0; q < query.rows; q++)
+        {
+            const cv::DMatch& match = queryMatches[q];
+            if (match.trainIdx < 0) {
+                continue;
+            }
+
+            int& current = trainMatch[match.trainIdx];
+            if (current < 0 || match.distance < queryMatches[current].distance) {
+                current = q;
+            }
+        }
+
+        for (int q = 0; q < query.rows; q++)
+        {
+            if (queryMatches[q].trainIdx >= 0 && trainMatch[queryMatches[q].trainIdx] == q) {
+                matches.push_back(queryMatches[q]);
+            }
+        }
+    }
+
+    // Counting sort of the descriptors into one table per substring
+    void BinaryDescriptorMatcher::BuildIndex(const cv::Mat& descriptors, Index& index)
+    {
+        const int count = descriptors.rows;
+        index.Bytes = descriptors.cols;
+        index.SubstringBytes = (count >= WIDE_SUBSTRING_MIN_DESCRIPTORS && index.Bytes % 2 == 0) ? 2 : 1;
+        index.Substrings = index.Bytes / index.SubstringBytes;
+        index.Buckets = 1 << (8 * index.SubstringBytes);
+        index.Offsets.assign(static_cast<size_t>(index.Substrings) * (index.Buckets + 1), 0);
+        index.Entries.resize(static_cast<size_t>(index.Substrings) * count);
+
+        for (int i = 0; i < count; i++)
+        {
+            const uchar* d = descriptors.ptr<uchar>(i);
+            for (int s = 0; s < index.Substrings; s++) {
+                index.Offsets[static_cast<size_t>(s) * (index.Buckets + 1) + Substring(d, s, index.SubstringBytes) + 1]++;
+            }
+        }
+
+        // offsets of each bucket into the entries
+        for (int s = 0; s < index.Substrings; s++)
+        {
+            int* offsets = &index.Offsets[static_cast<size_t>(s) * (index.Buckets + 1)];
+            offsets[0] = s * count;
+            for (int v = 1; v <= index.Buckets; v++) {
+                offsets[v] += offsets[v - 1];
+            }
+        }
+
+        std::vector<int> fill(index.Offsets);
+        for (int i = 0; i < count; i++)
+        {
+            const uchar* d = descriptors.ptr<uchar>(i);
+            for (int s = 0; s < index.Substrings; s++) {
+                index.Entries[fill[static_cast<size_t>(s) * (index.Buckets + 1) + Substring(d, s, index.SubstringBytes)]++] = i;
+            }
+        }
+    }
+
+    // Nearest neighbours by multi-index hashing: the buckets within Hamming radius k of every query substring are searched
+    // for k = 0, 1, ... A descriptor within distance Substrings * (k + 1) - 1 has at least one substring within k of the query,
+    // so the search stops as soon as the neighbours are inside that radius and falls back to a linear scan beyond it
+    BinaryDescriptorMatcher::Neighbours BinaryDescriptorMatcher::FindNeighbours(const Index& index, const cv::Mat& descriptors, const uchar* query, bool needSecond,
+                                                                               std::vector<int>& visited, int stamp, size_t& distancesComputed) const
+    {
+        Neighbours neighbours;
+        neighbours.BestDistance = NO_DISTANCE;
+        neighbours.SecondDistance = NO_DISTANCE;
+
+        const std::vector<std::vector<int>>& masksByRadius = SubstringMasksByRadius(index.SubstringBytes);
+
+        for (int radius = 0; radius <= MAX_SUBSTRING_RADIUS; radius++)
+        {
+            for (int s = 0; s < index.Substrings; s++)
+            {
+                const int* table = &index.Offsets[static_cast<size_t>(s) * (index.Buckets + 1)];
+                const int value = Substring(query, s, index.SubstringBytes);
+
+                for (int mask : masksByRadius[radius])
+                {
+                    const int* offsets = table + (value ^ mask);
+
+                    for (int e = offsets[0]; e < offsets[1]; e++)
+                    {
+                        const int i = index.Entries[e];
+                        if (visited[i] == stamp) {
+                            continue;
+                        }
+                        visited[i] = stamp;
+                        distancesComputed++;
+
+                        const int distance = HammingDistance(query, descriptors.ptr<uchar>(i), index.Bytes);
+                        if (distance < neighbours.BestDistance || (distance == neighbours.BestDistance && i < neighbours.Best)) {
+                            neighbours.SecondDistance = neighbours.BestDistance;
+                            neighbours.BestDistance = distance;
+                            neighbours.Best = i;
+                        }
+                        else if (distance < neighbours.SecondDistance) {
+                            neighbours.SecondDistance = distance;
+                        }
+                    }
+                }
+            }
+
+            // descriptors not found yet are at least this far away
+            const int guaranteedRadius = index.Substrings * (radius + 1) - 1;
+
+            if (neighbours.BestDistance > guaranteedRadius) {
+                continue;
+            }
+
+            if (!needSecond || descriptors.rows < 2 || neighbours.SecondDistance <= guaranteedRadius) {
+                return neighbours;
+            }
+
+            // the lower bound on the second distance is enough when the ratio test passes with it
+            if (neighbours.BestDistance < m_Ratio * (guaranteedRadius + 1)) {
+                neighbours.SecondDistance = guaranteedRadius + 1;
+                return neighbours;
+            }
+        }
+
+        LinearSearch(descriptors, query, neighbours);
+        distancesComputed += descriptors.rows;
+        return neighbours;
+    }
+
+    // Exact nearest neighbours
+    void BinaryDescriptorMatcher::LinearSearch(const cv::Mat& descriptors, const uchar* query, Neighbours& neighbours) const
+    {
+        neighbours.Best = -1;
+        neighbours.BestDistance = NO_DISTANCE;
+        neighbours.SecondDistance = NO_DISTANCE;
+
+        for (int i = 0; i < descriptors.rows; i++)
+        {
+            const int distance = HammingDistance(query, descriptors.ptr<uchar>(i), descriptors.cols);
+            if (distance < neighbours.BestDistance) {
+                neighbours.SecondDistance = neighbours.BestDistance;
+                neighbours.BestDistance = distance;
+                neighbours.Best = i;
+            }
+            else if (distance < neighbours.SecondDistance) {
+                neighbours.SecondDistance = distance;
+            }
+        }
+    }
+}
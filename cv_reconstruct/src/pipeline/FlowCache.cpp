@@ -0,0 +1,77 @@
+//
+// FlowCache.cpp
+// Bounded least recently used cache of the dense optical flow between pairs of keyframes
+//
+
+#include "pipeline/FlowCache.hpp"
+
+#include <algorithm>
+
+namespace Features
+{
+    // Constructor
+    FlowCache::FlowCache(size_t capacity) : m_Capacity(capacity)
+    {
+
+    }
+
+    // Lookup and move to the front
+    bool FlowCache::Get(size_t fromID, size_t toID, cv::Mat& flow)
+    {
+        auto it = m_Lookup.find(MakeKey(FramePair(fromID, toID)));
+        if (it == m_Lookup.end()) {
+            return false;
+        }
+
+        m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+        flow = it->second->Flow;
+
+        return true;
+    }
+
+    // Insert at the front, evicting from the back
+    void FlowCache::Insert(size_t fromID, size_t toID, const cv::Mat& flow)
+    {
+        if (m_Capacity == 0) {
+            return;
+        }
+
+        const FramePair frames(fromID, toID);
+        auto it = m_Lookup.find(MakeKey(frames));
+        if (it != m_Lookup.end())
+        {
+            it->second->Flow = flow;
+            m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+            return;
+        }
+
+        if (m_Entries.size() >= m_Capacity)
+        {
+            m_Lookup.erase(MakeKey(m_Entries.back().Frames));
+            m_Entries.pop_back();
+        }
+
+        m_Entries.push_front(Entry { frames, flow });
+        m_Lookup[MakeKey(frames)] = m_Entries.begin();
+    }
+
+    // Remove flows touching frames before the window, which sort first in the lookup
+    void FlowCache::EvictFramesBefore(size_t frameID)
+    {
+        auto end = m_Lookup.lower_bound(Key(frameID, FramePair(0, 0)));
+        for (auto it = m_Lookup.begin(); it != end; ++it) {
+            m_Entries.erase(it->second);
+        }
+        m_Lookup.erase(m_Lookup.begin(), end);
+    }
+
+    // Key ordered by the older of the two frames
+    FlowCache::Key FlowCache::MakeKey(const FramePair& frames) {
+        return Key(std::min(frames.first, frames.second), frames);
+    }
+
+    // Size
+    size_t FlowCache::Size() const {
+        return m_Entries.size();
+    }
+}
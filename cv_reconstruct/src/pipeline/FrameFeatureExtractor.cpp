@@ -3,74 +3,316 @@
 // Extracts 2D features from stereo frames
 //
 
+#include <algorithm>
+#include <cmath>
+
 #include <opencv2/flann/miniflann.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
 
 #include "pipeline/FrameFeatureExtractor.hpp"
 
-// Lowe ratio test
-#define RATIO_THRESHOLD 0.7f
+// FAST threshold used in cells where the configured threshold finds nothing
+#define MIN_FAST_THRESHOLD 7
+
+// FAST needs 3 pixels around a keypoint, cells are detected with this margin
+#define FAST_BORDER 3
+
+// size of a FAST keypoint at level 0
+#define FAST_KEYPOINT_SIZE 7.0f
+
+// keypoints are detected on each level of a half scale pyramid, the budget split over the levels like ORB's
+#define FEATURE_PYRAMID_LEVELS 3
+#define FEATURE_PYRAMID_SCALE 2.0f
+
+// maximum Hamming distance of a guided match as a share of the descriptor bits
+#define GUIDED_MAX_DISTANCE_RATIO 0.25f
+
+// ORB patch size and the radius used for the intensity centroid orientation
+#define ORB_PATCH_SIZE 31
+#define ORB_HALF_PATCH_SIZE 15
 
 namespace Pipeline
 {
     // Constructor
-    FrameFeatureExtractor::FrameFeatureExtractor()
+    FrameFeatureExtractor::FrameFeatureExtractor() : FrameFeatureExtractor(Config::Config())
+    {
+
+    }
+
+    // Constructor from config
+    FrameFeatureExtractor::FrameFeatureExtractor(const Config::Config& config)
+        : m_GridRows(std::max(config.Features.GridRows, 1)), m_GridCols(std::max(config.Features.GridCols, 1)),
+          m_MaxFeatures(std::max(config.Features.MaxFeatures, 1)), m_FastThreshold(config.Features.FastThreshold),
+          m_Matcher(config.Features.MatchRatio, config.Features.CrossCheck)
+    {
+        // descriptors for the grid detected keypoints, ORB needs its orientation computed here
+        if (config.Features.Descriptor == "brisk") {
+            m_FeatureExtractor = cv::BRISK::create();
+            m_ComputeOrientation = false;
+        }
+        else {
+            m_FeatureExtractor = cv::ORB::create(m_MaxFeatures, FEATURE_PYRAMID_SCALE, FEATURE_PYRAMID_LEVELS, ORB_PATCH_SIZE, 0, 2, cv::ORB::FAST_SCORE, ORB_PATCH_SIZE, m_FastThreshold);
+            m_ComputeOrientation = true;
+        }
+    }
+
+    // Grid bucketed FAST
+    void FrameFeatureExtractor::DetectKeypoints(const cv::Mat& image, std::vector<cv::KeyPoint>& keypoints, cv::InputArray mask) const
+    {
+        std::vector<std::vector<cv::Mat>> pyramids(1);
+        BuildPyramid(image, pyramids[0]);
+
+        std::vector<std::vector<cv::KeyPoint>> imageKeypoints;
+        DetectKeypoints(pyramids, imageKeypoints, { mask.getMat() });
+        keypoints = std::move(imageKeypoints[0]);
+    }
+
+    // Greyscale pyramid of the image
+    void FrameFeatureExtractor::BuildPyramid(const cv::Mat& image, std::vector<cv::Mat>& pyramid) const
+    {
+        cv::Mat grey;
+        if (image.channels() == 1) {
+            grey = image;
+        }
+        else {
+            cv::cvtColor(image, grey, cv::COLOR_BGR2GRAY);
+        }
+
+        cv::buildPyramid(grey, pyramid, FEATURE_PYRAMID_LEVELS - 1);
+    }
+
+    // Share of the feature budget for each pyramid level, halving with each level
+    int FrameFeatureExtractor::LevelQuota(int level, int levels) const
+    {
+        const float factor = 1.0f / FEATURE_PYRAMID_SCALE;
+        const float firstLevelQuota = m_MaxFeatures * (1.0f - factor) / (1.0f - std::pow(factor, static_cast<float>(levels)));
+
+        return std::max(cvRound(firstLevelQuota * std::pow(factor, static_cast<float>(level))), 1);
+    }
+
+    // Grid bucketed FAST over all cells of all pyramid levels of all images in one parallel loop
+    void FrameFeatureExtractor::DetectKeypoints(const std::vector<std::vector<cv::Mat>>& pyramids, std::vector<std::vector<cv::KeyPoint>>& keypoints, const std::vector<cv::Mat>& masks) const
     {
-        // setup feature detector as BRISK
-        m_FeatureExtractor = cv::BRISK::create();
+        CV_Assert(masks.empty() || masks.size() == pyramids.size());
+
+        const int imageCount = static_cast<int>(pyramids.size());
+        const int cellCount = m_GridRows * m_GridCols;
+        const int levelTasks = FEATURE_PYRAMID_LEVELS * cellCount;
+
+        // results are kept per image, level and cell and assembled in order, independent of the scheduling
+        std::vector<std::vector<cv::KeyPoint>> cellKeypoints(imageCount * levelTasks);
+
+        cv::parallel_for_(cv::Range(0, imageCount * levelTasks), [&](const cv::Range& range)
+        {
+            for (int task = range.start; task < range.end; task++)
+            {
+                const int i = task / levelTasks;
+                const int level = (task % levelTasks) / cellCount;
+                const int levels = std::min(static_cast<int>(pyramids[i].size()), FEATURE_PYRAMID_LEVELS);
+                if (level >= levels) {
+                    continue;
+                }
 
-        // setup BF matcher
-        m_BFMatcher = cv::BFMatcher::create(cv::NORM_HAMMING, false);
+                const int cellQuota = (LevelQuota(level, levels) + cellCount - 1) / cellCount;
+                DetectCellKeypoints(pyramids[i][level], masks.empty() ? cv::Mat() : masks[i], level, task % cellCount, cellQuota, cellKeypoints[task]);
+            }
+        });
+
+        keypoints.assign(imageCount, std::vector<cv::KeyPoint>());
+        for (int i = 0; i < imageCount; i++)
+        {
+            keypoints[i].reserve(m_MaxFeatures);
+            for (int task = 0; task < levelTasks; task++) {
+                const std::vector<cv::KeyPoint>& kept = cellKeypoints[i * levelTasks + task];
+                keypoints[i].insert(keypoints[i].end(), kept.begin(), kept.end());
+            }
+
+            if (m_ComputeOrientation) {
+                ComputeOrientations(pyramids[i], keypoints[i]);
+            }
+        }
+    }
+
+    // FAST in one grid cell of a pyramid level, keeping the strongest keypoints up to the cell's share of the budget.
+    // Keypoints are returned in level 0 coordinates with their level as the octave
+    void FrameFeatureExtractor::DetectCellKeypoints(const cv::Mat& grey, const cv::Mat& mask, int level, int cell, int cellQuota, std::vector<cv::KeyPoint>& kept) const
+    {
+        const cv::Rect imageRect(0, 0, grey.cols, grey.rows);
+        const float scale = std::pow(FEATURE_PYRAMID_SCALE, static_cast<float>(level));
+
+        const int row = cell / m_GridCols;
+        const int col = cell % m_GridCols;
+
+        const cv::Rect cellRect(col * grey.cols / m_GridCols, row * grey.rows / m_GridRows,
+                                (col + 1) * grey.cols / m_GridCols - col * grey.cols / m_GridCols,
+                                (row + 1) * grey.rows / m_GridRows - row * grey.rows / m_GridRows);
+
+        if (cellRect.area() == 0) {
+            return;
+        }
+
+        // detect with a margin so keypoints on the cell edges are found
+        const cv::Rect detectRect = (cellRect + cv::Size(2 * FAST_BORDER, 2 * FAST_BORDER) - cv::Point(FAST_BORDER, FAST_BORDER)) & imageRect;
+
+        std::vector<cv::KeyPoint> detected;
+        cv::FAST(grey(detectRect), detected, m_FastThreshold, true);
+        if (detected.empty() && m_FastThreshold > MIN_FAST_THRESHOLD) {
+            cv::FAST(grey(detectRect), detected, MIN_FAST_THRESHOLD, true);
+        }
+
+        // keep keypoints inside the cell (and the level 0 mask)
+        for (cv::KeyPoint& kp : detected)
+        {
+            kp.pt.x += detectRect.x;
+            kp.pt.y += detectRect.y;
+
+            const cv::Point p(static_cast<int>(kp.pt.x), static_cast<int>(kp.pt.y));
+            if (!cellRect.contains(p)) {
+                continue;
+            }
+
+            kp.pt *= scale;
+            kp.size = FAST_KEYPOINT_SIZE * scale;
+            kp.octave = level;
+
+            if (!mask.empty())
+            {
+                const int x = std::min(static_cast<int>(kp.pt.x), mask.cols - 1);
+                const int y = std::min(static_cast<int>(kp.pt.y), mask.rows - 1);
+                if (mask.at<uchar>(y, x) == 0) {
+                    continue;
+                }
+            }
+
+            kept.push_back(kp);
+        }
+
+        // strongest keypoints up to the cell's share of the budget
+        cv::KeyPointsFilter::retainBest(kept, cellQuota);
+        if (static_cast<int>(kept.size()) > cellQuota) {
+            kept.resize(cellQuota);
+        }
+    }
+
+    // Intensity centroid orientation and ORB patch size for FAST keypoints
+    void FrameFeatureExtractor::ComputeOrientations(const std::vector<cv::Mat>& pyramid, std::vector<cv::KeyPoint>& keypoints) const
+    {
+        // half width of each row of the circular patch
+        std::vector<int> umax(ORB_HALF_PATCH_SIZE + 1);
+        for (int v = 0; v <= ORB_HALF_PATCH_SIZE; v++) {
+            umax[v] = cvFloor(std::sqrt(static_cast<double>(ORB_HALF_PATCH_SIZE * ORB_HALF_PATCH_SIZE - v * v)));
+        }
+
+        cv::parallel_for_(cv::Range(0, static_cast<int>(keypoints.size())), [&](const cv::Range& range)
+        {
+            for (int i = range.start; i < range.end; i++)
+            {
+                // the patch is taken from the keypoint's level, as ORB does
+                cv::KeyPoint& kp = keypoints[i];
+                const cv::Mat& image = pyramid[kp.octave];
+                const float scale = std::pow(FEATURE_PYRAMID_SCALE, static_cast<float>(kp.octave));
+                kp.size = ORB_PATCH_SIZE * scale;
+
+                const int x = cvRound(kp.pt.x / scale);
+                const int y = cvRound(kp.pt.y / scale);
+
+                // too close to the border for a full patch, the descriptor drops it anyway
+                if (x < ORB_HALF_PATCH_SIZE || y < ORB_HALF_PATCH_SIZE || x >= image.cols - ORB_HALF_PATCH_SIZE || y >= image.rows - ORB_HALF_PATCH_SIZE) {
+                    kp.angle = 0.0f;
+                    continue;
+                }
+
+                int m01 = 0;
+                int m10 = 0;
+                for (int v = -ORB_HALF_PATCH_SIZE; v <= ORB_HALF_PATCH_SIZE; v++)
+                {
+                    const uchar* row = image.ptr<uchar>(y + v);
+                    const int d = umax[std::abs(v)];
+                    for (int u = -d; u <= d; u++) {
+                        m10 += u * row[x + u];
+                        m01 += v * row[x + u];
+                    }
+                }
+
+                kp.angle = cv::fastAtan2(static_cast<float>(m01), static_cast<float>(m10));
+            }
+        });
     }
 
     // Find correspondences
     void FrameFeatureExtractor::ComputeCorrespondences(const cv::Mat& image1, const cv::Mat& image2, std::vector<cv::KeyPoint>& keypoints1, std::vector<cv::KeyPoint>& keypoints2, std::vector<cv::DMatch>& matches) const
     {
-        // image 1 features
-        cv::Mat descriptors1;
-        m_FeatureExtractor->detectAndCompute(image1, cv::noArray(), keypoints1, descriptors1, false);
+        // features of both images in parallel
+        std::vector<std::vector<cv::KeyPoint>> keypoints;
+        std::vector<cv::Mat> descriptors;
+        ComputeFeaturesFromImages({ image1, image2 }, keypoints, descriptors);
 
-        // image 2 features
-        cv::Mat descriptors2;
-        m_FeatureExtractor->detectAndCompute(image2, cv::noArray(), keypoints2, descriptors2, false);
+        keypoints1 = std::move(keypoints[0]);
+        keypoints2 = std::move(keypoints[1]);
 
-        // feature matching
-        std::vector<std::vector<cv::DMatch>> allMatches;
-        m_BFMatcher->knnMatch(descriptors1, descriptors2, allMatches, 2);
+        // feature matching with Lowe ratio test
+        m_Matcher.Match(descriptors[0], descriptors[1], matches);
+    }
 
-        // filter using Lowe ratio test
-        FilterForGoodMatches(allMatches, matches);
+    // Correspondences between consecutive images
+    void FrameFeatureExtractor::ComputeCorrespondences(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::KeyPoint>>& keypoints, std::vector<std::vector<cv::DMatch>>& matches) const
+    {
+        std::vector<cv::Mat> descriptors;
+        ComputeFeaturesFromImages(images, keypoints, descriptors);
+
+        // each pair is matched independently
+        const int pairCount = std::max(static_cast<int>(images.size()) - 1, 0);
+        matches.assign(pairCount, std::vector<cv::DMatch>());
+
+        cv::parallel_for_(cv::Range(0, pairCount), [&](const cv::Range& range)
+        {
+            for (int i = range.start; i < range.end; i++) {
+                m_Matcher.Match(descriptors[i], descriptors[i + 1], matches[i]);
+            }
+        });
     }
 
     void FrameFeatureExtractor::ComputeCorrespondences(const cv::Mat& d1, const cv::Mat& d2, std::vector<cv::DMatch>& matches) const
     {
-        // feature matching
-        std::vector<std::vector<cv::DMatch>> allMatches;
-        m_BFMatcher->knnMatch(d1, d2, allMatches, 2);
+        // feature matching with Lowe ratio test
+        m_Matcher.Match(d1, d2, matches);
+    }
 
-        // filter using Lowe ratio test
-        FilterForGoodMatches(allMatches, matches);
+    // Match within windows around the predicted pixels
+    void FrameFeatureExtractor::ComputeGuidedCorrespondences(const cv::Mat& d1, const cv::Mat& d2, const std::vector<cv::Point2f>& predicted, const KeyPointGrid& grid2, float radius, std::vector<cv::DMatch>& matches) const
+    {
+        CV_Assert(predicted.size() == static_cast<size_t>(d1.rows));
+
+        // candidate keypoints of image 2 for each descriptor of image 1
+        std::vector<std::vector<int>> candidates(d1.rows);
+
+        cv::parallel_for_(cv::Range(0, d1.rows), [&](const cv::Range& range)
+        {
+            for (int i = range.start; i < range.end; i++) {
+                grid2.GetKeypointsInRadius(predicted[i], radius, candidates[i]);
+            }
+        });
+
+        const int maxDistance = static_cast<int>(GUIDED_MAX_DISTANCE_RATIO * d1.cols * 8);
+        m_Matcher.MatchCandidates(d1, d2, candidates, maxDistance, matches);
     }
 
     void FrameFeatureExtractor::ComputeCorrespondences(const cv::Mat& image1, const cv::Mat& image2, std::vector<cv::KeyPoint>& kp1, std::vector<cv::KeyPoint>& kp2, cv::InputArray mask1, cv::InputArray mask2) const
     {
-        // feature matching
-        std::vector<cv::KeyPoint> points1; std::vector<cv::KeyPoint> points2;
-        cv::Mat descriptors1; cv::Mat descriptors2;
-        
-        m_FeatureExtractor->detectAndCompute(image1, mask1, points1, descriptors1);
-        m_FeatureExtractor->detectAndCompute(image2, mask2, points2, descriptors2);
+        // features of both images in parallel
+        std::vector<std::vector<cv::KeyPoint>> points;
+        std::vector<cv::Mat> descriptors;
+        ComputeFeaturesFromImages({ image1, image2 }, points, descriptors, { mask1.getMat(), mask2.getMat() });
         
-        std::vector<std::vector<cv::DMatch>> allMatches;
-        m_BFMatcher->knnMatch(descriptors1, descriptors2, allMatches, 2);
-
         // filter using Lowe ratio test
         std::vector<cv::DMatch> matches;
-        FilterForGoodMatches(allMatches, matches);
+        m_Matcher.Match(descriptors[0], descriptors[1], matches);
         
         // add keypoints of matches
         for (const cv::DMatch& match : matches) {
-            kp1.push_back(points1[match.queryIdx]);
-            kp2.push_back(points2[match.trainIdx]);
+            kp1.push_back(points[0][match.queryIdx]);
+            kp2.push_back(points[1][match.trainIdx]);
         }
     }
 
@@ -78,28 +320,57 @@ namespace Pipeline
     void FrameFeatureExtractor::ComputeMatchesWithImage(const cv::Mat& descriptors, const cv::Mat& image, std::vector<cv::KeyPoint>& computedKeypoints, cv::Mat& computedDescriptors, std::vector<cv::DMatch>& matches) const
     {
         // detect features in image
-        m_FeatureExtractor->detectAndCompute(image, cv::noArray(), computedKeypoints, computedDescriptors, false);
-
-        std::vector<std::vector<cv::DMatch>> allMatches;
-        m_BFMatcher->knnMatch(descriptors, computedDescriptors, allMatches, 2);
+        ComputeFeaturesFromImage(image, computedKeypoints, computedDescriptors);
 
         // Lowe ratio test
-        FilterForGoodMatches(allMatches, matches);
+        m_Matcher.Match(descriptors, computedDescriptors, matches);
     }
 
     // Features from image
-    void FrameFeatureExtractor::ComputeFeaturesFromImage(const cv::Mat& image, std::vector<cv::KeyPoint>& computedKeypoints, cv::Mat& computedDescriptors) const {
-        m_FeatureExtractor->detectAndCompute(image, cv::noArray(), computedKeypoints, computedDescriptors, false);
+    void FrameFeatureExtractor::ComputeFeaturesFromImage(const cv::Mat& image, std::vector<cv::KeyPoint>& computedKeypoints, cv::Mat& computedDescriptors, cv::InputArray mask) const
+    {
+        std::vector<cv::Mat> pyramid;
+        BuildPyramid(image, pyramid);
+        ComputeFeaturesFromPyramid(pyramid, computedKeypoints, computedDescriptors, mask);
     }
 
-    // Lowe match ratio test
-    void FrameFeatureExtractor::FilterForGoodMatches(const std::vector<std::vector<cv::DMatch>>& matches, std::vector<cv::DMatch>& goodMatches) const
+    // Features from an existing pyramid
+    void FrameFeatureExtractor::ComputeFeaturesFromPyramid(const std::vector<cv::Mat>& pyramid, std::vector<cv::KeyPoint>& computedKeypoints, cv::Mat& computedDescriptors, cv::InputArray mask) const
     {
-        for (size_t i = 0; i < matches.size(); i++)
+        std::vector<std::vector<cv::KeyPoint>> keypoints;
+        std::vector<cv::Mat> descriptors;
+        ComputeFeaturesFromPyramids({ pyramid }, keypoints, descriptors, { mask.getMat() });
+
+        computedKeypoints = std::move(keypoints[0]);
+        computedDescriptors = descriptors[0];
+    }
+
+    // Features from several images
+    void FrameFeatureExtractor::ComputeFeaturesFromImages(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::KeyPoint>>& keypoints, std::vector<cv::Mat>& descriptors, const std::vector<cv::Mat>& masks) const
+    {
+        std::vector<std::vector<cv::Mat>> pyramids(images.size());
+        cv::parallel_for_(cv::Range(0, static_cast<int>(images.size())), [&](const cv::Range& range)
         {
-            if (!matches[i].empty() && matches[i][0].distance < RATIO_THRESHOLD * matches[i][1].distance) {
-                goodMatches.push_back(matches[i][0]);
+            for (int i = range.start; i < range.end; i++) {
+                BuildPyramid(images[i], pyramids[i]);
             }
-        }
+        });
+
+        ComputeFeaturesFromPyramids(pyramids, keypoints, descriptors, masks);
+    }
+
+    // Features from several pyramids: detection over all cells of all levels of all images, then descriptors of each image, in parallel
+    void FrameFeatureExtractor::ComputeFeaturesFromPyramids(const std::vector<std::vector<cv::Mat>>& pyramids, std::vector<std::vector<cv::KeyPoint>>& keypoints, std::vector<cv::Mat>& descriptors, const std::vector<cv::Mat>& masks) const
+    {
+        DetectKeypoints(pyramids, keypoints, masks);
+
+        // descriptors are computed at each keypoint's level (the descriptor's own pyramid has the same scale), those too close to the border are removed
+        descriptors.assign(pyramids.size(), cv::Mat());
+        cv::parallel_for_(cv::Range(0, static_cast<int>(pyramids.size())), [&](const cv::Range& range)
+        {
+            for (int i = range.start; i < range.end; i++) {
+                m_FeatureExtractor->compute(pyramids[i][0], keypoints[i], descriptors[i]);
+            }
+        });
     }
 }
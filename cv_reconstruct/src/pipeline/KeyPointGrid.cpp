@@ -0,0 +1,97 @@
+//
+// KeyPointGrid.cpp
+// Spatial index over the keypoints of a frame for radius queries around predicted pixel positions
+//
+
+#include "pipeline/KeyPointGrid.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace Pipeline
+{
+    // Constructor
+    KeyPointGrid::KeyPointGrid(const std::vector<cv::KeyPoint>& keypoints, const cv::Size& imageSize, int cellSize)
+        : m_CellSize(std::max(cellSize, 1))
+    {
+        m_GridCols = std::max((imageSize.width + m_CellSize - 1) / m_CellSize, 1);
+        m_GridRows = std::max((imageSize.height + m_CellSize - 1) / m_CellSize, 1);
+
+        const int count = static_cast<int>(keypoints.size());
+        m_Points.resize(count);
+        m_Levels.resize(count);
+
+        // counting sort of the keypoints into their cells
+        std::vector<int> cells(count);
+        m_CellOffsets.assign(m_GridCols * m_GridRows + 1, 0);
+
+        for (int i = 0; i < count; i++)
+        {
+            m_Points[i] = keypoints[i].pt;
+            m_Levels[i] = keypoints[i].octave;
+
+            const int col = std::min(std::max(static_cast<int>(keypoints[i].pt.x) / m_CellSize, 0), m_GridCols - 1);
+            const int row = std::min(std::max(static_cast<int>(keypoints[i].pt.y) / m_CellSize, 0), m_GridRows - 1);
+            cells[i] = row * m_GridCols + col;
+            m_CellOffsets[cells[i] + 1]++;
+        }
+
+        for (size_t cell = 1; cell < m_CellOffsets.size(); cell++) {
+            m_CellOffsets[cell] += m_CellOffsets[cell - 1];
+        }
+
+        m_CellEntries.resize(count);
+        std::vector<int> fill(m_CellOffsets.begin(), m_CellOffsets.end() - 1);
+        for (int i = 0; i < count; i++) {
+            m_CellEntries[fill[cells[i]]++] = i;
+        }
+    }
+
+    // Keypoints in the cells overlapping the search circle, then filtered by distance and level
+    void KeyPointGrid::GetKeypointsInRadius(const cv::Point2f& pixel, float radius, std::vector<int>& indices, int level) const
+    {
+        indices.clear();
+
+        if (m_Points.empty() || radius < 0 || !std::isfinite(pixel.x) || !std::isfinite(pixel.y)) {
+            return;
+        }
+
+        // search circle outside the grid
+        if (pixel.x + radius < 0 || pixel.y + radius < 0 || pixel.x - radius >= m_GridCols * m_CellSize || pixel.y - radius >= m_GridRows * m_CellSize) {
+            return;
+        }
+
+        const int minCol = std::max(static_cast<int>(std::floor((pixel.x - radius) / m_CellSize)), 0);
+        const int maxCol = std::min(static_cast<int>(std::floor((pixel.x + radius) / m_CellSize)), m_GridCols - 1);
+        const int minRow = std::max(static_cast<int>(std::floor((pixel.y - radius) / m_CellSize)), 0);
+        const int maxRow = std::min(static_cast<int>(std::floor((pixel.y + radius) / m_CellSize)), m_GridRows - 1);
+
+        const float radiusSq = radius * radius;
+
+        for (int row = minRow; row <= maxRow; row++)
+        {
+            for (int col = minCol; col <= maxCol; col++)
+            {
+                const int cell = row * m_GridCols + col;
+                for (int e = m_CellOffsets[cell]; e < m_CellOffsets[cell + 1]; e++)
+                {
+                    const int i = m_CellEntries[e];
+                    if (level >= 0 && m_Levels[i] != level) {
+                        continue;
+                    }
+
+                    const float dx = m_Points[i].x - pixel.x;
+                    const float dy = m_Points[i].y - pixel.y;
+                    if (dx * dx + dy * dy <= radiusSq) {
+                        indices.push_back(i);
+                    }
+                }
+            }
+        }
+    }
+
+    // Number of keypoints
+    size_t KeyPointGrid::Size() const {
+        return m_Points.size();
+    }
+}
@@ -4,10 +4,14 @@
 //
 
 #include <iostream>
-#include <unordered_set>
+#include <algorithm>
+#include <cmath>
 
 #include "pipeline/OpticalFlowEstimator.hpp"
 
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
 #define NUM_LEVELS 3
 #define PYR_SCALE 0.5
 #define FAST_PYR false
@@ -16,11 +20,40 @@
 #define POLY_N 5
 #define POLY_SIGMA 1.0
 
+// reduced scale dense flow: the smallest scale, and the guided filter radius (full scale pixels per flow pixel) and
+// regularisation (intensities in [0, 1])
+#define MIN_DENSE_SCALE 0.125f
+#define GUIDED_FILTER_RADIUS_FACTOR 2.0f
+#define GUIDED_FILTER_EPS 1e-3
+
+// sparse tracking: corner quality relative to the best corner, and how many frames ended tracks are kept for
+#define CORNER_QUALITY 0.01
+#define TRACK_HISTORY_FRAMES 10
+
 namespace Features
 {
     // Constructor
-    OpticalFlowEstimator::OpticalFlowEstimator() {
-        m_FarnebackOF = cv::FarnebackOpticalFlow::create(NUM_LEVELS, PYR_SCALE, FAST_PYR, WIN_SIZE, NUM_ITERS, POLY_N, POLY_SIGMA);
+    OpticalFlowEstimator::OpticalFlowEstimator() : OpticalFlowEstimator(DenseFlowBackend::DENSE_FLOW_FARNEBACK)
+    {
+
+    }
+
+    // Constructor with dense backend
+    OpticalFlowEstimator::OpticalFlowEstimator(DenseFlowBackend denseBackend, float denseScale) : m_DenseBackend(denseBackend), m_DenseScale(std::min(std::max(denseScale, MIN_DENSE_SCALE), 1.0f))
+    {
+        m_DenseFlow = CreateDenseFlow();
+    }
+
+    // Constructor with settings from config
+    OpticalFlowEstimator::OpticalFlowEstimator(const Config::Config& config) : OpticalFlowEstimator(config.OpticalFlow.DenseBackend, config.OpticalFlow.DenseScale)
+    {
+        m_FlowCache = FlowCache(static_cast<size_t>(std::max(config.OpticalFlow.FlowCacheSize, 0)));
+        m_Sparse = (config.OpticalFlow.Mode == "sparse");
+        m_MaxTracks = std::max(config.OpticalFlow.MaxTracks, 1);
+        m_CellSize = std::max(config.OpticalFlow.CellSize, 1);
+        m_WindowSize = std::max(config.OpticalFlow.WindowSize, 3);
+        m_PyramidLevels = std::max(config.OpticalFlow.PyramidLevels, 0);
+        m_MaxForwardBackwardError = config.OpticalFlow.MaxForwardBackwardError;
     }
 
     // Flow from image1 to image2
@@ -28,8 +61,8 @@ namespace Features
     {
         // convert to greyscale
         cv::Mat prev; cv::Mat next;
-        cv::cvtColor(image1, prev, cv::COLOR_BGR2GRAY);
-        cv::cvtColor(image2, next, cv::COLOR_BGR2GRAY);
+        ToGreyScale(image1, prev);
+        ToGreyScale(image2, next);
         
         // setup masks if provided
         bool isMasked1 = (&mask1 != &cv::noArray());
@@ -45,7 +78,7 @@ namespace Features
         
         // compute flow
         cv::Mat flow;
-        m_FarnebackOF->calc(prev, next, flow);
+        CalcDenseFlow(m_DenseFlow, prev, next, flow);
         
         // split into x and y components
         std::vector<cv::Mat> components;
@@ -99,8 +132,23 @@ namespace Features
     }
 
     // Estimate for N images - common pixels through optical flow
-    void OpticalFlowEstimator::EstimateCorrespondingPixels(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::KeyPoint>>& trackedPoints, cv::InputArray mask)
+    void OpticalFlowEstimator::EstimateCorrespondingPixels(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::KeyPoint>>& trackedPoints, cv::InputArray mask, const std::vector<size_t>& frameIDs)
     {
+        std::vector<std::vector<cv::Point2f>> trackedPixels;
+        EstimateCorrespondingPixels(images, trackedPixels, mask, frameIDs);
+        
+        // keypoints only for the pixels tracked through all images
+        trackedPoints.resize(trackedPixels.size());
+        for (size_t m = 0; m < trackedPixels.size(); m++) {
+            cv::KeyPoint::convert(trackedPixels[m], trackedPoints[m]);
+        }
+    }
+
+    // Estimate for N images - pixel positions stored as one contiguous float2 image per frame and a byte mask of valid pixels
+    void OpticalFlowEstimator::EstimateCorrespondingPixels(const std::vector<cv::Mat>& images, std::vector<std::vector<cv::Point2f>>& trackedPixels, cv::InputArray mask, const std::vector<size_t>& frameIDs)
+    {
+        CV_Assert(frameIDs.empty() || frameIDs.size() == images.size());
+        
         // need at least 2 images
         if (images.size() < 2) {
             std::cerr << "\nWarning: Optical Flow Estimator requires at least 2 images!" << std::endl;
@@ -108,134 +156,525 @@ namespace Features
         }
         
         // convert all images to greyscale
-        std::vector<cv::Mat> greyScaleImages;
-        for (const cv::Mat& image : images) {
-            cv::Mat greyScaleImage;
-            cv::cvtColor(image, greyScaleImage, cv::COLOR_BGR2GRAY);
-            greyScaleImages.push_back(greyScaleImage);
+        std::vector<cv::Mat> greyScaleImages(images.size());
+        for (size_t m = 0; m < images.size(); m++) {
+            ToGreyScale(images[m], greyScaleImages[m]);
+        }
+        
+        // features tracked from the first image
+        if (m_Sparse)
+        {
+            EstimateSparseCorrespondingPixels(greyScaleImages, trackedPixels, mask.getMat());
+            std::cout << "\nTracking complete. " << trackedPixels[0].size() << " common features tracked." << std::endl;
+            return;
         }
         
         // store cols for later access and for bounds checking
-        int rows = images[0].rows;
-        int cols = images[0].cols;
-        
-        // create the keypoint MxN matrix
-        // M: number of images
-        // N: number of pixels (must match in each image)
-        size_t M = images.size();
-        size_t N = rows * cols;
-        cv::KeyPoint defaultValue { 0.0, 0.0, 1.0 };
-        
-        // prepare data: keypoint matrix, and flow image
-        std::vector<std::vector<cv::KeyPoint>> keypoints(M, std::vector<cv::KeyPoint>(N, defaultValue));
-        cv::Mat flow;
+        const int rows = images[0].rows;
+        const int cols = images[0].cols;
+        const size_t M = images.size();
         
-        // first image keypoints: (x,y) coordinates of image
-        for (int row = 0; row < rows; row++) {
+        // position of every first image pixel in each image, and whether it is still tracked
+        std::vector<cv::Mat> positions(M);
+        cv::Mat valid(rows, cols, CV_8U, cv::Scalar(1));
+        
+        // first image positions: (x,y) coordinates of image
+        positions[0].create(rows, cols, CV_32FC2);
+        for (int row = 0; row < rows; row++)
+        {
+            cv::Point2f* position = positions[0].ptr<cv::Point2f>(row);
             for (int col = 0; col < cols; col++) {
-                keypoints[0][row * cols + col].pt.x = col;
-                keypoints[0][row * cols + col].pt.y = row;
+                position[col] = cv::Point2f(static_cast<float>(col), static_cast<float>(row));
             }
         }
         
-        // invalid pixel indices
-        std::unordered_set<size_t> outOfBoundKeyPointIndices;
+        // pixels outside the mask are never tracked
+        cv::Mat maskImage = mask.getMat();
+        if (!maskImage.empty()) {
+            valid.setTo(0, maskImage == 0);
+        }
         
-        // determine if mask is being applied
-        bool isMasked = (&mask != &cv::noArray());
-        if (isMasked)
+        // flows between the same frames are reused from the cache
+        std::vector<cv::Mat> flows(M - 1);
+        std::vector<int> uncachedPairs;
+        for (size_t pair = 0; pair < M - 1; pair++)
         {
-            cv::Mat maskImage = mask.getMat();
-            
-            // add indices for all pixels in mask to out of bounds indices
-            for (int row = 0; row < maskImage.rows; row++)
-            {
-                for (int col = 0; col < maskImage.cols; col++)
-                {
-                    int value = static_cast<int>(maskImage.at<unsigned char>(row, col));
-                    if (value == 0) {
-                        size_t index = row * cols + col;
-                        outOfBoundKeyPointIndices.insert(index);
-                    }
-                }
+            const bool cached = !frameIDs.empty() && m_FlowCache.Get(frameIDs[pair], frameIDs[pair + 1], flows[pair]) &&
+                                flows[pair].rows == rows && flows[pair].cols == cols;
+            if (!cached) {
+                flows[pair].create(rows, cols, CV_32FC2);
+                uncachedPairs.push_back(static_cast<int>(pair));
             }
         }
         
-        // optical flow of first 2 images
-        m_FarnebackOF->calc(greyScaleImages[0], greyScaleImages[1], flow);
-        size_t index = 0;
-        for (int row = 0; row < rows; row++)
+        // the flow of each image pair is independent. With at least one pair per thread the pairs are computed
+        // concurrently (backends keep internal buffers, so each task has its own), otherwise one pair at a time
+        // so the backend's own parallel loops keep every thread busy
+        if (static_cast<int>(uncachedPairs.size()) >= cv::getNumThreads())
         {
-            for (int col = 0; col < cols; col++)
+            cv::parallel_for_(cv::Range(0, static_cast<int>(uncachedPairs.size())), [&](const cv::Range& range)
             {
-                cv::Vec2f delta = flow.at<cv::Vec2f>(row, col);
-                index = row * cols + col;
-                
-                // only access valid pixels
-                if (outOfBoundKeyPointIndices.find(index) == outOfBoundKeyPointIndices.end())
-                {
-                    keypoints[1][index].pt.x = keypoints[0][index].pt.x + delta[0];
-                    keypoints[1][index].pt.y = keypoints[0][index].pt.y + delta[1];
-                    
-                    // make sure not out of bounds
-                    if (keypoints[1][index].pt.x < 0 || keypoints[1][index].pt.x >= cols) {
-                        outOfBoundKeyPointIndices.insert(index);
-                    }
-                    else if (keypoints[1][index].pt.y < 0 || keypoints[1][index].pt.y >= rows) {
-                        outOfBoundKeyPointIndices.insert(index);
-                    }
+                cv::Ptr<cv::DenseOpticalFlow> denseFlow = CreateDenseFlow();
+                for (int i = range.start; i < range.end; i++) {
+                    const int pair = uncachedPairs[i];
+                    CalcDenseFlow(denseFlow, greyScaleImages[pair], greyScaleImages[pair + 1], flows[pair]);
                 }
+            });
+        }
+        else if (!uncachedPairs.empty())
+        {
+            cv::Ptr<cv::DenseOpticalFlow> denseFlow = CreateDenseFlow();
+            for (int pair : uncachedPairs) {
+                CalcDenseFlow(denseFlow, greyScaleImages[pair], greyScaleImages[pair + 1], flows[pair]);
+            }
+        }
+        
+        if (!frameIDs.empty())
+        {
+            for (int pair : uncachedPairs) {
+                m_FlowCache.Insert(frameIDs[pair], frameIDs[pair + 1], flows[pair]);
             }
         }
         
-        // if more images, process iteratively while tracking pixel movement across remaining images
-        if (greyScaleImages.size() > 2)
+        // chain the flow of each image pair onto the positions in the previous image
+        for (size_t m = 1; m < M; m++)
         {
-            for (size_t m = 2; m < M; m++)
+            const cv::Mat& flow = flows[m - 1];
+            positions[m].create(rows, cols, CV_32FC2);
+            
+            const cv::Mat& previous = positions[m - 1];
+            cv::Mat& current = positions[m];
+            
+            cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& range)
             {
-                // optical flow on image (m - 1) and m
-                m_FarnebackOF->calc(greyScaleImages[m - 1], greyScaleImages[m], flow);
-                for (size_t index = 0; index < N; index++)
+                for (int row = range.start; row < range.end; row++)
                 {
-                    // only process valid pixel
-                    if (outOfBoundKeyPointIndices.find(index) == outOfBoundKeyPointIndices.end())
+                    const cv::Point2f* from = previous.ptr<cv::Point2f>(row);
+                    cv::Point2f* to = current.ptr<cv::Point2f>(row);
+                    uchar* isValid = valid.ptr<uchar>(row);
+                    
+                    for (int col = 0; col < cols; col++)
                     {
-                        int row = keypoints[m - 1][index].pt.y;
-                        int col = keypoints[m - 1][index].pt.x;
-                        
-                        cv::Vec2f delta = flow.at<cv::Vec2f>(row, col);
+                        // only process valid pixel
+                        if (!isValid[col]) {
+                            continue;
+                        }
                         
-                        keypoints[m][index].pt.x = keypoints[m - 1][index].pt.x + delta[0];
-                        keypoints[m][index].pt.y = keypoints[m - 1][index].pt.y + delta[1];
+                        const cv::Point2f& p = from[col];
+                        const cv::Point2f& delta = flow.at<cv::Point2f>(static_cast<int>(p.y), static_cast<int>(p.x));
+                        to[col] = p + delta;
                         
                         // make sure not out of bounds
-                        if (keypoints[m][index].pt.x < 0 || keypoints[m][index].pt.x >= cols) {
-                            outOfBoundKeyPointIndices.insert(index);
+                        if (to[col].x < 0 || to[col].x >= cols || to[col].y < 0 || to[col].y >= rows) {
+                            isValid[col] = 0;
                         }
-                        else if (keypoints[m][index].pt.y < 0 || keypoints[m][index].pt.y >= rows) {
-                            outOfBoundKeyPointIndices.insert(index);
+                    }
+                }
+            });
+        }
+        
+        // pixel positions of the pixels tracked through all images, in pixel order
+        const int trackedCount = cv::countNonZero(valid);
+        trackedPixels.assign(M, std::vector<cv::Point2f>());
+        
+        cv::parallel_for_(cv::Range(0, static_cast<int>(M)), [&](const cv::Range& range)
+        {
+            for (int m = range.start; m < range.end; m++)
+            {
+                std::vector<cv::Point2f>& tracked = trackedPixels[m];
+                tracked.reserve(trackedCount);
+                
+                for (int row = 0; row < rows; row++)
+                {
+                    const cv::Point2f* position = positions[m].ptr<cv::Point2f>(row);
+                    const uchar* isValid = valid.ptr<uchar>(row);
+                    for (int col = 0; col < cols; col++)
+                    {
+                        if (isValid[col]) {
+                            tracked.push_back(position[col]);
                         }
                     }
                 }
             }
+        });
+        
+        std::cout << "\nTracking complete. " << trackedCount << " common points matched." << std::endl;
+    }
+
+    // Greyscale without a copy for images that already are
+    void OpticalFlowEstimator::ToGreyScale(const cv::Mat& image, cv::Mat& grey) const
+    {
+        if (image.channels() == 1) {
+            grey = image;
+            return;
         }
         
-        // allocate space for tracked points
-        for (size_t m = 0; m < M; m++) {
-            trackedPoints.push_back(std::vector<cv::KeyPoint>());
+        cv::cvtColor(image, grey, cv::COLOR_BGR2GRAY);
+    }
+
+    // Sparse features of the first image tracked through all images
+    void OpticalFlowEstimator::EstimateSparseCorrespondingPixels(const std::vector<cv::Mat>& greyScaleImages, std::vector<std::vector<cv::Point2f>>& trackedPixels, const cv::Mat& mask) const
+    {
+        const size_t M = greyScaleImages.size();
+        trackedPixels.assign(M, std::vector<cv::Point2f>());
+        
+        DetectNewFeatures(greyScaleImages[0], mask, {}, m_MaxTracks, trackedPixels[0]);
+        
+        // index into the first image features of each surviving feature
+        std::vector<int> survivors(trackedPixels[0].size());
+        for (size_t i = 0; i < survivors.size(); i++) {
+            survivors[i] = static_cast<int>(i);
         }
         
-        // filter out bad pixels
-        for (size_t n = 0; n < N; n++)
+        // pyramids of all images built concurrently, only the tracking is chained
+        std::vector<std::vector<cv::Mat>> pyramids(M);
+        cv::parallel_for_(cv::Range(0, static_cast<int>(M)), [&](const cv::Range& range)
         {
-            if (outOfBoundKeyPointIndices.find(n) == outOfBoundKeyPointIndices.end())
+            for (int m = range.start; m < range.end; m++) {
+                BuildPyramid(greyScaleImages[m], pyramids[m]);
+            }
+        });
+        
+        std::vector<cv::Point2f> previousPoints = trackedPixels[0];
+        std::vector<std::vector<cv::Point2f>> chains(M);
+        
+        for (size_t m = 1; m < M && !survivors.empty(); m++)
+        {
+            std::vector<cv::Point2f> nextPoints;
+            std::vector<uchar> valid;
+            TrackPoints(pyramids[m - 1], pyramids[m], previousPoints, nextPoints, valid);
+            
+            // keep the features that survived, in every image so far
+            size_t kept = 0;
+            for (size_t i = 0; i < survivors.size(); i++)
             {
-                for (size_t m = 0; m < M; m++) {
-                    trackedPoints[m].push_back(keypoints[m][n]);
+                if (!valid[i]) {
+                    continue;
                 }
+                
+                survivors[kept] = survivors[i];
+                nextPoints[kept] = nextPoints[i];
+                for (size_t n = 1; n < m; n++) {
+                    chains[n][kept] = chains[n][i];
+                }
+                kept++;
+            }
+            
+            survivors.resize(kept);
+            nextPoints.resize(kept);
+            for (size_t n = 1; n < m; n++) {
+                chains[n].resize(kept);
             }
+            
+            chains[m] = nextPoints;
+            previousPoints = std::move(nextPoints);
+        }
+        
+        // first image pixels of the survivors
+        std::vector<cv::Point2f> firstPixels(survivors.size());
+        for (size_t i = 0; i < survivors.size(); i++) {
+            firstPixels[i] = trackedPixels[0][survivors[i]];
+        }
+        
+        trackedPixels[0] = std::move(firstPixels);
+        for (size_t m = 1; m < M; m++) {
+            trackedPixels[m] = std::move(chains[m]);
+            trackedPixels[m].resize(survivors.size());
+        }
+    }
+
+    // Persistent tracks into the next frame
+    void OpticalFlowEstimator::TrackFrame(size_t frameID, const cv::Mat& image, cv::InputArray mask)
+    {
+        cv::Mat grey;
+        ToGreyScale(image, grey);
+        
+        std::vector<cv::Mat> pyramid;
+        BuildPyramid(grey, pyramid);
+        
+        const size_t frame = m_FrameCount++;
+        m_FrameIndices[frameID] = frame;
+        
+        // follow the live tracks from the previous frame
+        std::vector<size_t> live;
+        std::vector<cv::Point2f> previousPoints;
+        for (size_t i = 0; i < m_Tracks.size(); i++)
+        {
+            if (m_Tracks[i].IsAlive) {
+                live.push_back(i);
+                previousPoints.push_back(m_Tracks[i].Pixels.back());
+            }
+        }
+        
+        std::vector<cv::Point2f> trackedPoints;
+        if (!live.empty())
+        {
+            std::vector<cv::Point2f> nextPoints;
+            std::vector<uchar> valid;
+            TrackPoints(m_PreviousPyramid, pyramid, previousPoints, nextPoints, valid);
+            
+            for (size_t i = 0; i < live.size(); i++)
+            {
+                FeatureTrack& track = m_Tracks[live[i]];
+                if (valid[i]) {
+                    track.Pixels.push_back(nextPoints[i]);
+                    trackedPoints.push_back(nextPoints[i]);
+                }
+                else {
+                    track.IsAlive = false;
+                }
+            }
+        }
+        
+        // new tracks in the empty cells
+        std::vector<cv::Point2f> features;
+        DetectNewFeatures(grey, mask.getMat(), trackedPoints, m_MaxTracks - static_cast<int>(trackedPoints.size()), features);
+        for (const cv::Point2f& feature : features)
+        {
+            FeatureTrack track;
+            track.ID = m_NextTrackID++;
+            track.FirstFrame = frame;
+            track.Pixels.push_back(feature);
+            m_Tracks.push_back(std::move(track));
+        }
+        
+        // drop tracks that ended too long ago to be part of a local optimisation window
+        m_Tracks.erase(std::remove_if(m_Tracks.begin(), m_Tracks.end(), [&](const FeatureTrack& track) {
+            return !track.IsAlive && track.FirstFrame + track.Pixels.size() + TRACK_HISTORY_FRAMES <= frame;
+        }), m_Tracks.end());
+        
+        m_PreviousPyramid = std::move(pyramid);
+    }
+
+    // Tracks seen in all frames
+    void OpticalFlowEstimator::GetTracks(const std::vector<size_t>& frameIDs, std::vector<std::vector<cv::Point2f>>& trackedPixels, std::vector<size_t>& trackIDs) const
+    {
+        trackedPixels.assign(frameIDs.size(), std::vector<cv::Point2f>());
+        trackIDs.clear();
+        
+        // tracking order index of each frame
+        std::vector<size_t> frames;
+        for (size_t frameID : frameIDs)
+        {
+            auto it = m_FrameIndices.find(frameID);
+            if (it == m_FrameIndices.end()) {
+                std::cerr << "\nWarning: Frame " << frameID << " has not been tracked!" << std::endl;
+                return;
+            }
+            frames.push_back(it->second);
+        }
+        
+        if (frames.empty()) {
+            return;
+        }
+        
+        const size_t first = *std::min_element(frames.begin(), frames.end());
+        const size_t last = *std::max_element(frames.begin(), frames.end());
+        
+        for (const FeatureTrack& track : m_Tracks)
+        {
+            // a track covers a contiguous range of frames
+            if (track.FirstFrame > first || track.FirstFrame + track.Pixels.size() <= last) {
+                continue;
+            }
+            
+            for (size_t m = 0; m < frames.size(); m++) {
+                trackedPixels[m].push_back(track.Pixels[frames[m] - track.FirstFrame]);
+            }
+            trackIDs.push_back(track.ID);
+        }
+    }
+
+    // Cache eviction
+    void OpticalFlowEstimator::EvictCachedFlowsBefore(size_t frameID) {
+        m_FlowCache.EvictFramesBefore(frameID);
+    }
+
+    // Sparse mode
+    bool OpticalFlowEstimator::IsSparse() const {
+        return m_Sparse;
+    }
+
+    // Is tracked
+    bool OpticalFlowEstimator::IsTracked(size_t frameID) const {
+        return m_FrameIndices.find(frameID) != m_FrameIndices.end();
+    }
+
+    // Pyramidal Lucas-Kanade with a forward-backward check: the point tracked back must return close to where it started
+    void OpticalFlowEstimator::TrackPoints(const std::vector<cv::Mat>& previousPyramid, const std::vector<cv::Mat>& nextPyramid, const std::vector<cv::Point2f>& previousPoints,
+                                           std::vector<cv::Point2f>& nextPoints, std::vector<uchar>& valid) const
+    {
+        valid.assign(previousPoints.size(), 0);
+        if (previousPoints.empty() || previousPyramid.empty()) {
+            nextPoints.clear();
+            return;
+        }
+        
+        const cv::Size windowSize(m_WindowSize, m_WindowSize);
+        
+        std::vector<uchar> forwardStatus, backwardStatus;
+        std::vector<float> errors;
+        std::vector<cv::Point2f> backPoints;
+        
+        cv::calcOpticalFlowPyrLK(previousPyramid, nextPyramid, previousPoints, nextPoints, forwardStatus, errors, windowSize, m_PyramidLevels);
+        cv::calcOpticalFlowPyrLK(nextPyramid, previousPyramid, nextPoints, backPoints, backwardStatus, errors, windowSize, m_PyramidLevels);
+        
+        const cv::Size imageSize = nextPyramid[0].size();
+        const float maxErrorSquared = m_MaxForwardBackwardError * m_MaxForwardBackwardError;
+        
+        for (size_t i = 0; i < previousPoints.size(); i++)
+        {
+            if (!forwardStatus[i] || !backwardStatus[i]) {
+                continue;
+            }
+            
+            const cv::Point2f& p = nextPoints[i];
+            if (p.x < 0 || p.y < 0 || p.x >= imageSize.width || p.y >= imageSize.height) {
+                continue;
+            }
+            
+            const cv::Point2f error = backPoints[i] - previousPoints[i];
+            valid[i] = (error.dot(error) <= maxErrorSquared) ? 1 : 0;
+        }
+    }
+
+    // Strongest corner of each grid cell without an existing feature, strongest first up to the budget
+    void OpticalFlowEstimator::DetectNewFeatures(const cv::Mat& grey, const cv::Mat& mask, const std::vector<cv::Point2f>& existing, int budget, std::vector<cv::Point2f>& features) const
+    {
+        features.clear();
+        if (budget <= 0) {
+            return;
+        }
+        
+        const int gridCols = (grey.cols + m_CellSize - 1) / m_CellSize;
+        const int gridRows = (grey.rows + m_CellSize - 1) / m_CellSize;
+        std::vector<uchar> occupied(gridRows * gridCols, 0);
+        
+        for (const cv::Point2f& p : existing)
+        {
+            const int col = std::min(std::max(static_cast<int>(p.x) / m_CellSize, 0), gridCols - 1);
+            const int row = std::min(std::max(static_cast<int>(p.y) / m_CellSize, 0), gridRows - 1);
+            occupied[row * gridCols + col] = 1;
+        }
+        
+        // corners only where new tracks may start
+        cv::Mat detectionMask(grey.size(), CV_8U, cv::Scalar(255));
+        if (!mask.empty()) {
+            detectionMask.setTo(0, mask == 0);
+        }
+        
+        for (int row = 0; row < gridRows; row++)
+        {
+            for (int col = 0; col < gridCols; col++)
+            {
+                if (occupied[row * gridCols + col]) {
+                    const cv::Rect cell(col * m_CellSize, row * m_CellSize, m_CellSize, m_CellSize);
+                    detectionMask(cell & cv::Rect(0, 0, grey.cols, grey.rows)).setTo(0);
+                }
+            }
+        }
+        
+        // corners are sorted by strength, so the first in a cell is its strongest
+        std::vector<cv::Point2f> corners;
+        cv::goodFeaturesToTrack(grey, corners, 0, CORNER_QUALITY, m_CellSize / 2.0, detectionMask);
+        
+        for (const cv::Point2f& corner : corners)
+        {
+            const int col = std::min(static_cast<int>(corner.x) / m_CellSize, gridCols - 1);
+            const int row = std::min(static_cast<int>(corner.y) / m_CellSize, gridRows - 1);
+            uchar& cell = occupied[row * gridCols + col];
+            if (cell) {
+                continue;
+            }
+            
+            cell = 1;
+            features.push_back(corner);
+            if (static_cast<int>(features.size()) >= budget) {
+                break;
+            }
+        }
+    }
+
+    // Image pyramid shared by the forward and backward passes
+    void OpticalFlowEstimator::BuildPyramid(const cv::Mat& grey, std::vector<cv::Mat>& pyramid) const
+    {
+        cv::buildOpticalFlowPyramid(grey, pyramid, cv::Size(m_WindowSize, m_WindowSize), m_PyramidLevels);
+    }
+
+    // A new instance of the dense backend
+    cv::Ptr<cv::DenseOpticalFlow> OpticalFlowEstimator::CreateDenseFlow() const
+    {
+        switch (m_DenseBackend)
+        {
+            case DENSE_FLOW_DIS_ULTRAFAST:
+                return cv::DISOpticalFlow::create(cv::DISOpticalFlow::PRESET_ULTRAFAST);
+            case DENSE_FLOW_DIS_FAST:
+                return cv::DISOpticalFlow::create(cv::DISOpticalFlow::PRESET_FAST);
+            case DENSE_FLOW_DIS_MEDIUM:
+                return cv::DISOpticalFlow::create(cv::DISOpticalFlow::PRESET_MEDIUM);
+            case DENSE_FLOW_FARNEBACK:
+            default:
+                return cv::FarnebackOpticalFlow::create(NUM_LEVELS, PYR_SCALE, FAST_PYR, WIN_SIZE, NUM_ITERS, POLY_N, POLY_SIGMA);
+        }
+    }
+
+    // Dense flow from the backend, at reduced scale if set
+    void OpticalFlowEstimator::CalcDenseFlow(const cv::Ptr<cv::DenseOpticalFlow>& denseFlow, const cv::Mat& prev, const cv::Mat& next, cv::Mat& flow) const
+    {
+        if (m_DenseScale >= 1.0f) {
+            denseFlow->calc(prev, next, flow);
+            return;
+        }
+        
+        cv::Mat smallPrev, smallNext, smallFlow;
+        cv::resize(prev, smallPrev, cv::Size(), m_DenseScale, m_DenseScale, cv::INTER_AREA);
+        cv::resize(next, smallNext, smallPrev.size(), 0, 0, cv::INTER_AREA);
+        denseFlow->calc(smallPrev, smallNext, smallFlow);
+        
+        // flow vectors grow with the image
+        cv::resize(smallFlow, flow, prev.size(), 0, 0, cv::INTER_LINEAR);
+        const double scaleX = static_cast<double>(prev.cols) / smallPrev.cols;
+        const double scaleY = static_cast<double>(prev.rows) / smallPrev.rows;
+        cv::multiply(flow, cv::Scalar(scaleX, scaleY), flow);
+        
+        GuidedUpsample(prev, flow);
+    }
+
+    // Guided filter on each flow component with the full scale image as guide, so flow edges follow image edges
+    // instead of the blur of the interpolation
+    void OpticalFlowEstimator::GuidedUpsample(const cv::Mat& guide, cv::Mat& flow) const
+    {
+        const int radius = static_cast<int>(std::ceil(GUIDED_FILTER_RADIUS_FACTOR / m_DenseScale));
+        const cv::Size window(2 * radius + 1, 2 * radius + 1);
+        
+        cv::Mat I;
+        guide.convertTo(I, CV_32F, 1.0 / 255.0);
+        
+        cv::Mat meanI, meanII;
+        cv::boxFilter(I, meanI, CV_32F, window);
+        cv::boxFilter(I.mul(I), meanII, CV_32F, window);
+        cv::Mat varI = meanII - meanI.mul(meanI);
+        
+        std::vector<cv::Mat> components;
+        cv::split(flow, components);
+        
+        for (cv::Mat& p : components)
+        {
+            cv::Mat meanP, meanIP;
+            cv::boxFilter(p, meanP, CV_32F, window);
+            cv::boxFilter(I.mul(p), meanIP, CV_32F, window);
+            
+            // local linear model p = a * I + b
+            cv::Mat a = (meanIP - meanI.mul(meanP)) / (varI + GUIDED_FILTER_EPS);
+            cv::Mat b = meanP - a.mul(meanI);
+            
+            cv::Mat meanA, meanB;
+            cv::boxFilter(a, meanA, CV_32F, window);
+            cv::boxFilter(b, meanB, CV_32F, window);
+            
+            p = meanA.mul(I) + meanB;
         }
         
-        std::cout << "\nTracking complete. " << trackedPoints[0].size() << " common points matched." << std::endl;
+        cv::merge(components, flow);
     }
 }
@@ -44,24 +44,10 @@ namespace Pipeline
             disparity = m_Reconstructor->GenerateDisparityMap(frame.LeftImage, frame.RightImage);
         }
 
-        // compute std dev of disparity and threshold it
-        cv::Mat disp; cv::Mat mean; std::vector<double> std;
-        cv::normalize(disparity, disp, 0, 255, cv::NORM_MINMAX, CV_8U);
-        cv::Mat mask(disp.rows, disp.cols, CV_8U);
-        cv::meanStdDev(disp, mean, std);
-        cv::threshold(disp, mask, std[0] * 1.3, 255, cv::THRESH_BINARY);
-
-        // apply mask to disparity
-        for (int row = 0; row < mask.rows; row++)
-        {
-            for (int col = 0; col < mask.cols; col++)
-            {
-                int value = static_cast<int>(mask.at<unsigned char>(row, col));
-                if (value == 0) {
-                    disparity.at<short>(row, col) = 0;
-                }
-            }
-        }
+        // prune low confidence disparities (kept in 16x fixed point)
+        cv::Mat filtered, mask;
+        m_Reconstructor->FilterDisparity(disparity, cv::Mat(), filtered, mask, CV_16S);
+        disparity = filtered;
     }
 
     // Process frame and generate processed, localized, point cloud
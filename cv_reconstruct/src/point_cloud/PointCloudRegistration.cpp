@@ -3,6 +3,8 @@
 // Handles point cloud registration
 //
 
+#include <cmath>
+
 #include <opencv2/core/core.hpp>
 #include <pcl/common/io.h>
 #include <pcl/io/pcd_io.h>
@@ -10,15 +12,25 @@
 #include <pcl/common/transforms.h>
 #include <pcl/filters/uniform_sampling.h>
 #include <pcl/filters/radius_outlier_removal.h>
+#include <pcl/registration/transformation_estimation_svd.h>
+#include <pcl/registration/correspondence_rejection_sample_consensus.h>
 
 #include "system/TrackingFrame.hpp"
 #include "reconstruct/Reconstruct3D.hpp"
 #include "point_cloud/PointCloudRegistration.hpp"
 
+// guided matches needed before falling back to matching all features
+#define MIN_GUIDED_MATCHES 20
+
+// sample consensus over the feature correspondences (inlier threshold in metres, stereo depth noise grows with depth)
+#define SAMPLE_CONSENSUS_INLIER_THRESHOLD 0.5
+#define SAMPLE_CONSENSUS_ITERATIONS 1000
+
 namespace PointCloud
 {
     // Constructor
-    PointCloudRegistration::PointCloudRegistration(const Config::Config& config, std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor) : m_3DReconstructor(reconstructor)
+    PointCloudRegistration::PointCloudRegistration(const Config::Config& config, std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor)
+        : m_3DReconstructor(reconstructor), m_2DFeatureExtractor(config), m_MatchSearchRadius(config.Tracking.MatchSearchRadius)
     {
         // setup ICP params from config file
         m_ICP.setMaximumIterations(config.PointCloudRegistration.ICP.NumMaxIterations);
@@ -199,17 +211,66 @@ namespace PointCloud
     // Estimate tracking frame to frame transform
     Eigen::Matrix4f PointCloudRegistration::EstimateTransformForFrameAlignment(const System::TrackingFrame& source, const System::TrackingFrame& target)
     {
-        // find correspondences between frame features
-        cv::Mat sourceDescriptors = source.GetFeatureDescriptors();
-        cv::Mat targetDescriptors = target.GetFeatureDescriptors();
+        // 3D correspondences from the cached stereo triangulated feature points
+        const std::vector<pcl::PointXYZRGB>& sourcePoints = source.GetFeaturePoints3D();
+        const std::vector<pcl::PointXYZRGB>& targetPoints = target.GetFeaturePoints3D();
+
+        // match the cached frame features within a window around their projection with the tracked poses,
+        // against all target features when the tracked poses are off
+        std::vector<cv::Point2f> predictedPixels;
+        const Eigen::Matrix4f predictedTransform = target.GetTrackedPose().inverse() * source.GetTrackedPose();
+        m_3DReconstructor->ProjectPoints(sourcePoints, predictedTransform, predictedPixels);
+
         std::vector<cv::DMatch> matches;
+        m_2DFeatureExtractor.ComputeGuidedCorrespondences(source.GetFeatureDescriptors(), target.GetFeatureDescriptors(), predictedPixels,
+                                                          target.GetFeatureGrid(), m_MatchSearchRadius, matches);
 
-        m_2DFeatureExtractor.ComputeCorrespondences(sourceDescriptors, targetDescriptors, matches);
+        if (matches.size() < MIN_GUIDED_MATCHES) {
+            m_2DFeatureExtractor.ComputeCorrespondences(source.GetFeatureDescriptors(), target.GetFeatureDescriptors(), matches);
+        }
 
+        pcl::PointCloud<pcl::PointXYZ>::Ptr sourceCloud { new pcl::PointCloud<pcl::PointXYZ>() };
+        pcl::PointCloud<pcl::PointXYZ>::Ptr targetCloud { new pcl::PointCloud<pcl::PointXYZ>() };
+        pcl::Correspondences correspondences;
+
+        for (const cv::DMatch& match : matches)
+        {
+            const pcl::PointXYZRGB& s = sourcePoints[match.queryIdx];
+            const pcl::PointXYZRGB& t = targetPoints[match.trainIdx];
 
+            // skip points without a valid depth
+            if (!std::isfinite(s.z) || !std::isfinite(t.z) || s.z <= 0 || t.z <= 0) {
+                continue;
+            }
 
+            correspondences.push_back(pcl::Correspondence(static_cast<int>(sourceCloud->size()), static_cast<int>(targetCloud->size()), 1.0));
+            sourceCloud->push_back(pcl::PointXYZ(s.x, s.y, s.z));
+            targetCloud->push_back(pcl::PointXYZ(t.x, t.y, t.z));
+        }
 
         Eigen::Matrix4f T = Eigen::Matrix4f::Identity();
+        if (correspondences.size() < 3) {
+            return T;
+        }
+
+        // reject mismatches with RANSAC over rigid transforms from 3 correspondences
+        pcl::registration::CorrespondenceRejectorSampleConsensus<pcl::PointXYZ> rejector;
+        rejector.setInputSource(sourceCloud);
+        rejector.setInputTarget(targetCloud);
+        rejector.setInlierThreshold(SAMPLE_CONSENSUS_INLIER_THRESHOLD);
+        rejector.setMaximumIterations(SAMPLE_CONSENSUS_ITERATIONS);
+
+        pcl::Correspondences inliers;
+        rejector.getRemainingCorrespondences(correspondences, inliers);
+
+        if (inliers.size() < 3) {
+            return T;
+        }
+
+        // closed form rigid body transform over the inliers
+        pcl::registration::TransformationEstimationSVD<pcl::PointXYZ, pcl::PointXYZ> estimator;
+        estimator.estimateRigidTransformation(*sourceCloud, *targetCloud, inliers, T);
+
         return T;
     }
 }
@@ -0,0 +1,678 @@
+//
+// CensusStereoMatcher.cpp
+// Semi-global stereo matcher using census transform and Hamming distance costs
+// Cost aggregation is vectorised with OpenCV universal intrinsics where available
+//
+
+#include "reconstruct/CensusStereoMatcher.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <limits>
+
+#include <opencv2/core/utility.hpp>
+#include <opencv2/imgproc/imgproc.hpp>
+
+#include <opencv2/core/hal/intrin.hpp>
+
+// 9x7 census window (62 comparison bits)
+#define CENSUS_RADIUS_X 4
+#define CENSUS_RADIUS_Y 3
+#define CENSUS_INVALID_COST 62
+
+// padding per pixel in the path buffers (holds the d = -1 and d = D sentinels)
+#define PATH_BUFFER_PADDING 16
+
+// tile size of the per-pixel range search
+#define RANGE_TILE_ROWS 16
+#define RANGE_TILE_COLS 32
+
+namespace Reconstruct
+{
+    namespace
+    {
+        const uint16_t PATH_COST_SENTINEL = std::numeric_limits<uint16_t>::max();
+
+        inline uint16_t SaturatingAdd(uint16_t a, uint16_t b) {
+            uint32_t sum = static_cast<uint32_t>(a) + b;
+            return static_cast<uint16_t>(sum > PATH_COST_SENTINEL ? PATH_COST_SENTINEL : sum);
+        }
+
+        // Aggregate the cost of a single pixel along one path:
+        // L(p, d) = C(p, d) + min(L(p-r, d), L(p-r, d-1) + P1, L(p-r, d+1) + P1, min_k L(p-r, k) + P2) - min_k L(p-r, k)
+        // prev and cur point at d = 0 of a buffer with sentinels at d = -1 and d = D
+        // Returns the minimum of the newly aggregated costs
+        inline uint16_t AggregatePixel(const uint16_t* prev, uint16_t prevMin, const uint8_t* cost, uint16_t* cur, uint16_t* sum,
+                                       int D, uint16_t P1, uint16_t P2, bool initialiseSum)
+        {
+#if CV_SIMD128
+            // 16 bit lanes, + and - saturate
+            const cv::v_uint16x8 vP1 = cv::v_setall_u16(P1);
+            const cv::v_uint16x8 vPrevMin = cv::v_setall_u16(prevMin);
+            const cv::v_uint16x8 vPrevMinP2 = cv::v_setall_u16(SaturatingAdd(prevMin, P2));
+            cv::v_uint16x8 vMin = cv::v_setall_u16(PATH_COST_SENTINEL);
+
+            for (int d = 0; d < D; d += cv::v_uint16x8::nlanes)
+            {
+                const cv::v_uint16x8 c = cv::v_load_expand(cost + d);
+                const cv::v_uint16x8 l0 = cv::v_load(prev + d);
+                const cv::v_uint16x8 lm = cv::v_load(prev + d - 1);
+                const cv::v_uint16x8 lp = cv::v_load(prev + d + 1);
+
+                cv::v_uint16x8 m = cv::v_min(l0, lm + vP1);
+                m = cv::v_min(m, lp + vP1);
+                m = cv::v_min(m, vPrevMinP2);
+
+                const cv::v_uint16x8 l = c + (m - vPrevMin);
+                cv::v_store(cur + d, l);
+                vMin = cv::v_min(vMin, l);
+
+                cv::v_store(sum + d, initialiseSum ? l : cv::v_load(sum + d) + l);
+            }
+
+            return static_cast<uint16_t>(cv::v_reduce_min(vMin));
+#else
+            const uint16_t prevMinP2 = SaturatingAdd(prevMin, P2);
+            uint16_t minCost = PATH_COST_SENTINEL;
+
+            for (int d = 0; d < D; d++)
+            {
+                uint16_t m = std::min(prev[d], SaturatingAdd(prev[d - 1], P1));
+                m = std::min(m, SaturatingAdd(prev[d + 1], P1));
+                m = std::min(m, prevMinP2);
+
+                uint16_t l = SaturatingAdd(cost[d], static_cast<uint16_t>(m - prevMin));
+                cur[d] = l;
+                minCost = std::min(minCost, l);
+                sum[d] = initialiseSum ? l : SaturatingAdd(sum[d], l);
+            }
+
+            return minCost;
+#endif
+        }
+
+        // Reset path buffers to zero cost with sentinels either side of the disparity range
+        void ResetPathBuffer(std::vector<uint16_t>& buffer, int stride, int D)
+        {
+            std::fill(buffer.begin(), buffer.end(), 0);
+            for (size_t i = 0; i + stride <= buffer.size(); i += stride) {
+                buffer[i] = PATH_COST_SENTINEL;
+                buffer[i + D + 1] = PATH_COST_SENTINEL;
+            }
+        }
+    }
+
+    // Factory
+    cv::Ptr<CensusStereoMatcher> CensusStereoMatcher::create(int minDisparity, int numDisparities, int P1, int P2, int numPaths) {
+        return cv::makePtr<CensusStereoMatcher>(minDisparity, numDisparities, P1, P2, numPaths);
+    }
+
+    // Constructor
+    CensusStereoMatcher::CensusStereoMatcher(int minDisparity, int numDisparities, int P1, int P2, int numPaths)
+        : m_MinDisparity(minDisparity), m_NumDisparities(numDisparities), m_P1(P1), m_P2(P2), m_NumPaths(numPaths == 4 ? 4 : 8)
+    {
+
+    }
+
+    // Compute disparity
+    void CensusStereoMatcher::compute(cv::InputArray leftArr, cv::InputArray rightArr, cv::OutputArray disparityArr)
+    {
+        cv::Mat left = leftArr.getMat();
+        cv::Mat right = rightArr.getMat();
+
+        CV_Assert(left.type() == CV_8UC1 && right.type() == CV_8UC1 && left.size() == right.size());
+        CV_Assert(m_NumDisparities > 0 && m_NumDisparities % 16 == 0);
+        CV_Assert(m_P1 > 0 && m_P2 > m_P1);
+
+        const int rows = left.rows;
+        const int cols = left.cols;
+        const int D = m_NumDisparities;
+        const int stride = D + PATH_BUFFER_PADDING;
+        const uint16_t P1 = static_cast<uint16_t>(m_P1);
+        const uint16_t P2 = static_cast<uint16_t>(m_P2);
+
+        disparityArr.create(left.size(), CV_16S);
+        cv::Mat disparity = disparityArr.getMat();
+
+        // census descriptors for both images
+        CensusTransform(left, m_CensusLeft);
+        CensusTransform(right, m_CensusRight);
+
+        // summed path costs for every pixel and disparity
+        m_AggregatedCost.resize(static_cast<size_t>(rows) * cols * D);
+
+        // vertical paths: 4 paths use the vertical path only, 8 paths add both diagonals
+        const int numRowPaths = (m_NumPaths == 8) ? 3 : 1;
+        const size_t rowPathSlots = static_cast<size_t>(numRowPaths) * (cols + 2);
+
+        // matching costs for every pixel and disparity, computed once for all paths
+        m_MatchingCost.resize(static_cast<size_t>(rows) * cols * D);
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& range)
+        {
+            for (int y = range.start; y < range.end; y++) {
+                ComputeRowCost(m_CensusLeft.data() + static_cast<size_t>(y) * cols, m_CensusRight.data() + static_cast<size_t>(y) * cols, cols,
+                               m_MatchingCost.data() + static_cast<size_t>(y) * cols * D);
+            }
+        });
+
+        // horizontal paths are independent for each row: left to right initialises the sum, right to left adds to it
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& range)
+        {
+            std::vector<uint16_t> lineBuffers(2 * stride);
+
+            for (int y = range.start; y < range.end; y++)
+            {
+                const uint8_t* cost = m_MatchingCost.data() + static_cast<size_t>(y) * cols * D;
+                uint16_t* sum = m_AggregatedCost.data() + static_cast<size_t>(y) * cols * D;
+
+                for (int pass = 0; pass < 2; pass++)
+                {
+                    const bool forward = (pass == 0);
+
+                    ResetPathBuffer(lineBuffers, stride, D);
+                    uint16_t* prevLine = lineBuffers.data();
+                    uint16_t* curLine = lineBuffers.data() + stride;
+                    uint16_t prevLineMin = 0;
+
+                    for (int j = 0; j < cols; j++)
+                    {
+                        const int x = forward ? j : (cols - 1 - j);
+                        prevLineMin = AggregatePixel(prevLine + 1, prevLineMin, cost + static_cast<size_t>(x) * D, curLine + 1,
+                                                     sum + static_cast<size_t>(x) * D, D, P1, P2, forward);
+                        std::swap(prevLine, curLine);
+                    }
+                }
+            }
+        });
+
+        // vertical and diagonal paths only depend on the previous row, so the pixels of each row are aggregated in parallel
+        std::vector<uint16_t> rowBuffers(2 * rowPathSlots * stride);
+        std::vector<uint16_t> rowMins(2 * rowPathSlots);
+        const double rowStripes = cv::getNumThreads();
+
+        // pass 0: top to bottom. pass 1: bottom to top
+        for (int pass = 0; pass < 2; pass++)
+        {
+            const bool forward = (pass == 0);
+            const int dir = forward ? 1 : -1;
+
+            // first row of each pass has no predecessor: zero cost with sentinels
+            ResetPathBuffer(rowBuffers, stride, D);
+            std::fill(rowMins.begin(), rowMins.end(), 0);
+
+            for (int i = 0; i < rows; i++)
+            {
+                const int y = forward ? i : (rows - 1 - i);
+
+                // matching costs for this row
+                const uint8_t* cost = m_MatchingCost.data() + static_cast<size_t>(y) * cols * D;
+
+                // previous and current row path buffers alternate every row
+                const uint16_t* prevRows = rowBuffers.data() + (i % 2) * rowPathSlots * stride;
+                uint16_t* curRows = rowBuffers.data() + ((i + 1) % 2) * rowPathSlots * stride;
+                const uint16_t* prevMins = rowMins.data() + (i % 2) * rowPathSlots;
+                uint16_t* curMins = rowMins.data() + ((i + 1) % 2) * rowPathSlots;
+
+                cv::parallel_for_(cv::Range(0, cols), [&](const cv::Range& range)
+                {
+                    for (int x = range.start; x < range.end; x++)
+                    {
+                        const uint8_t* c = cost + static_cast<size_t>(x) * D;
+                        uint16_t* s = m_AggregatedCost.data() + (static_cast<size_t>(y) * cols + x) * D;
+
+                        // vertical path (k = 0) and diagonal paths (k = 1, 2) from the previous row
+                        for (int k = 0; k < numRowPaths; k++)
+                        {
+                            const int xp = (k == 0) ? x : ((k == 1) ? (x - dir) : (x + dir));
+                            const size_t prevSlot = k * static_cast<size_t>(cols + 2) + (xp + 1);
+                            const size_t curSlot = k * static_cast<size_t>(cols + 2) + (x + 1);
+
+                            curMins[curSlot] = AggregatePixel(prevRows + prevSlot * stride + 1, prevMins[prevSlot], c,
+                                                              curRows + curSlot * stride + 1, s, D, P1, P2, false);
+                        }
+                    }
+                }, rowStripes);
+            }
+        }
+
+        // all paths have been summed: winner selection is independent for each row
+        cv::parallel_for_(cv::Range(0, rows), [&](const cv::Range& range)
+        {
+            std::vector<int> leftDisparity(cols);
+            std::vector<uint16_t> rightCost(cols);
+            std::vector<int> rightDisparity(cols);
+
+            for (int y = range.start; y < range.end; y++) {
+                SelectRowDisparity(m_AggregatedCost.data() + static_cast<size_t>(y) * cols * D, cols, disparity.ptr<short>(y),
+                                   leftDisparity.data(), rightCost.data(), rightDisparity.data());
+            }
+        });
+
+        // remove small disconnected blobs as the OpenCV matchers do
+        if (m_SpeckleWindowSize > 0) {
+            cv::filterSpeckles(disparity, (m_MinDisparity - 1) * DISP_SCALE, m_SpeckleWindowSize, m_SpeckleRange * DISP_SCALE);
+        }
+    }
+
+    // Disparity restricted to a per-pixel search range
+    size_t CensusStereoMatcher::ComputeInRange(cv::InputArray leftArr, cv::InputArray rightArr, cv::InputArray lowerBoundArr, cv::InputArray upperBoundArr, cv::OutputArray disparityArr, int windowRadius)
+    {
+        cv::Mat left = leftArr.getMat();
+        cv::Mat right = rightArr.getMat();
+        cv::Mat lowerBound = lowerBoundArr.getMat();
+        cv::Mat upperBound = upperBoundArr.getMat();
+
+        CV_Assert(left.type() == CV_8UC1 && right.type() == CV_8UC1 && left.size() == right.size());
+        CV_Assert(lowerBound.type() == CV_16S && upperBound.type() == CV_16S);
+        CV_Assert(lowerBound.size() == left.size() && upperBound.size() == left.size());
+
+        const int rows = left.rows;
+        const int cols = left.cols;
+        const int minDisparity = m_MinDisparity;
+        const int maxDisparity = m_MinDisparity + m_NumDisparities - 1;
+        const short invalid = static_cast<short>((m_MinDisparity - 1) * DISP_SCALE);
+
+        disparityArr.create(left.size(), CV_16S);
+        cv::Mat disparity = disparityArr.getMat();
+
+        CensusTransform(left, m_CensusLeft);
+        CensusTransform(right, m_CensusRight);
+
+        // tiles small enough that the search ranges of their pixels stay close together, so each tile only
+        // evaluates the costs of the disparities its own pixels search
+        const int tilesX = (cols + RANGE_TILE_COLS - 1) / RANGE_TILE_COLS;
+        const int tilesY = (rows + RANGE_TILE_ROWS - 1) / RANGE_TILE_ROWS;
+        std::atomic<size_t> evaluatedCosts { 0 };
+
+        cv::parallel_for_(cv::Range(0, tilesX * tilesY), [&](const cv::Range& range)
+        {
+            std::vector<int> columnSums;
+            std::vector<int> windowCosts;
+            size_t evaluated = 0;
+
+            for (int tile = range.start; tile < range.end; tile++)
+            {
+                const int row0 = (tile / tilesX) * RANGE_TILE_ROWS;
+                const int row1 = std::min(row0 + RANGE_TILE_ROWS, rows);
+                const int col0 = (tile % tilesX) * RANGE_TILE_COLS;
+                const int col1 = std::min(col0 + RANGE_TILE_COLS, cols);
+                const int tileCols = col1 - col0;
+
+                // disparities searched by any pixel of the tile, plus one either side for the sub-pixel fit
+                int rangeMin = maxDisparity + 1;
+                int rangeMax = minDisparity - 1;
+                for (int row = row0; row < row1; row++)
+                {
+                    const short* lower = lowerBound.ptr<short>(row);
+                    const short* upper = upperBound.ptr<short>(row);
+                    for (int col = col0; col < col1; col++)
+                    {
+                        const int dMin = std::max({ static_cast<int>(lower[col]), minDisparity, col - cols + 1 });
+                        const int dMax = std::min({ static_cast<int>(upper[col]), maxDisparity, col });
+                        if (dMin <= dMax) {
+                            rangeMin = std::min(rangeMin, std::max({ dMin - 1, minDisparity, col - cols + 1 }));
+                            rangeMax = std::max(rangeMax, std::min({ dMax + 1, maxDisparity, col }));
+                        }
+                    }
+                }
+
+                if (rangeMin > rangeMax)
+                {
+                    for (int row = row0; row < row1; row++) {
+                        std::fill(disparity.ptr<short>(row) + col0, disparity.ptr<short>(row) + col1, invalid);
+                    }
+                    continue;
+                }
+
+                // census costs per disparity summed over the window rows (columnSums, padded by the window radius
+                // either side) and then the window (windowCosts)
+                const int numDisparities = rangeMax - rangeMin + 1;
+                const int paddedCols = tileCols + 2 * windowRadius;
+                columnSums.assign(static_cast<size_t>(numDisparities) * paddedCols, 0);
+                windowCosts.resize(static_cast<size_t>(numDisparities) * tileCols);
+
+                for (int dy = -windowRadius; dy <= windowRadius; dy++) {
+                    AccumulateRowCost(row0 + dy, col0 - windowRadius, paddedCols, rangeMin, numDisparities, rows, cols, 1, columnSums.data());
+                }
+
+                for (int row = row0; row < row1; row++)
+                {
+                    // slide the window rows down
+                    if (row > row0) {
+                        AccumulateRowCost(row - windowRadius - 1, col0 - windowRadius, paddedCols, rangeMin, numDisparities, rows, cols, -1, columnSums.data());
+                        AccumulateRowCost(row + windowRadius, col0 - windowRadius, paddedCols, rangeMin, numDisparities, rows, cols, 1, columnSums.data());
+                    }
+                    BoxFilterRow(columnSums.data(), numDisparities, tileCols, windowRadius, windowCosts.data());
+                    evaluated += static_cast<size_t>(numDisparities) * tileCols;
+
+                    const short* lower = lowerBound.ptr<short>(row);
+                    const short* upper = upperBound.ptr<short>(row);
+                    short* out = disparity.ptr<short>(row);
+
+                    for (int col = col0; col < col1; col++)
+                    {
+                        // clamp range to the matcher's range and to the right image
+                        const int dMin = std::max({ static_cast<int>(lower[col]), minDisparity, col - cols + 1 });
+                        const int dMax = std::min({ static_cast<int>(upper[col]), maxDisparity, col });
+
+                        if (dMin > dMax) {
+                            out[col] = invalid;
+                            continue;
+                        }
+
+                        const int evalMin = std::max({ dMin - 1, minDisparity, col - cols + 1 });
+                        const int evalMax = std::min({ dMax + 1, maxDisparity, col });
+                        const int* cost = windowCosts.data() + (col - col0);
+
+                        int best = dMin;
+                        int bestCost = std::numeric_limits<int>::max();
+                        for (int d = dMin; d <= dMax; d++)
+                        {
+                            if (cost[(d - rangeMin) * tileCols] < bestCost) {
+                                bestCost = cost[(d - rangeMin) * tileCols];
+                                best = d;
+                            }
+                        }
+
+                        // uniqueness: no other (non-adjacent) disparity in the range may come close to the best cost
+                        bool isUnique = true;
+                        if (m_UniquenessRatio > 0)
+                        {
+                            for (int d = dMin; d <= dMax; d++)
+                            {
+                                if (std::abs(d - best) > 1 && cost[(d - rangeMin) * tileCols] * (100 - m_UniquenessRatio) < bestCost * 100) {
+                                    isUnique = false;
+                                    break;
+                                }
+                            }
+                        }
+
+                        if (!isUnique) {
+                            out[col] = invalid;
+                            continue;
+                        }
+
+                        // sub-pixel refinement by parabola fit
+                        int value = best * DISP_SCALE;
+                        if (best > evalMin && best < evalMax)
+                        {
+                            const int costPrev = cost[(best - 1 - rangeMin) * tileCols];
+                            const int costNext = cost[(best + 1 - rangeMin) * tileCols];
+                            const int denom2 = std::max(costPrev + costNext - 2 * bestCost, 1);
+                            value += ((costPrev - costNext) * DISP_SCALE + denom2) / (denom2 * 2);
+                        }
+
+                        out[col] = static_cast<short>(value);
+                    }
+                }
+            }
+
+            evaluatedCosts += evaluated;
+        });
+
+        return evaluatedCosts;
+    }
+
+    // Add (sign 1) or remove (sign -1) the census costs of one row (borders replicated) for a run of columns and disparities
+    void CensusStereoMatcher::AccumulateRowCost(int row, int colStart, int numCols, int minDisparity, int numDisparities, int rows, int cols, int sign, int* columnSums) const
+    {
+        const int y = std::min(std::max(row, 0), rows - 1);
+        const uint64_t* censusLeft = m_CensusLeft.data() + static_cast<size_t>(y) * cols;
+        const uint64_t* censusRight = m_CensusRight.data() + static_cast<size_t>(y) * cols;
+
+        for (int i = 0; i < numDisparities; i++)
+        {
+            const int d = minDisparity + i;
+            int* sums = columnSums + static_cast<size_t>(i) * numCols;
+
+            for (int j = 0; j < numCols; j++)
+            {
+                const int x = std::min(std::max(colStart + j, 0), cols - 1);
+                const int xr = x - d;
+                sums[j] += sign * ((xr >= 0 && xr < cols) ? __builtin_popcountll(censusLeft[x] ^ censusRight[xr]) : CENSUS_INVALID_COST);
+            }
+        }
+    }
+
+    // Sum the column sums (padded by the window radius either side) over the window width with a running sum
+    void CensusStereoMatcher::BoxFilterRow(const int* columnSums, int numDisparities, int cols, int windowRadius, int* windowCosts) const
+    {
+        const int paddedCols = cols + 2 * windowRadius;
+
+        for (int i = 0; i < numDisparities; i++)
+        {
+            const int* sums = columnSums + static_cast<size_t>(i) * paddedCols;
+            int* costs = windowCosts + static_cast<size_t>(i) * cols;
+
+            int sum = 0;
+            for (int x = 0; x <= 2 * windowRadius; x++) {
+                sum += sums[x];
+            }
+            costs[0] = sum;
+
+            for (int x = 1; x < cols; x++)
+            {
+                sum += sums[x + 2 * windowRadius] - sums[x - 1];
+                costs[x] = sum;
+            }
+        }
+    }
+
+    // Census transform with replicated borders
+    void CensusStereoMatcher::CensusTransform(const cv::Mat& image, std::vector<uint64_t>& census) const
+    {
+        cv::Mat padded;
+        cv::copyMakeBorder(image, padded, CENSUS_RADIUS_Y, CENSUS_RADIUS_Y, CENSUS_RADIUS_X, CENSUS_RADIUS_X, cv::BORDER_REPLICATE);
+
+        census.resize(static_cast<size_t>(image.rows) * image.cols);
+
+        cv::parallel_for_(cv::Range(0, image.rows), [&](const cv::Range& range)
+        {
+            for (int row = range.start; row < range.end; row++)
+            {
+                uint64_t* out = census.data() + static_cast<size_t>(row) * image.cols;
+                const uchar* center = padded.ptr<uchar>(row + CENSUS_RADIUS_Y) + CENSUS_RADIUS_X;
+
+                for (int col = 0; col < image.cols; col++)
+                {
+                    uint64_t bits = 0;
+                    const uchar c = center[col];
+
+                    for (int dy = -CENSUS_RADIUS_Y; dy <= CENSUS_RADIUS_Y; dy++)
+                    {
+                        const uchar* p = padded.ptr<uchar>(row + CENSUS_RADIUS_Y + dy) + CENSUS_RADIUS_X + col;
+                        for (int dx = -CENSUS_RADIUS_X; dx <= CENSUS_RADIUS_X; dx++)
+                        {
+                            if (dx == 0 && dy == 0) {
+                                continue;
+                            }
+                            bits = (bits << 1) | static_cast<uint64_t>(p[dx] < c);
+                        }
+                    }
+
+                    out[col] = bits;
+                }
+            }
+        });
+    }
+
+    // Hamming distance between census descriptors for every disparity in the row
+    void CensusStereoMatcher::ComputeRowCost(const uint64_t* censusLeft, const uint64_t* censusRight, int cols, uint8_t* cost) const
+    {
+        const int D = m_NumDisparities;
+
+        for (int x = 0; x < cols; x++)
+        {
+            const uint64_t cl = censusLeft[x];
+            uint8_t* c = cost + static_cast<size_t>(x) * D;
+
+            for (int d = 0; d < D; d++)
+            {
+                const int xr = x - (m_MinDisparity + d);
+                c[d] = (xr >= 0 && xr < cols) ? static_cast<uint8_t>(__builtin_popcountll(cl ^ censusRight[xr])) : CENSUS_INVALID_COST;
+            }
+        }
+    }
+
+    // Winner-takes-all with uniqueness, sub-pixel and left-right checks for a single row
+    void CensusStereoMatcher::SelectRowDisparity(const uint16_t* sum, int cols, short* disparity, int* leftDisparity, uint16_t* rightCost, int* rightDisparity) const
+    {
+        const int D = m_NumDisparities;
+        const short invalid = static_cast<short>((m_MinDisparity - 1) * DISP_SCALE);
+
+        std::fill(rightCost, rightCost + cols, PATH_COST_SENTINEL);
+        std::fill(rightDisparity, rightDisparity + cols, -1);
+
+        for (int x = 0; x < cols; x++)
+        {
+            const uint16_t* s = sum + static_cast<size_t>(x) * D;
+
+            // best disparity for the left pixel, and best left pixel for each right pixel
+            int best = 0;
+            uint16_t minCost = s[0];
+            for (int d = 0; d < D; d++)
+            {
+                if (s[d] < minCost) {
+                    minCost = s[d];
+                    best = d;
+                }
+
+                const int xr = x - (m_MinDisparity + d);
+                if (xr >= 0 && xr < cols && s[d] < rightCost[xr]) {
+                    rightCost[xr] = s[d];
+                    rightDisparity[xr] = d;
+                }
+            }
+
+            leftDisparity[x] = -1;
+
+            // uniqueness: no other (non-adjacent) disparity may come close to the best cost
+            bool isUnique = true;
+            if (m_UniquenessRatio > 0)
+            {
+                for (int d = 0; d < D; d++)
+                {
+                    if (std::abs(d - best) > 1 && s[d] * (100 - m_UniquenessRatio) < minCost * 100) {
+                        isUnique = false;
+                        break;
+                    }
+                }
+            }
+
+            if (!isUnique) {
+                disparity[x] = invalid;
+                continue;
+            }
+
+            // sub-pixel refinement by parabola fit
+            int value = best * DISP_SCALE;
+            if (best > 0 && best < D - 1)
+            {
+                const int costPrev = s[best - 1];
+                const int costNext = s[best + 1];
+                const int denom2 = std::max(costPrev + costNext - 2 * static_cast<int>(minCost), 1);
+                value += ((costPrev - costNext) * DISP_SCALE + denom2) / (denom2 * 2);
+            }
+
+            disparity[x] = static_cast<short>(value + m_MinDisparity * DISP_SCALE);
+            leftDisparity[x] = best;
+        }
+
+        // left-right consistency check
+        if (m_Disp12MaxDiff < 0) {
+            return;
+        }
+
+        for (int x = 0; x < cols; x++)
+        {
+            if (leftDisparity[x] < 0) {
+                continue;
+            }
+
+            const int xr = x - (m_MinDisparity + leftDisparity[x]);
+            if (xr < 0 || xr >= cols || std::abs(rightDisparity[xr] - leftDisparity[x]) > m_Disp12MaxDiff) {
+                disparity[x] = invalid;
+            }
+        }
+    }
+
+    // Getters and setters
+
+    int CensusStereoMatcher::getMinDisparity() const {
+        return m_MinDisparity;
+    }
+
+    void CensusStereoMatcher::setMinDisparity(int minDisparity) {
+        m_MinDisparity = minDisparity;
+    }
+
+    int CensusStereoMatcher::getNumDisparities() const {
+        return m_NumDisparities;
+    }
+
+    void CensusStereoMatcher::setNumDisparities(int numDisparities) {
+        m_NumDisparities = numDisparities;
+    }
+
+    int CensusStereoMatcher::getBlockSize() const {
+        return m_BlockSize;
+    }
+
+    void CensusStereoMatcher::setBlockSize(int blockSize) {
+        m_BlockSize = blockSize;
+    }
+
+    int CensusStereoMatcher::getSpeckleWindowSize() const {
+        return m_SpeckleWindowSize;
+    }
+
+    void CensusStereoMatcher::setSpeckleWindowSize(int speckleWindowSize) {
+        m_SpeckleWindowSize = speckleWindowSize;
+    }
+
+    int CensusStereoMatcher::getSpeckleRange() const {
+        return m_SpeckleRange;
+    }
+
+    void CensusStereoMatcher::setSpeckleRange(int speckleRange) {
+        m_SpeckleRange = speckleRange;
+    }
+
+    int CensusStereoMatcher::getDisp12MaxDiff() const {
+        return m_Disp12MaxDiff;
+    }
+
+    void CensusStereoMatcher::setDisp12MaxDiff(int disp12MaxDiff) {
+        m_Disp12MaxDiff = disp12MaxDiff;
+    }
+
+    void CensusStereoMatcher::SetPenalties(int P1, int P2) {
+        m_P1 = P1;
+        m_P2 = P2;
+    }
+
+    int CensusStereoMatcher::GetP1() const {
+        return m_P1;
+    }
+
+    int CensusStereoMatcher::GetP2() const {
+        return m_P2;
+    }
+
+    void CensusStereoMatcher::SetNumPaths(int numPaths) {
+        m_NumPaths = (numPaths == 4) ? 4 : 8;
+    }
+
+    int CensusStereoMatcher::GetNumPaths() const {
+        return m_NumPaths;
+    }
+
+    void CensusStereoMatcher::SetUniquenessRatio(int ratio) {
+        m_UniquenessRatio = ratio;
+    }
+
+    int CensusStereoMatcher::GetUniquenessRatio() const {
+        return m_UniquenessRatio;
+    }
+}
@@ -0,0 +1,188 @@
+//
+// DisparityFilter.cpp
+// Filters 16x fixed point disparity maps: speckle removal, left-right consistency, confidence masking
+// and output conversion in a single pass over the image
+//
+
+#include "reconstruct/DisparityFilter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <opencv2/core/utility.hpp>
+#include <opencv2/core/hal/intrin.hpp>
+#include <opencv2/calib3d/calib3d.hpp>
+
+#define DISPARITY_SCALE 16
+
+namespace Reconstruct
+{
+    // Constructor
+    DisparityFilter::DisparityFilter(int minDisparity, float confidenceStdFactor, int speckleWindowSize, int speckleRange, int disp12MaxDiff)
+        : m_MinDisparity(minDisparity), m_ConfidenceStdFactor(confidenceStdFactor), m_SpeckleWindowSize(speckleWindowSize),
+          m_SpeckleRange(speckleRange), m_Disp12MaxDiff(disp12MaxDiff)
+    {
+
+    }
+
+    // Filter disparity
+    void DisparityFilter::Apply(cv::Mat& disparity, const cv::Mat& rightDisparity, const cv::Rect& roi, cv::Mat& filtered, cv::Mat& mask, int outputDepth) const
+    {
+        CV_Assert(disparity.type() == CV_16S);
+        CV_Assert(outputDepth == CV_16S || outputDepth == CV_32F);
+        CV_Assert(rightDisparity.empty() || (rightDisparity.type() == CV_16S && rightDisparity.size() == disparity.size()));
+
+        const cv::Rect region = roi & cv::Rect(0, 0, disparity.cols, disparity.rows);
+        const bool checkLeftRight = !rightDisparity.empty();
+
+        filtered = cv::Mat::zeros(disparity.size(), outputDepth);
+        mask = cv::Mat::zeros(disparity.size(), CV_8U);
+
+        if (region.area() == 0) {
+            return;
+        }
+
+        cv::Mat disparityROI = disparity(region);
+
+        // remove small blobs of inconsistent disparity
+        if (m_SpeckleWindowSize > 0) {
+            cv::filterSpeckles(disparityROI, (m_MinDisparity - 1) * DISPARITY_SCALE, m_SpeckleWindowSize, m_SpeckleRange * DISPARITY_SCALE);
+        }
+
+        // keep disparities above the confidence threshold (and always above 0)
+        const double threshold = ComputeConfidenceThreshold(disparityROI);
+        const short keepAbove = static_cast<short>(std::min<double>(std::max(std::floor(threshold), 0.0), std::numeric_limits<short>::max()));
+        const int maxDiff = m_Disp12MaxDiff * DISPARITY_SCALE;
+        const float scale = 1.0f / DISPARITY_SCALE;
+
+        cv::parallel_for_(cv::Range(0, region.height), [&](const cv::Range& range)
+        {
+            for (int i = range.start; i < range.end; i++)
+            {
+                const int row = region.y + i;
+                const short* d = disparity.ptr<short>(row) + region.x;
+                uchar* m = mask.ptr<uchar>(row) + region.x;
+                short* out16 = (outputDepth == CV_16S) ? filtered.ptr<short>(row) + region.x : nullptr;
+                float* out32 = (outputDepth == CV_32F) ? filtered.ptr<float>(row) + region.x : nullptr;
+
+                int x = 0;
+
+                if (checkLeftRight)
+                {
+                    const short* right = rightDisparity.ptr<short>(row);
+
+                    for (; x < region.width; x++)
+                    {
+                        const short value = d[x];
+                        bool keep = value > keepAbove;
+
+                        // the matched right pixel must agree on the disparity
+                        if (keep) {
+                            const int xr = region.x + x - ((value + DISPARITY_SCALE / 2) / DISPARITY_SCALE);
+                            keep = (xr >= 0) && (std::abs(right[xr] - value) <= maxDiff);
+                        }
+
+                        m[x] = keep ? 255 : 0;
+                        if (out16) {
+                            out16[x] = keep ? value : 0;
+                        }
+                        else {
+                            out32[x] = keep ? value * scale : 0.0f;
+                        }
+                    }
+
+                    continue;
+                }
+
+#if CV_SIMD128
+                const cv::v_int16x8 vKeepAbove = cv::v_setall_s16(keepAbove);
+                const cv::v_float32x4 vScale = cv::v_setall_f32(scale);
+
+                for (; x <= region.width - cv::v_int16x8::nlanes; x += cv::v_int16x8::nlanes)
+                {
+                    const cv::v_int16x8 keep = cv::v_load(d + x) > vKeepAbove;
+                    const cv::v_int16x8 value = cv::v_load(d + x) & keep;
+
+                    // all ones mask packs to 0xFF
+                    cv::v_pack_store(reinterpret_cast<schar*>(m + x), keep);
+
+                    if (out16) {
+                        cv::v_store(out16 + x, value);
+                    }
+                    else {
+                        cv::v_int32x4 low, high;
+                        cv::v_expand(value, low, high);
+                        cv::v_store(out32 + x, cv::v_cvt_f32(low) * vScale);
+                        cv::v_store(out32 + x + cv::v_float32x4::nlanes, cv::v_cvt_f32(high) * vScale);
+                    }
+                }
+#endif
+                for (; x < region.width; x++)
+                {
+                    const bool keep = d[x] > keepAbove;
+                    m[x] = keep ? 255 : 0;
+                    if (out16) {
+                        out16[x] = keep ? d[x] : 0;
+                    }
+                    else {
+                        out32[x] = keep ? d[x] * scale : 0.0f;
+                    }
+                }
+            }
+        });
+    }
+
+    // Minimum + factor * std deviation, equivalent to thresholding the min-max normalised disparity at factor * std
+    double DisparityFilter::ComputeConfidenceThreshold(const cv::Mat& disparity) const
+    {
+        CV_Assert(disparity.type() == CV_16S);
+
+        if (disparity.empty()) {
+            return 0.0;
+        }
+
+        // per-row partial sums, reduced afterwards
+        std::vector<int> rowMin(disparity.rows);
+        std::vector<double> rowSum(disparity.rows);
+        std::vector<double> rowSumSq(disparity.rows);
+
+        cv::parallel_for_(cv::Range(0, disparity.rows), [&](const cv::Range& range)
+        {
+            for (int row = range.start; row < range.end; row++)
+            {
+                const short* d = disparity.ptr<short>(row);
+                int minimum = std::numeric_limits<int>::max();
+                int64_t sum = 0;
+                int64_t sumSq = 0;
+
+                for (int col = 0; col < disparity.cols; col++) {
+                    minimum = std::min<int>(minimum, d[col]);
+                    sum += d[col];
+                    sumSq += static_cast<int64_t>(d[col]) * d[col];
+                }
+
+                rowMin[row] = minimum;
+                rowSum[row] = static_cast<double>(sum);
+                rowSumSq[row] = static_cast<double>(sumSq);
+            }
+        });
+
+        int minimum = std::numeric_limits<int>::max();
+        double sum = 0.0;
+        double sumSq = 0.0;
+
+        for (int row = 0; row < disparity.rows; row++) {
+            minimum = std::min(minimum, rowMin[row]);
+            sum += rowSum[row];
+            sumSq += rowSumSq[row];
+        }
+
+        const double count = static_cast<double>(disparity.total());
+        const double mean = sum / count;
+        const double stdDev = std::sqrt(std::max(sumSq / count - mean * mean, 0.0));
+
+        return minimum + m_ConfidenceStdFactor * stdDev;
+    }
+}
@@ -5,17 +5,28 @@
 
 #include "reconstruct/Reconstruct3D.hpp"
 #include "reconstruct/Reconstruct3DTypes.hpp"
+#include "reconstruct/CensusStereoMatcher.hpp"
+#include "camera/CameraCompute.hpp"
 
 #include <opencv2/imgproc/imgproc.hpp>
+#include <opencv2/core/utility.hpp>
+#include <opencv2/core/hal/intrin.hpp>
 #include <opencv2/core/eigen.hpp>
 
 #include <pcl/stereo/disparity_map_converter.h>
 #include <pcl/common/transforms.h>
 
+#include <algorithm>
+#include <climits>
+#include <cmath>
 #include <fstream>
+#include <limits>
 
 #define MISSING_DISPARITY_Z 10000
 
+// rows matched above and below the valid region so matching windows stay inside the image data
+#define MATCHING_ROW_MARGIN 8
+
 namespace Reconstruct
 {
     const int SGM_MIN_DISPARITY = 0;
@@ -23,10 +34,55 @@ namespace Reconstruct
     //constexpr int SGM_P2 = 32 * 3 * SGM_BLOCK_SIZE * SGM_BLOCK_SIZE;
 
     // Constructor
-    Reconstruct3D::Reconstruct3D(const Camera::Calib::StereoCalib& stereoSetup, const Config::Config& config) : m_StereoCameraSetup(stereoSetup)
+    Reconstruct3D::Reconstruct3D(const Camera::Calib::StereoCalib& stereoSetup, const Config::Config& config)
+        : m_InputStereoCameraSetup(stereoSetup), m_ProcessingScale(config.Reconstruction.Scale.Disparity)
 {
+        // intrinsics, rectification and valid regions at the processing scale
+        m_StereoCameraSetup = Camera::CameraCompute::ScaleStereoCalib(stereoSetup, m_ProcessingScale);
+
+        // dense mapping samples the disparity at a lower resolution
+        m_DenseSampleStep = std::max(1, static_cast<int>(std::lround(m_ProcessingScale / std::max(config.Reconstruction.Scale.DenseMapping, 1e-3f))));
+
+        // colour kept for texturing relative to the processing resolution (never upsampled)
+        m_TextureScale = std::min(1.0f, config.Reconstruction.Scale.Texture / m_ProcessingScale);
+
         // setup stereo matcher
         ConfigureSteoreoMatcher(config);
+        SetHierarchicalDisparity(config.Reconstruction.Hierarchical.Enabled, config.Reconstruction.Hierarchical.SearchBand, config.Reconstruction.Hierarchical.WindowRadius);
+        m_TemporalSearchBand = config.Reconstruction.TemporalPrior.SearchBand;
+        m_TemporalWindowRadius = config.Reconstruction.TemporalPrior.WindowRadius;
+        m_SemiDenseEnabled = config.Reconstruction.SemiDense.Enabled;
+        m_SemiDenseGradientThreshold = config.Reconstruction.SemiDense.GradientThreshold;
+        m_SemiDensePointBudget = config.Reconstruction.SemiDense.PointBudget;
+
+        // disparity filter
+        m_LeftRightCheck = config.Reconstruction.DisparityFilter.LeftRightCheck;
+        m_DisparityFilter = DisparityFilter(m_StereoMatcher->getMinDisparity(),
+                                            config.Reconstruction.DisparityFilter.ConfidenceStdFactor,
+                                            config.Reconstruction.DisparityFilter.SpeckleWindowSize,
+                                            config.Reconstruction.DisparityFilter.SpeckleRange,
+                                            config.Reconstruction.DisparityFilter.Disp12MaxDiff);
+
+        // sparse feature matching over the dense matcher's disparity range
+        m_SparseStereoMatcher = SparseStereoMatcher(m_StereoMatcher->getMinDisparity(), m_StereoMatcher->getNumDisparities());
+
+        // valid region after rectification, computed once for this calibration (images used as is keep every pixel)
+        const Eigen::Vector2i& resolution = m_StereoCameraSetup.LeftCameraCalib.ImageResolutionInPixels;
+        const cv::Rect& validRectLeft = m_StereoCameraSetup.Rectification.ValidRectLeft;
+        if (config.Reconstruction.ShouldRectifyImages && validRectLeft.area() > 0 && resolution(0) > 0 && resolution(1) > 0) {
+            m_ValidRectifiedRegion = validRectLeft & cv::Rect(0, 0, resolution(0), resolution(1));
+        }
+
+        // disparity to depth lookup for triangulation
+        BuildDepthLUT();
+
+        // rectification maps are built once for the calibrated input resolution
+        const Eigen::Vector2i& inputResolution = m_InputStereoCameraSetup.LeftCameraCalib.ImageResolutionInPixels;
+        if (!m_StereoCameraSetup.Rectification.PL.empty() && inputResolution(0) > 0 && inputResolution(1) > 0)
+        {
+            m_RectificationInputSize = cv::Size(inputResolution(0), inputResolution(1));
+            BuildRectificationMaps(m_RectificationInputSize, m_RectifyMapLeft1, m_RectifyMapLeft2, m_RectifyMapRight1, m_RectifyMapRight2);
+        }
     
         // calculate and store the Q matrix (3D projection)
         Eigen::Matrix4f Q = Eigen::Matrix4f::Identity();
@@ -43,7 +99,7 @@ namespace Reconstruct
             case STEREO_BLOCK_MATCHER: {
                 SetBlockMatcherType(STEREO_BLOCK_MATCHER);
                 m_StereoMatcher->setBlockSize(config.Reconstruction.SBM.WindowSize);
-                m_StereoMatcher->setNumDisparities(config.Reconstruction.SBM.NumDisparities);
+                m_StereoMatcher->setNumDisparities(ScaleDisparityCount(config.Reconstruction.SBM.NumDisparities));
                 break;
             }
 
@@ -51,10 +107,10 @@ namespace Reconstruct
                 SetBlockMatcherType(STEREO_SEMI_GLOBAL_BLOCK_MATCHER);
                 auto sgbm = std::static_pointer_cast<cv::StereoSGBM>(m_StereoMatcher);
 
-                sgbm->setMinDisparity(config.Reconstruction.SGBM.MinDisparity);
+                sgbm->setMinDisparity(static_cast<int>(std::floor(config.Reconstruction.SGBM.MinDisparity * m_ProcessingScale)));
                 sgbm->setPreFilterCap(config.Reconstruction.SGBM.PreFilterCap);
                 sgbm->setBlockSize(config.Reconstruction.SGBM.BlockSize);
-                sgbm->setNumDisparities(config.Reconstruction.SGBM.NumDisparities);
+                sgbm->setNumDisparities(ScaleDisparityCount(config.Reconstruction.SGBM.NumDisparities));
                 sgbm->setSpeckleRange(config.Reconstruction.SGBM.SpeckleRange);
                 sgbm->setSpeckleWindowSize(config.Reconstruction.SGBM.SpeckleWindowSize);
                 sgbm->setUniquenessRatio(config.Reconstruction.SGBM.UniquenessRatio);
@@ -65,6 +121,22 @@ namespace Reconstruct
 
                 break;
             }
+
+            case STEREO_CENSUS_SEMI_GLOBAL_MATCHER: {
+                SetBlockMatcherType(STEREO_CENSUS_SEMI_GLOBAL_MATCHER);
+                auto csgm = std::static_pointer_cast<CensusStereoMatcher>(m_StereoMatcher);
+
+                csgm->setMinDisparity(static_cast<int>(std::floor(config.Reconstruction.CSGM.MinDisparity * m_ProcessingScale)));
+                csgm->setNumDisparities(ScaleDisparityCount(config.Reconstruction.CSGM.NumDisparities));
+                csgm->setDisp12MaxDiff(config.Reconstruction.CSGM.Disp12MaxDiff);
+                csgm->setSpeckleRange(config.Reconstruction.CSGM.SpeckleRange);
+                csgm->setSpeckleWindowSize(config.Reconstruction.CSGM.SpeckleWindowSize);
+                csgm->SetPenalties(config.Reconstruction.CSGM.P1, config.Reconstruction.CSGM.P2);
+                csgm->SetNumPaths(config.Reconstruction.CSGM.NumPaths);
+                csgm->SetUniquenessRatio(config.Reconstruction.CSGM.UniquenessRatio);
+
+                break;
+            }
         }
     }
 
@@ -78,11 +150,279 @@ namespace Reconstruct
         cv::cvtColor(leftImage, leftImageGrey, cv::COLOR_BGR2GRAY);
         cv::cvtColor(rightImage, rightImageGrey, cv::COLOR_BGR2GRAY);
 
-        m_StereoMatcher->compute(leftImageGrey, rightImageGrey, disparity);
+        // only match the region that can produce valid disparities
+        cv::Rect validROI, inputRegion;
+        GetMatchingRegion(leftImageGrey.size(), validROI, inputRegion);
+
+        if (m_HierarchicalEnabled) {
+            disparity = GenerateDisparityMapHierarchical(leftImageGrey(inputRegion), rightImageGrey(inputRegion));
+        }
+        else {
+            m_StereoMatcher->compute(leftImageGrey(inputRegion), rightImageGrey(inputRegion), disparity);
+        }
+
+        return PasteValidRegion(disparity, validROI, inputRegion, leftImageGrey.size());
+    }
+
+    // Disparity map searched around the previous frame's disparity
+    cv::Mat Reconstruct3D::GenerateDisparityMap(const cv::Mat& leftImage, const cv::Mat& rightImage, const cv::Mat& previousDisparity, const Eigen::Matrix4f& motion) const
+    {
+        cv::Mat leftImageGrey, rightImageGrey;
+        cv::cvtColor(leftImage, leftImageGrey, cv::COLOR_BGR2GRAY);
+        cv::cvtColor(rightImage, rightImageGrey, cv::COLOR_BGR2GRAY);
+
+        cv::Mat prior = WarpDisparity(previousDisparity, motion);
+
+        // only match the region that can produce valid disparities
+        cv::Rect validROI, inputRegion;
+        GetMatchingRegion(leftImageGrey.size(), validROI, inputRegion);
+
+        cv::Mat lowerBound, upperBound, disparity;
+        BuildSearchRanges(prior(inputRegion), m_TemporalSearchBand, true, lowerBound, upperBound);
+        m_RangeStereoMatcher->ComputeInRange(leftImageGrey(inputRegion), rightImageGrey(inputRegion), lowerBound, upperBound, disparity, m_TemporalWindowRadius);
+
+        return PasteValidRegion(disparity, validROI, inputRegion, leftImageGrey.size());
+    }
+
+    // Right disparity map from the mirrored stereo pair
+    cv::Mat Reconstruct3D::GenerateRightDisparityMap(const cv::Mat& leftImage, const cv::Mat& rightImage) const
+    {
+        cv::Mat leftImageGrey, rightImageGrey;
+        cv::cvtColor(leftImage, leftImageGrey, cv::COLOR_BGR2GRAY);
+        cv::cvtColor(rightImage, rightImageGrey, cv::COLOR_BGR2GRAY);
+
+        // mirrored right image becomes the left view
+        cv::Mat leftFlipped, rightFlipped, disparityFlipped, rightDisparity;
+        cv::flip(leftImageGrey, leftFlipped, 1);
+        cv::flip(rightImageGrey, rightFlipped, 1);
+
+        m_StereoMatcher->compute(rightFlipped, leftFlipped, disparityFlipped);
+        cv::flip(disparityFlipped, rightDisparity, 1);
+
+        return rightDisparity;
+    }
+
+    // The census matcher does its own left-right check
+    bool Reconstruct3D::RequiresRightDisparity() const {
+        return m_LeftRightCheck && m_StereoBlockMatcherType != STEREO_CENSUS_SEMI_GLOBAL_MATCHER;
+    }
+
+    // Filter disparity within the valid region
+    void Reconstruct3D::FilterDisparity(cv::Mat& disparity, const cv::Mat& rightDisparity, cv::Mat& filtered, cv::Mat& mask, int outputDepth) const {
+        m_DisparityFilter.Apply(disparity, rightDisparity, GetValidDisparityROI(disparity.size()), filtered, mask, outputDepth);
+    }
+
+    // Valid disparity region of interest
+    cv::Rect Reconstruct3D::GetValidDisparityROI(const cv::Size& imageSize) const
+    {
+        cv::Rect imageRect(cv::Point(0, 0), imageSize);
+        cv::Rect roi = (m_ValidRectifiedRegion.area() > 0) ? (m_ValidRectifiedRegion & imageRect) : imageRect;
+
+        // left columns have no match within the disparity range
+        const int firstColumn = std::max(0, m_StereoMatcher->getMinDisparity() + m_StereoMatcher->getNumDisparities());
+        roi &= cv::Rect(firstColumn, 0, std::max(0, imageSize.width - firstColumn), imageSize.height);
+
+        return roi;
+    }
+
+    // Region of the images passed to the matcher for the valid region
+    void Reconstruct3D::GetMatchingRegion(const cv::Size& imageSize, cv::Rect& validROI, cv::Rect& inputRegion) const
+    {
+        validROI = GetValidDisparityROI(imageSize);
+
+        // columns to the left are needed to match across the whole disparity range
+        const int searchWidth = std::max(0, m_StereoMatcher->getMinDisparity() + m_StereoMatcher->getNumDisparities());
+        const int rowMargin = std::max(MATCHING_ROW_MARGIN, m_StereoMatcher->getBlockSize() / 2 + 1);
+
+        const int x0 = std::max(0, validROI.x - searchWidth);
+        const int y0 = std::max(0, validROI.y - rowMargin);
+        const int x1 = validROI.x + validROI.width;
+        const int y1 = std::min(imageSize.height, validROI.y + validROI.height + rowMargin);
+
+        inputRegion = cv::Rect(x0, y0, x1 - x0, y1 - y0);
+
+        // nothing valid, fall back to matching the whole image
+        if (validROI.area() == 0) {
+            inputRegion = cv::Rect(cv::Point(0, 0), imageSize);
+        }
+    }
+
+    // Copy the valid region of a disparity computed on a sub-image into a full size disparity
+    cv::Mat Reconstruct3D::PasteValidRegion(const cv::Mat& disparity, const cv::Rect& validROI, const cv::Rect& inputRegion, const cv::Size& imageSize) const
+    {
+        const short invalid = static_cast<short>((m_StereoMatcher->getMinDisparity() - 1) * 16);
+        cv::Mat fullDisparity(imageSize, CV_16S, cv::Scalar(invalid));
+
+        disparity(validROI - inputRegion.tl()).copyTo(fullDisparity(validROI));
+
+        return fullDisparity;
+    }
+
+    // Forward warp disparity into the moved camera
+    cv::Mat Reconstruct3D::WarpDisparity(const cv::Mat& disparity, const Eigen::Matrix4f& motion) const
+    {
+        const int minDisparity = m_RangeStereoMatcher->getMinDisparity();
+        const short invalid = static_cast<short>((minDisparity - 1) * 16);
+
+        // baseline and focal length
+        const float b = m_StereoCameraSetup.T(0);
+        const float f = (m_StereoCameraSetup.LeftCameraCalib.K(0, 0) + m_StereoCameraSetup.LeftCameraCalib.K(1, 1)) / 2.0f;
+        const float fb16 = f * b * 16.0f;
+
+        // principal point
+        const float cx = m_StereoCameraSetup.LeftCameraCalib.K(0, 2);
+        const float cy = m_StereoCameraSetup.LeftCameraCalib.K(1, 2);
+
+        const Eigen::Matrix3f R = motion.block<3, 3>(0, 0);
+        const Eigen::Vector3f t = motion.block<3, 1>(0, 3);
+
+        // source rows are warped in parallel stripes, each into its own z-buffer as the targets of stripes overlap
+        const int numStripes = std::max(1, std::min(cv::getNumThreads(), disparity.rows));
+        std::vector<cv::Mat> zBuffers(numStripes);
+
+        cv::parallel_for_(cv::Range(0, numStripes), [&](const cv::Range& range)
+        {
+            for (int stripe = range.start; stripe < range.end; stripe++)
+            {
+                cv::Mat& zBuffer = zBuffers[stripe];
+                zBuffer.create(disparity.size(), CV_16S);
+                zBuffer.setTo(cv::Scalar(invalid));
+
+                const int rowStart = stripe * disparity.rows / numStripes;
+                const int rowEnd = (stripe + 1) * disparity.rows / numStripes;
+
+                for (int row = rowStart; row < rowEnd; row++)
+                {
+                    const short* source = disparity.ptr<short>(row);
+                    const float y = -(static_cast<float>(row) - cy) / f;
+
+                    for (int col = 0; col < disparity.cols; col++)
+                    {
+                        if (source[col] <= 0) {
+                            continue;
+                        }
+
+                        // back project (y up as in Triangulate3D) and move into the target camera
+                        const float z = fb16 / source[col];
+                        const Eigen::Vector3f P = R * Eigen::Vector3f((static_cast<float>(col) - cx) / f * z, y * z, z) + t;
+
+                        if (P(2) <= 0.0f) {
+                            continue;
+                        }
+
+                        const int u = static_cast<int>(std::lround(f * P(0) / P(2) + cx));
+                        const int v = static_cast<int>(std::lround(-f * P(1) / P(2) + cy));
+
+                        if (u < 0 || u >= zBuffer.cols || v < 0 || v >= zBuffer.rows) {
+                            continue;
+                        }
+
+                        // z-buffer: nearest surface (largest disparity) wins
+                        const long d = std::lround(fb16 / P(2));
+                        short& target = zBuffer.at<short>(v, u);
+                        target = static_cast<short>(std::max<long>(target, std::min<long>(d, SHRT_MAX)));
+                    }
+                }
+            }
+        });
+
+        // merge the z-buffers, keeping the nearest surface
+        cv::Mat warped = zBuffers[0];
+        cv::parallel_for_(cv::Range(0, warped.rows), [&](const cv::Range& range)
+        {
+            for (int row = range.start; row < range.end; row++)
+            {
+                short* target = warped.ptr<short>(row);
+                for (int stripe = 1; stripe < numStripes; stripe++)
+                {
+                    const short* source = zBuffers[stripe].ptr<short>(row);
+                    for (int col = 0; col < warped.cols; col++) {
+                        target[col] = std::max(target[col], source[col]);
+                    }
+                }
+            }
+        });
+
+        // close the single pixel cracks left by forward warping
+        cv::Mat dilated;
+        cv::dilate(warped, dilated, cv::Mat());
+        dilated.copyTo(warped, warped == invalid);
+
+        return warped;
+    }
+
+    // Coarse-to-fine disparity map
+    cv::Mat Reconstruct3D::GenerateDisparityMapHierarchical(const cv::Mat& leftImageGrey, const cv::Mat& rightImageGrey) const
+    {
+        // full search at half resolution
+        cv::Mat leftCoarse, rightCoarse, coarseDisparity;
+        cv::pyrDown(leftImageGrey, leftCoarse);
+        cv::pyrDown(rightImageGrey, rightCoarse);
+
+        m_CoarseStereoMatcher->compute(leftCoarse, rightCoarse, coarseDisparity);
+
+        // upsample the estimate, disparities double at full resolution (invalid values stay below the minimum)
+        cv::Mat prior;
+        cv::resize(coarseDisparity, prior, leftImageGrey.size(), 0, 0, cv::INTER_NEAREST);
+        prior.convertTo(prior, CV_16S, 2.0);
+
+        // refine at full resolution within the band around the estimate, pixels the coarse match rejected stay invalid
+        cv::Mat lowerBound, upperBound, disparity;
+        BuildSearchRanges(prior, m_HierarchicalSearchBand, false, lowerBound, upperBound);
+        m_RangeStereoMatcher->ComputeInRange(leftImageGrey, rightImageGrey, lowerBound, upperBound, disparity, m_HierarchicalWindowRadius);
 
         return disparity;
     }
 
+    // Per-pixel disparity search ranges around a 16x fixed point disparity estimate
+    void Reconstruct3D::BuildSearchRanges(const cv::Mat& prior, int band, bool searchInvalid, cv::Mat& lowerBound, cv::Mat& upperBound) const
+    {
+        const int minDisparity = m_RangeStereoMatcher->getMinDisparity();
+        const int maxDisparity = minDisparity + m_RangeStereoMatcher->getNumDisparities() - 1;
+        const int invalidBelow = minDisparity * 16;
+
+        // neighbourhood min / max so the band covers both sides of depth edges
+        cv::Mat priorMin, priorMax;
+        cv::erode(prior, priorMin, cv::Mat());
+        cv::dilate(prior, priorMax, cv::Mat());
+
+        lowerBound.create(prior.size(), CV_16S);
+        upperBound.create(prior.size(), CV_16S);
+
+        for (int row = 0; row < prior.rows; row++)
+        {
+            const short* p = prior.ptr<short>(row);
+            const short* pMin = priorMin.ptr<short>(row);
+            const short* pMax = priorMax.ptr<short>(row);
+            short* lower = lowerBound.ptr<short>(row);
+            short* upper = upperBound.ptr<short>(row);
+
+            for (int col = 0; col < prior.cols; col++)
+            {
+                // no estimate here, leave the pixel invalid (empty range)
+                if (!searchInvalid && p[col] < invalidBelow) {
+                    lower[col] = static_cast<short>(maxDisparity);
+                    upper[col] = static_cast<short>(minDisparity - 1);
+                    continue;
+                }
+
+                // no estimate anywhere nearby, search the full range
+                if (pMax[col] < invalidBelow) {
+                    lower[col] = static_cast<short>(minDisparity);
+                    upper[col] = static_cast<short>(maxDisparity);
+                    continue;
+                }
+
+                // an invalid neighbour opens the band down to the minimum only when invalid estimates are searched
+                int lo = (pMin[col] >= invalidBelow) ? (pMin[col] >> 4) - band : (searchInvalid ? minDisparity : (p[col] >> 4) - band);
+                int hi = ((pMax[col] + 15) >> 4) + band;
+
+                lower[col] = static_cast<short>(std::max(lo, minDisparity));
+                upper[col] = static_cast<short>(std::min(hi, maxDisparity));
+            }
+        }
+    }
+
     // Get camera intrinsics
     void Reconstruct3D::GetCameraParameters(float& fx, float& fy, float& cx, float& cy, int camNumber) const
     {
@@ -155,21 +495,18 @@ namespace Reconstruct
     // Generate point cloud by direct calculation from disparity
     pcl::PointCloud<pcl::PointXYZRGB> Reconstruct3D::Triangulate3D(const cv::Mat& disparity, const cv::Mat& cameraImage, cv::InputArray& mask) const
     {
-        pcl::PointCloud<pcl::PointXYZRGB> pointCloud;
+        CV_Assert(disparity.type() == CV_32F || disparity.type() == CV_16S);
 
-        cv::Vec3f coords;
-        pcl::PointXYZRGB point;
-
-        uint32_t count = 0;
-        float d;
+        pcl::PointCloud<pcl::PointXYZRGB> pointCloud;
 
         // baseline and focal length
-        float b = m_StereoCameraSetup.T(0);
-        float f = (m_StereoCameraSetup.LeftCameraCalib.K(0, 0) + m_StereoCameraSetup.LeftCameraCalib.K(1, 1)) / 2.0f;
+        const float b = m_StereoCameraSetup.T(0);
+        const float f = (m_StereoCameraSetup.LeftCameraCalib.K(0, 0) + m_StereoCameraSetup.LeftCameraCalib.K(1, 1)) / 2.0f;
+        const float fb16 = f * b * 16.0f;
 
         // principal point
-        float cx = m_StereoCameraSetup.LeftCameraCalib.K(0, 2);
-        float cy = m_StereoCameraSetup.LeftCameraCalib.K(1, 2);
+        const float cx = m_StereoCameraSetup.LeftCameraCalib.K(0, 2);
+        const float cy = m_StereoCameraSetup.LeftCameraCalib.K(1, 2);
 
         bool applyingMask = (&mask != &cv::noArray());
         cv::Mat maskImage;
@@ -177,47 +514,210 @@ namespace Reconstruct
             maskImage = mask.getMat();
         }
 
-        for (int i = 0; i < disparity.rows; i++)
+        // only the valid region can hold disparities, sampled every step pixels for dense mapping
+        const cv::Rect roi = GetValidDisparityROI(disparity.size());
+        const int step = m_DenseSampleStep;
+        const int width = (roi.width + step - 1) / step;
+        const int height = (roi.height + step - 1) / step;
+        const bool fixedPoint = (disparity.type() == CV_16S);
+        const int lutSize = static_cast<int>(m_DisparityDepthLUT.size());
+
+        // per-column and per-row ray factors: x = columnRay * z, y = rowRay * z
+        std::vector<float> columnRays(width);
+        for (int j = 0; j < width; j++) {
+            columnRays[j] = (static_cast<float>(roi.x + j * step) - cx) / f;
+        }
+
+        std::vector<float> rowRays(height);
+        for (int i = 0; i < height; i++) {
+            rowRays[i] = -(static_cast<float>(roi.y + i * step) - cy) / f;
+        }
+
+        // colour pixel of each sample, the colour image may be downscaled for texturing
+        std::vector<int> colourColumns(width);
+        for (int j = 0; j < width; j++) {
+            colourColumns[j] = (roi.x + j * step) * cameraImage.cols / disparity.cols;
+        }
+
+        // 16x fixed point disparity of a row (0 where invalid or masked)
+        auto quantiseRow = [&](int row, int* fixed)
+        {
+            if (fixedPoint) {
+                const short* d = disparity.ptr<short>(row) + roi.x;
+                for (int j = 0; j < width; j++) {
+                    fixed[j] = std::max(static_cast<int>(d[j * step]), 0);
+                }
+            }
+            else {
+                const float* d = disparity.ptr<float>(row) + roi.x;
+                for (int j = 0; j < width; j++) {
+                    fixed[j] = std::max(cvRound(d[j * step] * 16.0f), 0);
+                }
+            }
+
+            if (applyingMask) {
+                const uchar* m = maskImage.ptr<uchar>(row) + roi.x;
+                for (int j = 0; j < width; j++) {
+                    fixed[j] = (m[j * step] == 0) ? 0 : fixed[j];
+                }
+            }
+        };
+
+        // count points per row so the cloud can be sized up front
+        std::vector<int> rowOffsets(height + 1, 0);
+        cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& range)
         {
-            for (int j = 0; j < disparity.cols; j++)
+            std::vector<int> fixed(width);
+            for (int i = range.start; i < range.end; i++)
             {
-                // skip zero disparities
-                d = disparity.at<float>(i, j);
-                if (d <= 0.0) {
-                    continue;
+                quantiseRow(roi.y + i * step, fixed.data());
+                rowOffsets[i + 1] = static_cast<int>(width - std::count(fixed.begin(), fixed.end(), 0));
+            }
+        });
+
+        for (int i = 0; i < height; i++) {
+            rowOffsets[i + 1] += rowOffsets[i];
+        }
+
+        pointCloud.points.resize(rowOffsets[height]);
+
+        // triangulate rows in parallel, each writing to its own range of the cloud
+        cv::parallel_for_(cv::Range(0, height), [&](const cv::Range& range)
+        {
+            std::vector<int> fixed(width);
+            std::vector<float> depth(width);
+            std::vector<float> x(width);
+
+            for (int i = range.start; i < range.end; i++)
+            {
+                const int row = roi.y + i * step;
+                quantiseRow(row, fixed.data());
+
+                // depth from the lookup table
+                for (int j = 0; j < width; j++) {
+                    depth[j] = (fixed[j] < lutSize) ? m_DisparityDepthLUT[fixed[j]] : fb16 / static_cast<float>(fixed[j]);
                 }
 
-                // check for mask and skip triangulation if mask is being applied
-                if (applyingMask) {
-                    int value = static_cast<int>(maskImage.at<unsigned char>(i, j));
-                    if (value == 0) {
+                // horizontal coordinate for the whole row
+                int j = 0;
+#if CV_SIMD128
+                for (; j <= width - cv::v_float32x4::nlanes; j += cv::v_float32x4::nlanes) {
+                    cv::v_store(x.data() + j, cv::v_load(columnRays.data() + j) * cv::v_load(depth.data() + j));
+                }
+#endif
+                for (; j < width; j++) {
+                    x[j] = columnRays[j] * depth[j];
+                }
+
+                // write valid points
+                const cv::Vec3b* color = cameraImage.ptr<cv::Vec3b>(row * cameraImage.rows / disparity.rows);
+                pcl::PointXYZRGB* point = pointCloud.points.data() + rowOffsets[i];
+
+                for (j = 0; j < width; j++)
+                {
+                    if (fixed[j] == 0) {
                         continue;
                     }
-                }
 
-                point.z = f * b / d;
-                point.x = (static_cast<float>(j) - cx) * (point.z / f);
-                point.y = -(static_cast<float>(i) - cy) * (point.z / f);
+                    point->x = x[j];
+                    point->y = rowRays[i] * depth[j];
+                    point->z = depth[j];
 
-                point.r = cameraImage.at<cv::Vec3b>(i, j)[2];
-                point.g = cameraImage.at<cv::Vec3b>(i, j)[1];
-                point.b = cameraImage.at<cv::Vec3b>(i, j)[0];
+                    const cv::Vec3b& c = color[colourColumns[j]];
+                    point->r = c[2];
+                    point->g = c[1];
+                    point->b = c[0];
 
-                pointCloud.push_back(point);
-                count++;
+                    point++;
+                }
             }
-        }
+        });
 
-        pointCloud.width = count;
+        pointCloud.width = static_cast<uint32_t>(pointCloud.points.size());
         pointCloud.height = 1;
         pointCloud.is_dense = true;
 
         return pointCloud;
     }
 
+    // Semi-dense pixel selection
+    cv::Mat Reconstruct3D::SelectSemiDensePixels(const cv::Mat& cameraImage, const cv::Mat& mask) const
+    {
+        if (!m_SemiDenseEnabled) {
+            return mask;
+        }
+
+        const cv::Rect roi = GetValidDisparityROI(mask.size());
+        cv::Mat semiDenseMask = cv::Mat::zeros(mask.size(), CV_8U);
+
+        // gradient magnitude (|dx| + |dy|) / 8 in 8 bits
+        cv::Mat grey, dx, dy, absDx, absDy, gradient;
+        if (cameraImage.channels() == 1) {
+            grey = cameraImage(roi);
+        }
+        else {
+            cv::cvtColor(cameraImage(roi), grey, cv::COLOR_BGR2GRAY);
+        }
+        cv::Sobel(grey, dx, CV_16S, 1, 0);
+        cv::Sobel(grey, dy, CV_16S, 0, 1);
+        cv::convertScaleAbs(dx, absDx, 0.125);
+        cv::convertScaleAbs(dy, absDy, 0.125);
+        cv::add(absDx, absDy, gradient);
+
+        const cv::Mat maskROI = mask(roi);
+        int threshold = std::max(0, std::min(m_SemiDenseGradientThreshold, 255));
+
+        // raise the threshold until the strongest gradients fit in the point budget
+        if (m_SemiDensePointBudget > 0)
+        {
+            std::vector<int> histogram(256, 0);
+            for (int row = 0; row < gradient.rows; row++)
+            {
+                const uchar* g = gradient.ptr<uchar>(row);
+                const uchar* m = maskROI.ptr<uchar>(row);
+                for (int col = 0; col < gradient.cols; col++) {
+                    histogram[g[col]] += (m[col] != 0);
+                }
+            }
+
+            int count = 0;
+            for (int level = 255; level >= threshold; level--)
+            {
+                count += histogram[level];
+                if (count > m_SemiDensePointBudget) {
+                    threshold = level + 1;
+                    break;
+                }
+            }
+        }
+
+        cv::Mat selected = semiDenseMask(roi);
+        cv::compare(gradient, threshold, selected, cv::CMP_GE);
+        cv::bitwise_and(selected, maskROI, selected);
+
+        return semiDenseMask;
+    }
+
+    // Depth for each 16x fixed point disparity in the matcher's range
+    void Reconstruct3D::BuildDepthLUT()
+    {
+        const float b = m_StereoCameraSetup.T(0);
+        const float f = (m_StereoCameraSetup.LeftCameraCalib.K(0, 0) + m_StereoCameraSetup.LeftCameraCalib.K(1, 1)) / 2.0f;
+        const int maxDisparity = std::max(0, m_StereoMatcher->getMinDisparity() + m_StereoMatcher->getNumDisparities());
+
+        m_DisparityDepthLUT.resize(maxDisparity * 16 + 1);
+        m_DisparityDepthLUT[0] = 0.0f;
+
+        for (size_t i = 1; i < m_DisparityDepthLUT.size(); i++) {
+            m_DisparityDepthLUT[i] = f * b * 16.0f / static_cast<float>(i);
+        }
+    }
+
     // Triangulate vector of 2D points using disparity
     void Reconstruct3D::TriangulatePoints(const cv::Mat& disparity, const cv::Mat& cameraImage, const std::vector<cv::KeyPoint>& points, std::vector<pcl::PointXYZRGB>& triangulatedPoints) const
     {
+        CV_Assert(disparity.type() == CV_32F || disparity.type() == CV_16S);
+        
         // get cam params
         float fx, fy, cx, cy, b;
         GetCameraParameters(fx, fy, cx, cy);
@@ -229,14 +729,16 @@ namespace Reconstruct
         
         int row = 0; int col = 0;
         
+        triangulatedPoints.reserve(triangulatedPoints.size() + points.size());
+        
         // triangulate each 2D point to 3D
         for (const cv::KeyPoint& p : points)
         {
             row = static_cast<int>(p.pt.y);
             col = static_cast<int>(p.pt.x);
             
-            d = disparity.at<float>(row, col);
-            color = cameraImage.at<cv::Vec3b>(p.pt.y, p.pt.x);
+            d = GetDisparityAt(disparity, row, col);
+            color = cameraImage.at<cv::Vec3b>(row * cameraImage.rows / disparity.rows, col * cameraImage.cols / disparity.cols);
             
             // no disparity for this point!
             if (d <= 0.0)
@@ -256,25 +758,103 @@ namespace Reconstruct
         }
     }
 
-    // Nearest neighbourhood disparity that is not zero
-    float Reconstruct3D::GetNearestNeighbourDisparity(const cv::Mat& disparity, int row, int col, int n) const
+    // Triangulate features from sparse stereo matches
+    void Reconstruct3D::TriangulateStereoFeatures(const cv::Mat& leftImage, const cv::Mat& rightImage, const cv::Mat& cameraImage,
+                                                  const std::vector<cv::KeyPoint>& leftKeypoints, const cv::Mat& leftDescriptors,
+                                                  const std::vector<cv::KeyPoint>& rightKeypoints, const cv::Mat& rightDescriptors,
+                                                  std::vector<pcl::PointXYZRGB>& triangulatedPoints) const
+    {
+        std::vector<float> disparities;
+        m_SparseStereoMatcher.Compute(leftImage, rightImage, leftKeypoints, leftDescriptors, rightKeypoints, rightDescriptors, disparities);
+        
+        float fx, fy, cx, cy;
+        GetCameraParameters(fx, fy, cx, cy);
+        const float b = m_StereoCameraSetup.T(0);
+        const float invalid = std::numeric_limits<float>::quiet_NaN();
+        
+        triangulatedPoints.resize(leftKeypoints.size());
+        
+        for (size_t i = 0; i < leftKeypoints.size(); i++)
+        {
+            const cv::Point2f& p = leftKeypoints[i].pt;
+            const int row = std::min(static_cast<int>(p.y) * cameraImage.rows / leftImage.rows, cameraImage.rows - 1);
+            const int col = std::min(static_cast<int>(p.x) * cameraImage.cols / leftImage.cols, cameraImage.cols - 1);
+            const cv::Vec3b& color = cameraImage.at<cv::Vec3b>(row, col);
+            
+            pcl::PointXYZRGB& P = triangulatedPoints[i];
+            P = pcl::PointXYZRGB(color[2], color[1], color[0]);
+            
+            // no match for this feature
+            if (disparities[i] <= 0.0f) {
+                P.x = P.y = P.z = invalid;
+                continue;
+            }
+            
+            P.z = fx * b / disparities[i];
+            P.x = (p.x - cx) * P.z / fx;
+            P.y = -(p.y - cy) * P.z / fy;
+        }
+    }
+
+    // Project 3D points, the inverse of the triangulation
+    void Reconstruct3D::ProjectPoints(const std::vector<pcl::PointXYZRGB>& points, const Eigen::Matrix4f& transform, std::vector<cv::Point2f>& pixels) const
     {
-        cv::Mat image;
-        cv::Rect roi;
+        float fx, fy, cx, cy;
+        GetCameraParameters(fx, fy, cx, cy);
+        
+        const float invalid = std::numeric_limits<float>::quiet_NaN();
+        pixels.assign(points.size(), cv::Point2f(invalid, invalid));
         
-        roi.x = (col - n) >= 0 ? (col - n) : 0;
-        roi.y = (row - n) >= 0 ? (row - n) : 0;
-        roi.width = (col + n) < disparity.cols ? n : (disparity.cols - 1);
-        roi.height = (row + n) < disparity.rows ? n : (disparity.rows - 1);
+        for (size_t i = 0; i < points.size(); i++)
+        {
+            const pcl::PointXYZRGB& p = points[i];
+            if (!std::isfinite(p.z) || p.z <= 0) {
+                continue;
+            }
+            
+            const Eigen::Vector4f P = transform * Eigen::Vector4f(p.x, p.y, p.z, 1.0f);
+            if (P.z() <= 0) {
+                continue;
+            }
+            
+            pixels[i].x = fx * P.x() / P.z() + cx;
+            pixels[i].y = -fy * P.y() / P.z() + cy;
+        }
+    }
+
+    // Disparity in pixels at a point of a 16x fixed point or float disparity image
+    float Reconstruct3D::GetDisparityAt(const cv::Mat& disparity, int row, int col) const
+    {
+        if (disparity.type() == CV_16S) {
+            return disparity.at<short>(row, col) / 16.0f;
+        }
         
-        image = disparity(roi);
+        return disparity.at<float>(row, col);
+    }
+
+    // Nearest neighbourhood disparity that is not zero
+    float Reconstruct3D::GetNearestNeighbourDisparity(const cv::Mat& disparity, int row, int col, int n) const
+    {
+        const int rowStart = std::max(row - n, 0);
+        const int rowEnd = std::min(row + n, disparity.rows - 1);
+        const int colStart = std::max(col - n, 0);
+        const int colEnd = std::min(col + n, disparity.cols - 1);
         
-        for (int i = 0; i < image.rows; i++)
+        // search outwards in rings so the closest valid disparity is returned
+        for (int radius = 1; radius <= n; radius++)
         {
-            for (int j = 0; j < image.cols; j++)
+            for (int i = std::max(row - radius, rowStart); i <= std::min(row + radius, rowEnd); i++)
             {
-                if (image.at<float>(row, col) > 0) {
-                    return image.at<float>(row, col);
+                for (int j = std::max(col - radius, colStart); j <= std::min(col + radius, colEnd); j++)
+                {
+                    if (std::abs(i - row) != radius && std::abs(j - col) != radius) {
+                        continue;
+                    }
+                    
+                    const float d = GetDisparityAt(disparity, i, j);
+                    if (d > 0) {
+                        return d;
+                    }
                 }
             }
         }
@@ -329,49 +909,158 @@ namespace Reconstruct
     // Apply stereo rectification to left and right images
     void Reconstruct3D::RectifyImages(const cv::Mat& leftImage, const cv::Mat& rightImage, cv::Mat& rectLeftImage, cv::Mat& rectRightImage) const
     {
-        // convert to cv from eigen
+        // use the cached maps when the input matches the calibrated resolution
+        if (leftImage.size() == m_RectificationInputSize)
+        {
+            cv::remap(leftImage, rectLeftImage, m_RectifyMapLeft1, m_RectifyMapLeft2, cv::INTER_LINEAR);
+            cv::remap(rightImage, rectRightImage, m_RectifyMapRight1, m_RectifyMapRight2, cv::INTER_LINEAR);
+            return;
+        }
+
+        cv::Mat map11, map12, map21, map22;
+        BuildRectificationMaps(leftImage.size(), map11, map12, map21, map22);
+
+        cv::remap(leftImage, rectLeftImage, map11, map12, cv::INTER_LINEAR);
+        cv::remap(rightImage, rectRightImage, map21, map22, cv::INTER_LINEAR);
+    }
+
+    // Rectification maps from input resolution to rectified images at processing scale
+    void Reconstruct3D::BuildRectificationMaps(const cv::Size& inputSize, cv::Mat& mapLeft1, cv::Mat& mapLeft2, cv::Mat& mapRight1, cv::Mat& mapRight2) const
+    {
+        // convert to cv from eigen (intrinsics of the input images)
         cv::Mat K1, K2;
         std::vector<float> D1, D2;
 
-        cv::eigen2cv(m_StereoCameraSetup.LeftCameraCalib.K, K1);
+        cv::eigen2cv(m_InputStereoCameraSetup.LeftCameraCalib.K, K1);
         K1.convertTo(K1, CV_64F);
 
-        cv::eigen2cv(m_StereoCameraSetup.RightCameraCalib.K, K2);
+        cv::eigen2cv(m_InputStereoCameraSetup.RightCameraCalib.K, K2);
         K2.convertTo(K2, CV_64F);
 
-        cv::eigen2cv(m_StereoCameraSetup.LeftCameraCalib.D, D1);
-        cv::eigen2cv(m_StereoCameraSetup.RightCameraCalib.D, D2);
+        cv::eigen2cv(m_InputStereoCameraSetup.LeftCameraCalib.D, D1);
+        cv::eigen2cv(m_InputStereoCameraSetup.RightCameraCalib.D, D2);
 
-        // other required matrices
+        // rectified projections at processing scale
         cv::Mat R1 = m_StereoCameraSetup.Rectification.RL;
         cv::Mat R2 = m_StereoCameraSetup.Rectification.RR;
         cv::Mat P1 = m_StereoCameraSetup.Rectification.PL;
         cv::Mat P2 = m_StereoCameraSetup.Rectification.PR;
 
-        cv::Size size(leftImage.cols, rightImage.rows);
+        cv::Size size(static_cast<int>(std::lround(inputSize.width * m_ProcessingScale)), static_cast<int>(std::lround(inputSize.height * m_ProcessingScale)));
 
-        // remap image using rectified projection
-        cv::Mat map11, map12, map21, map22;
-        initUndistortRectifyMap(K1, D1, R1, P1, size, CV_16SC2, map11, map12);
-        initUndistortRectifyMap(K2, D2, R2, P2, size, CV_16SC2, map21, map22);
+        // remap resamples straight to the processing resolution
+        cv::initUndistortRectifyMap(K1, D1, R1, P1, size, CV_16SC2, mapLeft1, mapLeft2);
+        cv::initUndistortRectifyMap(K2, D2, R2, P2, size, CV_16SC2, mapRight1, mapRight2);
+    }
 
-        cv::Mat leftImageRectified, rightImageRectified;
-        cv::remap(leftImage, rectLeftImage, map11, map12, cv::INTER_LINEAR);
-        cv::remap(rightImage, rectRightImage, map21, map22, cv::INTER_LINEAR);
+    // Resize to processing scale
+    void Reconstruct3D::ResizeToProcessingScale(const cv::Mat& image, cv::Mat& scaledImage) const
+    {
+        if (m_ProcessingScale == 1.0f) {
+            scaledImage = image;
+            return;
+        }
+
+        cv::resize(image, scaledImage, cv::Size(), m_ProcessingScale, m_ProcessingScale, cv::INTER_AREA);
+    }
+
+    float Reconstruct3D::GetProcessingScale() const {
+        return m_ProcessingScale;
+    }
+
+    // Texture resolution
+    void Reconstruct3D::ResizeToTextureScale(const cv::Mat& image, cv::Mat& scaledImage) const
+    {
+        if (m_TextureScale >= 1.0f) {
+            scaledImage = image;
+            return;
+        }
+
+        cv::resize(image, scaledImage, cv::Size(), m_TextureScale, m_TextureScale, cv::INTER_AREA);
+    }
+
+    // Number of disparities at processing scale (multiple of 16)
+    int Reconstruct3D::ScaleDisparityCount(int numDisparities) const {
+        return std::max(16, ((static_cast<int>(std::ceil(numDisparities * m_ProcessingScale)) + 15) / 16) * 16);
     }
 
     // Setters
 
-    void Reconstruct3D::SetStereoBMWindowSize(int size) {
+    void Reconstruct3D::SetStereoBMWindowSize(int size)
+    {
         m_StereoMatcher->setBlockSize(size);
+
+        ConfigureRefinementMatchers();
     }
 
-    void Reconstruct3D::SetStereoBMNumDisparities(int num) {
+    void Reconstruct3D::SetStereoBMNumDisparities(int num)
+    {
         m_StereoMatcher->setNumDisparities(num);
+        BuildDepthLUT();
+
+        ConfigureRefinementMatchers();
+    }
+
+    void Reconstruct3D::SetHierarchicalDisparity(bool enabled, int searchBand, int windowRadius)
+    {
+        m_HierarchicalEnabled = enabled;
+        m_HierarchicalSearchBand = searchBand;
+        m_HierarchicalWindowRadius = windowRadius;
+
+        ConfigureRefinementMatchers();
+    }
+
+    // Configure the half resolution matcher and the full resolution refinement from the current matcher
+    void Reconstruct3D::ConfigureRefinementMatchers()
+    {
+        const int minDisparity = m_StereoMatcher->getMinDisparity();
+        const int numDisparities = m_StereoMatcher->getNumDisparities();
+
+        // half the range at half resolution, rounded up to a multiple of 16
+        const int coarseMinDisparity = static_cast<int>(std::floor(minDisparity / 2.0));
+        const int coarseNumDisparities = std::max(16, ((numDisparities / 2 + 15) / 16) * 16);
+        const int coarseBlockSize = std::max(5, (m_StereoMatcher->getBlockSize() / 2) | 1);
+
+        switch (m_StereoBlockMatcherType)
+        {
+            case STEREO_BLOCK_MATCHER: {
+                m_CoarseStereoMatcher = cv::StereoBM::create(coarseNumDisparities, coarseBlockSize);
+                m_CoarseStereoMatcher->setMinDisparity(coarseMinDisparity);
+                break;
+            }
+
+            case STEREO_SEMI_GLOBAL_BLOCK_MATCHER: {
+                auto sgbm = std::static_pointer_cast<cv::StereoSGBM>(m_StereoMatcher);
+                const int blockSize = std::max(1, sgbm->getBlockSize() / 2) | 1;
+
+                m_CoarseStereoMatcher = cv::StereoSGBM::create(coarseMinDisparity, coarseNumDisparities, blockSize,
+                                                               8 * 3 * blockSize * blockSize, 32 * 3 * blockSize * blockSize,
+                                                               sgbm->getDisp12MaxDiff(), sgbm->getPreFilterCap(), sgbm->getUniquenessRatio(),
+                                                               sgbm->getSpeckleWindowSize() / 4, sgbm->getSpeckleRange());
+                break;
+            }
+
+            case STEREO_CENSUS_SEMI_GLOBAL_MATCHER: {
+                auto csgm = std::static_pointer_cast<CensusStereoMatcher>(m_StereoMatcher);
+                auto coarse = CensusStereoMatcher::create(coarseMinDisparity, coarseNumDisparities, csgm->GetP1(), csgm->GetP2(), csgm->GetNumPaths());
+
+                coarse->SetUniquenessRatio(csgm->GetUniquenessRatio());
+                coarse->setDisp12MaxDiff(csgm->getDisp12MaxDiff());
+                coarse->setSpeckleRange(csgm->getSpeckleRange());
+                coarse->setSpeckleWindowSize(csgm->getSpeckleWindowSize() / 4);
+
+                m_CoarseStereoMatcher = coarse;
+                break;
+            }
+        }
+
+        m_RangeStereoMatcher = CensusStereoMatcher::create(minDisparity, numDisparities);
     }
 
     void Reconstruct3D::SetBlockMatcherType(StereoBlockMatcherType type)
     {
+        m_StereoBlockMatcherType = type;
+
         // create block matchers with default args
         switch (type)
         {
@@ -381,6 +1070,11 @@ namespace Reconstruct
 
             case STEREO_SEMI_GLOBAL_BLOCK_MATCHER:
                 m_StereoMatcher = cv::StereoSGBM::create(0, 16, 3);
+                break;
+
+            case STEREO_CENSUS_SEMI_GLOBAL_MATCHER:
+                m_StereoMatcher = CensusStereoMatcher::create(0, 16);
+                break;
         }
     }
 }
@@ -0,0 +1,195 @@
+//
+// SparseStereoMatcher.cpp
+// Matches left image features to right image features along the rectified scanline, with sub-pixel refinement
+// of the disparity by patch correlation
+//
+
+#include "reconstruct/SparseStereoMatcher.hpp"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+
+#include <opencv2/core/utility.hpp>
+#include <opencv2/core/hal/hal.hpp>
+
+// matches with a patch cost above this factor of the median cost are rejected
+#define OUTLIER_COST_FACTOR 2.1f
+
+namespace Reconstruct
+{
+    // Constructor
+    SparseStereoMatcher::SparseStereoMatcher(int minDisparity, int numDisparities, int maxDescriptorDistance, int rowTolerance, int windowRadius, int refineRadius)
+        : m_MinDisparity(minDisparity), m_NumDisparities(std::max(numDisparities, 1)), m_MaxDescriptorDistance(maxDescriptorDistance),
+          m_RowTolerance(std::max(rowTolerance, 0)), m_WindowRadius(std::max(windowRadius, 1)), m_RefineRadius(std::max(refineRadius, 1))
+    {
+
+    }
+
+    // Scanline descriptor matching, patch refinement and outlier rejection
+    void SparseStereoMatcher::Compute(const cv::Mat& leftImage, const cv::Mat& rightImage,
+                                      const std::vector<cv::KeyPoint>& leftKeypoints, const cv::Mat& leftDescriptors,
+                                      const std::vector<cv::KeyPoint>& rightKeypoints, const cv::Mat& rightDescriptors,
+                                      std::vector<float>& disparities) const
+    {
+        CV_Assert(leftImage.type() == CV_8U && rightImage.type() == CV_8U && leftImage.size() == rightImage.size());
+        CV_Assert(leftDescriptors.rows == static_cast<int>(leftKeypoints.size()) && rightDescriptors.rows == static_cast<int>(rightKeypoints.size()));
+
+        const int count = static_cast<int>(leftKeypoints.size());
+        disparities.assign(count, 0.0f);
+
+        if (count == 0 || rightKeypoints.empty()) {
+            return;
+        }
+
+        CV_Assert(leftDescriptors.type() == CV_8U && rightDescriptors.type() == CV_8U && leftDescriptors.cols == rightDescriptors.cols);
+
+        // right features of each row, including those within the row tolerance (scaled to the level they were detected at)
+        std::vector<std::vector<int>> rowFeatures(rightImage.rows);
+        for (int i = 0; i < static_cast<int>(rightKeypoints.size()); i++)
+        {
+            const int y = cvRound(rightKeypoints[i].pt.y);
+            const int tolerance = m_RowTolerance << std::max(rightKeypoints[i].octave, 0);
+            const int first = std::max(y - tolerance, 0);
+            const int last = std::min(y + tolerance, rightImage.rows - 1);
+            for (int row = first; row <= last; row++) {
+                rowFeatures[row].push_back(i);
+            }
+        }
+
+        const int maxDisparity = m_MinDisparity + m_NumDisparities - 1;
+        std::vector<int> costs(count, -1);
+
+        cv::parallel_for_(cv::Range(0, count), [&](const cv::Range& range)
+        {
+            for (int i = range.start; i < range.end; i++)
+            {
+                const cv::Point2f& left = leftKeypoints[i].pt;
+                const int row = cvRound(left.y);
+                if (row < 0 || row >= leftImage.rows) {
+                    continue;
+                }
+
+                // closest descriptor among the right features within the disparity range on the scanline
+                const float minX = left.x - maxDisparity;
+                const float maxX = left.x - m_MinDisparity;
+                const uchar* descriptor = leftDescriptors.ptr<uchar>(i);
+
+                int bestDistance = INT_MAX;
+                int best = -1;
+                for (int j : rowFeatures[row])
+                {
+                    const float x = rightKeypoints[j].pt.x;
+                    if (x < minX || x > maxX) {
+                        continue;
+                    }
+
+                    const int distance = cv::hal::normHamming(descriptor, rightDescriptors.ptr<uchar>(j), leftDescriptors.cols);
+                    if (distance < bestDistance) {
+                        bestDistance = distance;
+                        best = j;
+                    }
+                }
+
+                if (best < 0 || bestDistance > m_MaxDescriptorDistance) {
+                    continue;
+                }
+
+                float disparity;
+                int cost;
+                if (RefineDisparity(leftImage, rightImage, left, rightKeypoints[best].pt.x, disparity, cost)) {
+                    disparities[i] = disparity;
+                    costs[i] = cost;
+                }
+            }
+        });
+
+        // reject matches whose patches correlate much worse than the typical match
+        std::vector<int> matchedCosts;
+        matchedCosts.reserve(count);
+        for (int cost : costs)
+        {
+            if (cost >= 0) {
+                matchedCosts.push_back(cost);
+            }
+        }
+
+        if (matchedCosts.empty()) {
+            return;
+        }
+
+        std::nth_element(matchedCosts.begin(), matchedCosts.begin() + matchedCosts.size() / 2, matchedCosts.end());
+        const float maxCost = OUTLIER_COST_FACTOR * matchedCosts[matchedCosts.size() / 2];
+
+        for (int i = 0; i < count; i++)
+        {
+            if (costs[i] > maxCost) {
+                disparities[i] = 0.0f;
+            }
+        }
+    }
+
+    // Sum of absolute differences of brightness normalised patches around the matched right feature,
+    // with a parabola fit through the best cost and its neighbours for the sub-pixel offset
+    bool SparseStereoMatcher::RefineDisparity(const cv::Mat& leftImage, const cv::Mat& rightImage, const cv::Point2f& left, float rightX, float& disparity, int& cost) const
+    {
+        const int xl = cvRound(left.x);
+        const int yl = cvRound(left.y);
+        const int xr = cvRound(rightX);
+        const int w = m_WindowRadius;
+        const int L = m_RefineRadius;
+
+        if (yl - w < 0 || yl + w >= leftImage.rows || xl - w < 0 || xl + w >= leftImage.cols ||
+            xr - L - w < 0 || xr + L + w >= rightImage.cols) {
+            return false;
+        }
+
+        const int leftCentre = leftImage.at<uchar>(yl, xl);
+
+        std::vector<int> costs(2 * L + 1);
+        int bestCost = INT_MAX;
+        int bestOffset = 0;
+
+        for (int offset = -L; offset <= L; offset++)
+        {
+            const int rightCentre = rightImage.at<uchar>(yl, xr + offset);
+            int sad = 0;
+
+            for (int dy = -w; dy <= w; dy++)
+            {
+                const uchar* l = leftImage.ptr<uchar>(yl + dy) + xl;
+                const uchar* r = rightImage.ptr<uchar>(yl + dy) + xr + offset;
+                for (int dx = -w; dx <= w; dx++) {
+                    sad += std::abs((l[dx] - leftCentre) - (r[dx] - rightCentre));
+                }
+            }
+
+            costs[offset + L] = sad;
+            if (sad < bestCost) {
+                bestCost = sad;
+                bestOffset = offset;
+            }
+        }
+
+        // the minimum must be inside the search range for the parabola fit
+        if (bestOffset == -L || bestOffset == L) {
+            return false;
+        }
+
+        const float c0 = static_cast<float>(costs[bestOffset + L - 1]);
+        const float c1 = static_cast<float>(costs[bestOffset + L]);
+        const float c2 = static_cast<float>(costs[bestOffset + L + 1]);
+        const float denominator = 2.0f * (c0 + c2 - 2.0f * c1);
+        const float delta = (denominator > 0.0f) ? (c0 - c2) / denominator : 0.0f;
+
+        if (delta < -1.0f || delta > 1.0f) {
+            return false;
+        }
+
+        disparity = left.x - (xr + bestOffset + delta);
+        cost = bestCost;
+
+        return disparity > 0.0f && disparity >= m_MinDisparity && disparity <= m_MinDisparity + m_NumDisparities - 1;
+    }
+}
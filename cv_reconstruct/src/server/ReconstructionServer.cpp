@@ -23,7 +23,6 @@
 #include <opencv2/imgproc/imgproc.hpp>
 
 #define CALIB_FILE_PATH "calib.json"
-#define IMAGE_DOWNSIZE_FACTOR 1.0
 
 namespace Server
 {
@@ -109,19 +108,9 @@ namespace Server
         Camera::Calib::StereoCalib stereoSetup;
         Camera::CameraCompute cameraCompute(*m_Calib);
         stereoSetup = cameraCompute.GetRectifiedStereoSettings();
-        
-        // adjust intrinsics since downscaling images
-        stereoSetup.LeftCameraCalib.K(0, 0) = stereoSetup.LeftCameraCalib.K(0, 0) * IMAGE_DOWNSIZE_FACTOR;
-        stereoSetup.LeftCameraCalib.K(1, 1) = stereoSetup.LeftCameraCalib.K(1, 1) * IMAGE_DOWNSIZE_FACTOR;
-        stereoSetup.LeftCameraCalib.K(0, 2) = stereoSetup.LeftCameraCalib.K(0, 2) * IMAGE_DOWNSIZE_FACTOR;
-        stereoSetup.LeftCameraCalib.K(1, 2) = stereoSetup.LeftCameraCalib.K(1, 2) * IMAGE_DOWNSIZE_FACTOR;
-        
-        stereoSetup.RightCameraCalib.K(0, 0) = stereoSetup.RightCameraCalib.K(0, 0) * IMAGE_DOWNSIZE_FACTOR;
-        stereoSetup.RightCameraCalib.K(1, 1) = stereoSetup.RightCameraCalib.K(1, 1) * IMAGE_DOWNSIZE_FACTOR;
-        stereoSetup.RightCameraCalib.K(0, 2) = stereoSetup.RightCameraCalib.K(0, 2) * IMAGE_DOWNSIZE_FACTOR;
-        stereoSetup.RightCameraCalib.K(1, 2) = stereoSetup.RightCameraCalib.K(1, 2) * IMAGE_DOWNSIZE_FACTOR;
 
         // construct the reconstruction system (pun intended)
+        // images are processed at the configured scales, the reconstructor rescales the calibration to match
         m_ReconstructionSystem = std::make_unique<System::ReconstructionSystem>(m_Config, stereoSetup);
 
         // calib data will be loaded by now - expecting a constant stream of stereo messages at this point
@@ -140,10 +129,6 @@ namespace Server
                 // got a stereo message from the client process with 3D reconstruct
                 frame = Utility::MessageConverter::ConvertStereoMessage(message);
                 frame.ID = m_NumFramesProcessed;
-                
-                // downsize the image to half its size
-                //cv::resize(frame.LeftImage, frame.LeftImage, cv::Size(frame.LeftImage.cols * IMAGE_DOWNSIZE_FACTOR, frame.LeftImage.rows * IMAGE_DOWNSIZE_FACTOR));
-                //cv::resize(frame.RightImage, frame.RightImage, cv::Size(frame.RightImage.cols * IMAGE_DOWNSIZE_FACTOR, frame.RightImage.rows * IMAGE_DOWNSIZE_FACTOR));
 
                 // submit to reconstruction system for processing
                 m_ReconstructionSystem->ProcessStereoFrame(frame);
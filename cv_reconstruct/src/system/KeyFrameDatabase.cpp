@@ -6,32 +6,94 @@
 #include <iostream>
 #include <fstream>
 #include <cmath>
+#include <algorithm>
 
 #include <opencv2/highgui/highgui.hpp>
+#include <opencv2/imgcodecs.hpp>
 
 #include "system/KeyFrameDatabase.hpp"
 
 namespace System
 {
+    // Constructor
+    KeyFrameDatabase::KeyFrameDatabase(const Config::Config& config)
+        : m_PersistImages(config.KeyFrameDatabase.PersistImages), m_ImageExtension("." + config.KeyFrameDatabase.ImageFormat),
+          m_MaxQueuedWrites(static_cast<size_t>(std::max(config.KeyFrameDatabase.MaxQueuedWrites, 1)))
+    {
+        // compression only applies to png, other formats use the OpenCV defaults
+        if (config.KeyFrameDatabase.ImageFormat == "png") {
+            m_ImageWriteParams = { cv::IMWRITE_PNG_COMPRESSION, config.KeyFrameDatabase.CompressionLevel };
+        }
+        
+        if (m_PersistImages) {
+            m_WriterThread = std::thread(&KeyFrameDatabase::RunImageWriter, this);
+        }
+    }
+
+    // Destructor
+    KeyFrameDatabase::~KeyFrameDatabase()
+    {
+        if (!m_WriterThread.joinable()) {
+            return;
+        }
+        
+        // writer drains the queue before stopping
+        {
+            std::lock_guard<std::mutex> lock(m_WriteQueueMutex);
+            m_StopWriter = true;
+        }
+        m_WriteQueued.notify_one();
+        m_WriterThread.join();
+    }
+
     // Insert
     size_t KeyFrameDatabase::InsertKeyFrame(std::shared_ptr<TrackingFrame> frame)
     {
-        size_t id = m_NextUsableID++;
-        
         m_DatabaseMutex.lock();
+        size_t id = m_NextUsableID++;
         m_KeyFrames[id] = frame;
         frame->SetID(id);
         m_LastInsertedID = id;
         m_DatabaseMutex.unlock();
         
-        // save camera image to disk for permanent access
-        cv::imwrite("keyframe_" + std::to_string(id) + ".png", frame->GetCameraImage());
+        // queue camera image for writing to disk for permanent access
+        if (m_PersistImages)
+        {
+            std::unique_lock<std::mutex> lock(m_WriteQueueMutex);
+            m_WriteCompleted.wait(lock, [this] { return m_WriteQueue.size() < m_MaxQueuedWrites; });
+            m_WriteQueue.emplace_back(GetKeyFrameImagePath(id), frame->GetCameraImage());
+            lock.unlock();
+            m_WriteQueued.notify_one();
+        }
         
         std::cout << "\nKey Frame Created: " << "#" << id << std::endl;
         
         return id;
     }
 
+    // Write queued keyframe images until stopped and the queue is empty
+    void KeyFrameDatabase::RunImageWriter()
+    {
+        while (true)
+        {
+            std::unique_lock<std::mutex> lock(m_WriteQueueMutex);
+            m_WriteQueued.wait(lock, [this] { return m_StopWriter || !m_WriteQueue.empty(); });
+            
+            if (m_WriteQueue.empty()) {
+                return;
+            }
+            
+            std::pair<std::string, cv::Mat> write = std::move(m_WriteQueue.front());
+            m_WriteQueue.pop_front();
+            lock.unlock();
+            m_WriteCompleted.notify_one();
+            
+            if (!cv::imwrite(write.first, write.second, m_ImageWriteParams)) {
+                std::cerr << "\nFailed to write keyframe image: " << write.first << std::endl;
+            }
+        }
+    }
+
     // Select by ID
     std::shared_ptr<TrackingFrame> KeyFrameDatabase::SelectKeyFrame(size_t id)
     {
@@ -50,7 +112,7 @@ namespace System
 
     // Get path
     std::string KeyFrameDatabase::GetKeyFrameImagePath(size_t id) const {
-        return std::string("keyframe_" + std::to_string(id) + ".png");
+        return std::string("keyframe_" + std::to_string(id) + m_ImageExtension);
     }
 
     // Update keyframe pose
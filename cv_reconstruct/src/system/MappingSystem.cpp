@@ -7,7 +7,7 @@
 #include <thread>
 #include <chrono>
 #include <cmath>
-#include <set>
+#include <map>
 
 #include <pcl/io/pcd_io.h>
 #include <pcl/common/io.h>
@@ -29,7 +29,7 @@
 namespace System
 {
     // Constructor
-    MappingSystem::MappingSystem(std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor, std::shared_ptr<KeyFrameDatabase> keyFrameDB) : m_3DReconstructor(reconstructor), m_KeyFrameDataBase(keyFrameDB)
+    MappingSystem::MappingSystem(std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor, std::shared_ptr<KeyFrameDatabase> keyFrameDB, const Config::Config& config) : m_3DReconstructor(reconstructor), m_KeyFrameDataBase(keyFrameDB)
     {
         // map database
         m_MapDataBase = std::make_shared<MapDataBase>();
@@ -40,7 +40,7 @@ namespace System
         m_OptimisationGraph = std::make_unique<OptimisationGraph>(fx, fy, cx, cy);
         
         // setup optical flow estimator
-        m_OpticalFlowEstimator = std::make_unique<Features::OpticalFlowEstimator>();
+        m_OpticalFlowEstimator = std::make_unique<Features::OpticalFlowEstimator>(config);
     }
 
     // Start optimisation thread
@@ -291,17 +291,17 @@ namespace System
             std::cout << "\nRotation (Roll, Pitch, Yaw): " << "(" << roll << ", " << pitch << ", " << yaw << ")";
             std::cout << "\n\n||------------------------------------------------------------------------------------||" << std::endl;
             
-            pcl::PointCloud<pcl::PointXYZRGB>::Ptr keyFramePointCloud = keyFrame->GetDensePointCloud();
+            pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr denseCloud = keyFrame->GetDensePointCloud();
             
             // downsample and filter that shit some moaaar
             pcl::VoxelGrid<pcl::PointXYZRGB> voxel_grid;
-            voxel_grid.setInputCloud (keyFramePointCloud);
+            voxel_grid.setInputCloud (denseCloud);
             voxel_grid.setLeafSize (0.2, 0.2, 0.2);
             //voxel_grid.filter(*keyFramePointCloud);
             
             // more noise removal, get that shit out of here
             pcl::RadiusOutlierRemoval<pcl::PointXYZRGB> outrem;
-            outrem.setInputCloud(keyFramePointCloud);
+            outrem.setInputCloud(denseCloud);
             outrem.setRadiusSearch(1.0);
             outrem.setMinNeighborsInRadius(300);
             //outrem.filter (*keyFramePointCloud);
@@ -314,8 +314,9 @@ namespace System
             ST (2,2) = ST (2,2) * S;
             //pcl::transformPointCloud(*keyFramePointCloud, *keyFramePointCloud, ST);
             
-            // move cloud to estimated pose
-            pcl::transformPointCloud(*keyFramePointCloud, *keyFramePointCloud, keyFrame->GetTrackedPose());
+            // move cloud to estimated pose (the frame's cached cloud stays in camera space)
+            pcl::PointCloud<pcl::PointXYZRGB>::Ptr keyFramePointCloud { new pcl::PointCloud<pcl::PointXYZRGB>() };
+            pcl::transformPointCloud(*denseCloud, *keyFramePointCloud, keyFrame->GetTrackedPose());
             
             // icp if previous point cloud is available
             if (m_TargetBlock != nullptr)
@@ -344,6 +345,9 @@ namespace System
             std::shared_ptr<MapBlock> block = std::make_shared<MapBlock>(frames, *keyFramePointCloud);
             m_MapDataBase->InsertBlock(block);
             m_LastKeyFrameAddedToMap = keyFrame;
+            
+            // the map block holds its own copy
+            keyFrame->ReleaseDensePointCloud();
             std::cout << "\nKeyFrame " << "#" << keyFrame->GetID() << " inserted into map";
             
             // debug: sleep for 1 second. Then remove previous point clouds
@@ -368,6 +372,17 @@ namespace System
         // push onto unpotimised block list
         m_UnoptimisedBlocks.push_back(block);
         
+        // sparse feature tracks are only used by local optimisation, so follow them through the keyframes of its blocks
+        if (m_OpticalFlowEstimator->IsSparse())
+        {
+            for (auto keyFrame : keyFrames)
+            {
+                if (!m_OpticalFlowEstimator->IsTracked(keyFrame->GetID())) {
+                    m_OpticalFlowEstimator->TrackFrame(keyFrame->GetID(), keyFrame->GetGreyImage(), keyFrame->GetCameraImageMask());
+                }
+            }
+        }
+        
         // check if local BA is needed
         if (m_UnoptimisedBlocks.size() >= NUM_BLOCKS_FOR_LOCAL_OPTIMISATION) {
             LocalOptimisation();
@@ -392,7 +407,7 @@ namespace System
         std::cout << "\nPerforming local optimisation. " << m_UnoptimisedBlocks.size() << " blocks will be optimised" << std::endl;
         
         // extract all keyframes in the unoptimised blocks
-        std::set<TrackingFrame> keyFrames;
+        std::map<size_t, std::shared_ptr<TrackingFrame>> keyFrames;
         
         // add all poses to graph if not already added
         for (std::shared_ptr<MapBlock> block : m_UnoptimisedBlocks)
@@ -404,7 +419,7 @@ namespace System
                     int cameraVertexID = m_OptimisationGraph->AddDefaultCameraPoseVertex(frame->GetID() < 2);
                     m_CameraGraphIDs[frame->GetID()] = cameraVertexID;
                 }
-                keyFrames.insert(*frame);
+                keyFrames[frame->GetID()] = frame;
             }
         }
         
@@ -413,14 +428,40 @@ namespace System
         std::vector<std::vector<cv::KeyPoint>> projectedPoints;
         std::vector<pcl::PointXYZRGB> points3D;
         
-        for (const TrackingFrame& frame : keyFrames) {
-            cameras.push_back(m_CameraGraphIDs[frame.GetID()]);
-            images.push_back(frame.GetCameraImage());
+        std::vector<size_t> keyFrameIDs;
+        
+        for (const auto& entry : keyFrames) {
+            cameras.push_back(m_CameraGraphIDs[entry.first]);
+            keyFrameIDs.push_back(entry.first);
+        }
+        std::shared_ptr<TrackingFrame> firstKeyFrame = keyFrames.begin()->second;
+        
+        if (m_OpticalFlowEstimator->IsSparse())
+        {
+            // feature tracks seen by all of these keyframes
+            std::vector<std::vector<cv::Point2f>> trackedPixels;
+            std::vector<size_t> trackIDs;
+            m_OpticalFlowEstimator->GetTracks(keyFrameIDs, trackedPixels, trackIDs);
+            
+            projectedPoints.resize(trackedPixels.size());
+            for (size_t i = 0; i < trackedPixels.size(); i++) {
+                cv::KeyPoint::convert(trackedPixels[i], projectedPoints[i]);
+            }
+        }
+        else
+        {
+            for (const auto& entry : keyFrames) {
+                images.push_back(entry.second->GetGreyImage());
+            }
+            
+            m_OpticalFlowEstimator->EstimateCorrespondingPixels(images, projectedPoints, firstKeyFrame->GetCameraImageMask(), keyFrameIDs);
+            
+            // windows do not overlap, so the flows between this window's keyframes are never requested again
+            m_OpticalFlowEstimator->EvictCachedFlowsBefore(keyFrameIDs.back());
         }
-        m_OpticalFlowEstimator->EstimateCorrespondingPixels(images, projectedPoints, keyFrames.begin()->GetCameraImageMask());
         
         // project first keyframe's points to 3D (all other keyframes can see this)
-        m_3DReconstructor->TriangulatePoints(keyFrames.begin()->GetDisparity(), images[0], projectedPoints[0], points3D);
+        m_3DReconstructor->TriangulatePoints(firstKeyFrame->GetDisparity(), firstKeyFrame->GetCameraImage(), projectedPoints[0], points3D);
         
         // add this set of cameras and points to graph for local optimisation
         m_OptimisationGraph->AddCamerasLookingAtPoints(cameras, points3D, projectedPoints, false);
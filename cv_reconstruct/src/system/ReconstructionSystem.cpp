@@ -20,44 +20,119 @@ namespace System
         // 3D reconstruction module (shared by many subsystems)
         m_3DReconstructor = std::make_shared<Reconstruct::Reconstruct3D>(stereoCalib, config);
         
+        // 2D features shared by tracking frames and the tracker
+        m_FeatureExtractor = std::make_shared<Pipeline::FrameFeatureExtractor>(config);
+        
         // keyframe database: stores keyframes and regulates thread safe keyframe access
-        m_KeyFrameDatabase = std::make_shared<KeyFrameDatabase>();
+        m_KeyFrameDatabase = std::make_shared<KeyFrameDatabase>(config);
         
         // mapping subsystem: performs windowed BA and local optimisation of the map
-        m_MappingSystem = std::make_shared<MappingSystem>(m_3DReconstructor, m_KeyFrameDatabase);
+        m_MappingSystem = std::make_shared<MappingSystem>(m_3DReconstructor, m_KeyFrameDatabase, config);
         m_MappingSystem->StartOptimisationThread();
         
         // tracker: tracks frames for local mapping and quick localisation
-        m_Tracker = std::make_unique<Tracker>(m_FeatureExtractor, m_3DReconstructor, m_MappingSystem, m_KeyFrameDatabase);
+        m_Tracker = std::make_unique<Tracker>(m_FeatureExtractor, m_3DReconstructor, m_MappingSystem, m_KeyFrameDatabase, config);
     }
 
     // Process stereo frame
     void ReconstructionSystem::ProcessStereoFrame(const Pipeline::StereoFrame& stereoFrame)
     {
-        // disparity image (used as basis for 3D reconstruction)
-        cv::Mat disparity;
         cv::Mat leftImage; cv::Mat rightImage;
 
         // check if stereo rectification is needed (from config)
         if (m_Config.Reconstruction.ShouldRectifyImages) {
             m_3DReconstructor->RectifyImages(stereoFrame.LeftImage, stereoFrame.RightImage, leftImage, rightImage);
-            disparity = m_3DReconstructor->GenerateDisparityMap(leftImage, rightImage);
         }
         else {
-            leftImage = stereoFrame.LeftImage;
-            rightImage = stereoFrame.RightImage;
+            m_3DReconstructor->ResizeToProcessingScale(stereoFrame.LeftImage, leftImage);
+            m_3DReconstructor->ResizeToProcessingScale(stereoFrame.RightImage, rightImage);
         }
 
-        // create disparity image from stereo frame
-        disparity = m_3DReconstructor->GenerateDisparityMap(leftImage, rightImage);
-
         // create the tracking frame for this stereo frame and pass to tracker to track
         GPS gps;
         gps.Latitude = stereoFrame.Translation(0);
         gps.Longitude = stereoFrame.Translation(1);
         gps.Altitude = stereoFrame.Translation(2);
-        std::shared_ptr<TrackingFrame> frame { new TrackingFrame(leftImage, disparity, m_3DReconstructor, gps) };
-        m_Tracker->TrackFrame(frame);
+
+        // with sparse stereo, feature depths come from the right image features and only keyframes get a dense disparity
+        std::shared_ptr<TrackingFrame> frame;
+        if (m_Config.Tracking.SparseStereo) {
+            frame.reset(new TrackingFrame(leftImage, m_FeatureExtractor, m_3DReconstructor, gps, rightImage));
+        }
+        else {
+            cv::Mat disparity = ComputeDisparity(leftImage, rightImage, false);
+            frame.reset(new TrackingFrame(leftImage, disparity, m_FeatureExtractor, m_3DReconstructor, gps, ComputeRightDisparity(leftImage, rightImage)));
+        }
+
+        if (!m_Tracker->TrackFrame(frame))
+        {
+            // only keyframes need the feature depths
+            frame->ReleaseRightImage();
+            return;
+        }
+
+        // dense disparity for the new keyframe
+        if (!frame->HasDisparity()) {
+            cv::Mat disparity = ComputeDisparity(leftImage, rightImage, true);
+            frame->SetDisparity(disparity, ComputeRightDisparity(leftImage, rightImage));
+        }
+
+        m_Tracker->InsertKeyFrame(frame);
+    }
+
+    // Right disparity for the left-right consistency check, if the matcher doesn't do its own
+    cv::Mat ReconstructionSystem::ComputeRightDisparity(const cv::Mat& leftImage, const cv::Mat& rightImage) const
+    {
+        if (m_3DReconstructor->RequiresRightDisparity()) {
+            return m_3DReconstructor->GenerateRightDisparityMap(leftImage, rightImage);
+        }
+
+        return cv::Mat();
+    }
+
+    // Disparity for the frame, searched around the previous frame's disparity when the temporal prior is enabled
+    cv::Mat ReconstructionSystem::ComputeDisparity(const cv::Mat& leftImage, const cv::Mat& rightImage, bool tracked)
+    {
+        if (!m_Config.Reconstruction.TemporalPrior.Enabled) {
+            return m_3DReconstructor->GenerateDisparityMap(leftImage, rightImage);
+        }
+
+        // pose of this frame and of the frame with the previous disparity, from the tracker (camera frame motion).
+        // a frame that is already tracked (sparse tracking) uses its tracked pose, and the previous disparity may be a few frames old
+        Eigen::Matrix4f pose;
+        Eigen::Matrix4f previousPose;
+        if (tracked)
+        {
+            pose = m_Tracker->GetPose().cast<float>();
+            previousPose = m_PreviousFramePose;
+        }
+        else
+        {
+            pose = m_Tracker->PredictPose().cast<float>();
+            previousPose = m_Tracker->GetPose().cast<float>();
+        }
+
+        // full search for the first frame and periodically to stop errors propagating through the priors
+        cv::Mat disparity;
+        bool refresh = m_PreviousDisparity.empty() || m_PreviousDisparity.size() != leftImage.size() ||
+                       m_FramesSincePriorRefresh >= m_Config.Reconstruction.TemporalPrior.RefreshInterval;
+
+        if (refresh)
+        {
+            disparity = m_3DReconstructor->GenerateDisparityMap(leftImage, rightImage);
+            m_FramesSincePriorRefresh = 0;
+        }
+        else
+        {
+            Eigen::Matrix4f motion = pose.inverse() * previousPose;
+            disparity = m_3DReconstructor->GenerateDisparityMap(leftImage, rightImage, m_PreviousDisparity, motion);
+            m_FramesSincePriorRefresh++;
+        }
+
+        m_PreviousDisparity = disparity;
+        m_PreviousFramePose = pose;
+
+        return disparity;
     }
 
     // Shutdown request
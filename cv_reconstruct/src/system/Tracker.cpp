@@ -2,26 +2,24 @@
 // Tracker.cpp
 // Tracks frames and estimates transforms between frames
 //
-#define CERES_FOUND 1
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
 
 #include <eigen3/Eigen/Eigen>
 
 #include <opencv2/core/core.hpp>
-#include <opencv2/sfm.hpp>
-#include <opencv2/sfm/reconstruct.hpp>
-#include <opencv2/core/eigen.hpp>
-
-#include <pcl/common/geometry.h>
-#include <pcl/io/pcd_io.h>
+#include <opencv2/calib3d/calib3d.hpp>
 
 #include "system/TrackingFrame.hpp"
 #include "system/Tracker.hpp"
 
-#include <opencv2/highgui.hpp>
-
 #define MIN_CORRESPONDENCES_NEEDED 20
-#define MIN_DISTANCE_FOR_NEW_KEYFRAME 5.0
-#define IMAGE_COUNT_REQUIRED_FOR_SFM 3
+#define PNP_RANSAC_ITERATIONS 100
+#define PNP_REPROJECTION_ERROR 2.0
+#define PNP_CONFIDENCE 0.99
+#define MAX_CONSECUTIVE_TRACKING_FAILURES 10
 
 namespace System
 {
@@ -29,103 +27,203 @@ namespace System
     Tracker::Tracker(std::shared_ptr<Pipeline::FrameFeatureExtractor> featureExtractor,
                      std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor,
                      std::shared_ptr<MappingSystem> mappingSystem,
-                     std::shared_ptr<KeyFrameDatabase> keyFrameDB) : m_FeatureExtractor(std::move(featureExtractor)), m_3DReconstructor(reconstructor), m_MappingSystem(mappingSystem), m_KeyFrameDatabase(keyFrameDB)
+                     std::shared_ptr<KeyFrameDatabase> keyFrameDB,
+                     const Config::Config& config) : m_FeatureExtractor(std::move(featureExtractor)), m_3DReconstructor(reconstructor), m_MappingSystem(mappingSystem), m_KeyFrameDatabase(keyFrameDB),
+                                                     m_MinTrackedOverlap(config.Tracking.MinTrackedOverlap), m_MinMedianParallax(config.Tracking.MinMedianParallax),
+                                                     m_MaxRotation(config.Tracking.MaxRotationDegrees * static_cast<float>(M_PI) / 180.0f),
+                                                     m_MatchSearchRadius(config.Tracking.MatchSearchRadius)
     {
-        // setup optimsation graph with camera params
-        float fx, fy, cx, cy;
-        m_3DReconstructor->GetCameraParameters(fx, fy, cx, cy);
-        m_OptimisationGraph = std::make_unique<OptimisationGraph>(fx, fy, cx, cy);
-        
-        // optical flow estimation
-        m_OpticalFlowEstimator = std::make_unique<Features::OpticalFlowEstimator>();
     }
 
     // Track this frame and update estimated position and rotation of the camera
-    void Tracker::TrackFrame(std::shared_ptr<TrackingFrame> frame)
+    bool Tracker::TrackFrame(std::shared_ptr<TrackingFrame> frame)
+    {
+        // the first frame becomes the first keyframe and defines the world frame
+        if (m_KeyFrameDatabase->IsEmpty()) {
+            return true;
+        }
+        
+        // track against last keyframe
+        std::shared_ptr<TrackingFrame> recentKeyFrame = m_KeyFrameDatabase->SelectMostRecentKeyFrame();
+        return TrackFrame(frame, recentKeyFrame);
+    }
+    
+    // Insert keyframe
+    void Tracker::InsertKeyFrame(std::shared_ptr<TrackingFrame> frame)
+    {
+        m_KeyFrameDatabase->InsertKeyFrame(frame);
+        
+        // send tracked keyframe to mapper for mapping
+        m_MappingSystem->AddKeyFrames({ frame });
+    }
+    
+    // Track between the most recent keyframe and this new frame, deciding if it needs to become a keyframe
+    bool Tracker::TrackFrame(std::shared_ptr<TrackingFrame> currentFrame, std::shared_ptr<TrackingFrame> recentKeyFrame)
     {
-        // if no keyframes add this as the first keyframe
-        if (m_KeyFrameDatabase->IsEmpty())
+        // constant velocity prediction of the frame relative to the keyframe guides the feature matching
+        const Eigen::Matrix4f predictedPose = recentKeyFrame->GetTrackedPose().inverse() * PredictPose().cast<float>();
+        
+        // motion-only pose of the frame relative to the keyframe from the keyframe's cached features
+        TrackingResult result;
+        bool tracked = EstimateRelativePose(*recentKeyFrame, *currentFrame, predictedPose, result);
+        
+        Eigen::Matrix4f pose;
+        if (tracked) {
+            pose = recentKeyFrame->GetTrackedPose() * result.RelativePose;
+            m_ConsecutiveTrackingFailures = 0;
+        }
+        else
         {
-            //size_t keyFrameID = m_KeyFrameDatabase->InsertKeyFrame(frame);
-            //int poseVertexID = m_OptimisationGraph->AddDefaultCameraPoseVertex(true);
-            //m_KeyFramePoseVertexIDs[keyFrameID] = poseVertexID;
-            //m_MappingSystem->AddKeyFrame(frame);
+            // fall back to the constant velocity prediction and keep tracking against the same keyframe
+            m_ConsecutiveTrackingFailures++;
+            std::cerr << "\nWARNING: Tracking failed for frame. Using constant velocity prediction." << std::endl;
             
-            // add to image paths for SfM
-            m_KeyFrameDatabase->InsertKeyFrame(frame);
-            m_TrackedKeyFrames.push_back(frame);
-            m_KeyFrameImagePaths.push_back(m_KeyFrameDatabase->GetKeyFrameImagePath(frame->GetID()));
+            if (m_ConsecutiveTrackingFailures == MAX_CONSECUTIVE_TRACKING_FAILURES) {
+                std::cerr << "\nWARNING: Tracking lost after " << m_ConsecutiveTrackingFailures << " failed frames. Relocalisation needed." << std::endl;
+            }
             
-            // save first keyframe point cloud for debugging
-            auto pc = frame->GetDensePointCloud();
-            cv::imwrite("keyframe_0_disparity.png", frame->GetDisparity());
-            pcl::io::savePCDFileBinary("keyframe_0_point_cloud.pcd", *pc);
-        }
-        else {
-            // track against last keyframe
-            std::shared_ptr<TrackingFrame> recentKeyFrame = m_KeyFrameDatabase->SelectMostRecentKeyFrame();
-            return TrackFrame(frame, recentKeyFrame);
+            pose = PredictPose().cast<float>();
         }
+        
+        currentFrame->SetTrackedPose(pose);
+        
+        // update the motion model with the full-rate trajectory
+        Eigen::Matrix4d poseD = pose.cast<double>();
+        m_Velocity = m_CurrentPose.inverse() * poseD;
+        m_CurrentPose = poseD;
+        
+        // an untracked frame has no reliable pose to anchor a keyframe on
+        return tracked && NeedsNewKeyFrame(result);
+    }
+    
+    // New keyframe when the scene has changed enough: too little of the keyframe is still tracked,
+    // enough parallax for new depth, or a large rotation
+    bool Tracker::NeedsNewKeyFrame(const TrackingResult& result) const
+    {
+        const Eigen::AngleAxisf rotation(Eigen::Matrix3f(result.RelativePose.block<3, 3>(0, 0)));
+        
+        return result.Overlap < m_MinTrackedOverlap ||
+               result.MedianParallax >= m_MinMedianParallax ||
+               std::abs(rotation.angle()) >= m_MaxRotation;
     }
     
-    // Track between previous frame and this new frame
-    void Tracker::TrackFrame(std::shared_ptr<TrackingFrame> currentFrame, std::shared_ptr<TrackingFrame> recentKeyFrame)
+    // Estimate the pose of the frame in the keyframe camera coordinates from stereo triangulated keyframe features
+    bool Tracker::EstimateRelativePose(const TrackingFrame& keyFrame, const TrackingFrame& frame, const Eigen::Matrix4f& predictedPose, TrackingResult& result) const
     {
-        // gps distance for keyframe tracking check
-        float distance = currentFrame->DistanceFrom(*recentKeyFrame);
-        //std::cout << "\nGPS distance to previous keyframe: " << distance;
-        if (distance < MIN_DISTANCE_FOR_NEW_KEYFRAME) {
-            return;
+        result = TrackingResult();
+        
+        // match the cached features, keyframe features are restricted to pixels with a valid disparity
+        std::vector<cv::DMatch> matches;
+        MatchFeatures(keyFrame, frame, predictedPose, matches);
+        
+        if (matches.size() < MIN_CORRESPONDENCES_NEEDED) {
+            return false;
         }
         
-        // insert into keyframe database as passed certain distance
-        m_KeyFrameDatabase->InsertKeyFrame(currentFrame);
+        // cached 3D points in the keyframe camera
+        const std::vector<pcl::PointXYZRGB>& points3D = keyFrame.GetFeaturePoints3D();
+        const std::vector<cv::KeyPoint>& keyFramePoints = keyFrame.GetFeatureKeypoints();
+        const std::vector<cv::KeyPoint>& framePoints = frame.GetFeatureKeypoints();
         
-        // now tracking this keyframe
-        m_TrackedKeyFrames.push_back(currentFrame);
-        m_KeyFrameImagePaths.push_back(m_KeyFrameDatabase->GetKeyFrameImagePath(currentFrame->GetID()));
+        // triangulation is y-up, PnP expects the OpenCV camera convention (y-down)
+        std::vector<cv::Point3f> objectPoints;
+        std::vector<cv::Point2f> imagePoints;
+        std::vector<cv::Point2f> keyFramePixels;
+        objectPoints.reserve(matches.size());
+        imagePoints.reserve(matches.size());
+        keyFramePixels.reserve(matches.size());
         
-        // need at least 3 images for SfM
-        if (m_KeyFrameImagePaths.size() < IMAGE_COUNT_REQUIRED_FOR_SFM) {
-            return;
+        for (const cv::DMatch& match : matches)
+        {
+            const pcl::PointXYZRGB& P = points3D[match.queryIdx];
+            if (!std::isfinite(P.z) || P.z <= 0) {
+                continue;
+            }
+            
+            objectPoints.emplace_back(P.x, -P.y, P.z);
+            imagePoints.push_back(framePoints[match.trainIdx].pt);
+            keyFramePixels.push_back(keyFramePoints[match.queryIdx].pt);
         }
         
-        // SfM for pose estimation
+        if (objectPoints.size() < MIN_CORRESPONDENCES_NEEDED) {
+            return false;
+        }
         
-        // intrinsics matrix
         float fx, fy, cx, cy;
         m_3DReconstructor->GetCameraParameters(fx, fy, cx, cy);
-        cv::Matx33d K = cv::Matx33d( fx, 0, cx, 0, fy, cy, 0, 0, 1);
-        
-        // run OpenCV SfM pipeline for pose estimation
-        std::vector<cv::Mat> Rs_est, ts_est, points3d_estimated;
-        cv::sfm::reconstruct(m_KeyFrameImagePaths, Rs_est, ts_est, K, points3d_estimated, true);
+        cv::Mat K = (cv::Mat_<double>(3, 3) << fx, 0, cx, 0, fy, cy, 0, 0, 1);
         
-        // keyframes to send to mapper
-        std::vector<std::shared_ptr<TrackingFrame>> processedKeyFrames;
+        // robust pose from 3D-2D correspondences
+        cv::Mat rvec, tvec;
+        std::vector<int> inliers;
+        bool found = cv::solvePnPRansac(objectPoints, imagePoints, K, cv::noArray(), rvec, tvec, false,
+                                        PNP_RANSAC_ITERATIONS, PNP_REPROJECTION_ERROR, PNP_CONFIDENCE, inliers, cv::SOLVEPNP_EPNP);
         
-        // update all poses
-        for (size_t i = 0; i < Rs_est.size(); i++) {
-            auto kf = m_TrackedKeyFrames[i];
-            kf->SetTrackedPose(PoseFromCVRT(Rs_est[i], ts_est[i]));
+        if (!found || inliers.size() < MIN_CORRESPONDENCES_NEEDED) {
+            return false;
         }
         
-        // if first time doing this - set all 3 poses
-        if (m_TrackedKeyFrames.size() == IMAGE_COUNT_REQUIRED_FOR_SFM) {
-            for (size_t i = 0; i < IMAGE_COUNT_REQUIRED_FOR_SFM; i++) {
-                //m_TrackedKeyFrames[i]->SetTrackedPose(PoseFromCVRT(Rs_est[i], ts_est[i]));
-                processedKeyFrames.push_back(m_TrackedKeyFrames[i]);
-            }
+        // motion-only refinement on the inliers
+        std::vector<cv::Point3f> inlierObjectPoints;
+        std::vector<cv::Point2f> inlierImagePoints;
+        inlierObjectPoints.reserve(inliers.size());
+        inlierImagePoints.reserve(inliers.size());
+        
+        for (int i : inliers) {
+            inlierObjectPoints.push_back(objectPoints[i]);
+            inlierImagePoints.push_back(imagePoints[i]);
         }
-        else
+        
+        cv::solvePnPRefineLM(inlierObjectPoints, inlierImagePoints, K, cv::noArray(), rvec, tvec);
+        
+        // PnP gives keyframe -> frame, invert for the frame pose in the keyframe camera
+        cv::Mat R;
+        cv::Rodrigues(rvec, R);
+        Eigen::Matrix4f frameFromKeyFrame = PoseFromCVRT(R, tvec);
+        
+        // back to the y-up convention of the point clouds
+        Eigen::Matrix4f flipY = Eigen::Matrix4f::Identity();
+        flipY(1, 1) = -1.0f;
+        result.RelativePose = flipY * frameFromKeyFrame.inverse() * flipY;
+        
+        // share of the keyframe's features with a depth still tracked
+        const size_t keyFramePointsWithDepth = std::count_if(points3D.begin(), points3D.end(), [](const pcl::PointXYZRGB& P) {
+            return std::isfinite(P.z) && P.z > 0;
+        });
+        result.Overlap = static_cast<float>(inliers.size()) / static_cast<float>(std::max<size_t>(keyFramePointsWithDepth, 1));
+        
+        // rotation compensated parallax: keyframe pixels rotated into the frame (K R K^-1) against the observed pixels
+        cv::Matx33d H = cv::Matx33d(K) * cv::Matx33d(R) * cv::Matx33d(K).inv();
+        std::vector<float> parallax;
+        parallax.reserve(inliers.size());
+        
+        for (int i : inliers)
         {
-            // just set last pose, as first few were already estimated
-            //m_TrackedKeyFrames.back()->SetTrackedPose(PoseFromCVRT(Rs_est.back(), ts_est.back()));
-            processedKeyFrames.push_back(m_TrackedKeyFrames.back());
+            const cv::Vec3d p = H * cv::Vec3d(keyFramePixels[i].x, keyFramePixels[i].y, 1.0);
+            const float dx = static_cast<float>(p[0] / p[2]) - imagePoints[i].x;
+            const float dy = static_cast<float>(p[1] / p[2]) - imagePoints[i].y;
+            parallax.push_back(std::sqrt(dx * dx + dy * dy));
         }
         
-        // send tracked keyframes to mapper for mapping
-        m_MappingSystem->AddKeyFrames(processedKeyFrames);
+        std::nth_element(parallax.begin(), parallax.begin() + parallax.size() / 2, parallax.end());
+        result.MedianParallax = parallax[parallax.size() / 2];
+        
+        return true;
+    }
+
+    // Match keyframe features within a window around their projection with the predicted pose,
+    // matching against all features of the frame when the prediction is off
+    void Tracker::MatchFeatures(const TrackingFrame& keyFrame, const TrackingFrame& frame, const Eigen::Matrix4f& predictedPose, std::vector<cv::DMatch>& matches) const
+    {
+        std::vector<cv::Point2f> predictedPixels;
+        m_3DReconstructor->ProjectPoints(keyFrame.GetFeaturePoints3D(), predictedPose.inverse(), predictedPixels);
+        
+        m_FeatureExtractor->ComputeGuidedCorrespondences(keyFrame.GetFeatureDescriptors(), frame.GetFeatureDescriptors(), predictedPixels,
+                                                         frame.GetFeatureGrid(), m_MatchSearchRadius, matches);
+        
+        if (matches.size() < MIN_CORRESPONDENCES_NEEDED) {
+            m_FeatureExtractor->ComputeCorrespondences(keyFrame.GetFeatureDescriptors(), frame.GetFeatureDescriptors(), matches);
+        }
     }
 
     // Create eigen 4x4 homogenous transformation matrix from R, and t
@@ -150,4 +248,14 @@ namespace System
     Eigen::Matrix4d Tracker::GetPose() const {
         return m_CurrentPose;
     }
+
+    // Lost after too many consecutive failures
+    bool Tracker::IsLost() const {
+        return m_ConsecutiveTrackingFailures >= MAX_CONSECUTIVE_TRACKING_FAILURES;
+    }
+
+    // Constant velocity prediction of the next pose
+    Eigen::Matrix4d Tracker::PredictPose() const {
+        return m_CurrentPose * m_Velocity;
+    }
 }
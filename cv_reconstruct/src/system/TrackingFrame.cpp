@@ -11,59 +11,141 @@
 
 #include <opencv2/highgui/highgui.hpp>
 
+#define TRACKING_PYRAMID_LEVELS 3
+
 namespace System
 {
     // Constructor
-    TrackingFrame::TrackingFrame(const cv::Mat& cameraImage, const cv::Mat& disparity, std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor, const GPS& gps) : m_3DReconstructor(reconstructor), m_GPSLocation(gps)
+    TrackingFrame::TrackingFrame(const cv::Mat& cameraImage, const cv::Mat& disparity, std::shared_ptr<Pipeline::FrameFeatureExtractor> featureExtractor,
+                                 std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor, const GPS& gps, const cv::Mat& rightDisparity)
+        : m_FeatureExtractor(std::move(featureExtractor)), m_3DReconstructor(std::move(reconstructor)), m_GPSLocation(gps)
     {
-        cameraImage.copyTo(m_CameraImage);
-        disparity.copyTo(m_Disparity);
-        SetupFrame();
+        BuildGreyPyramid(cameraImage);
+        SetupFrame(disparity, rightDisparity);
     }
 
-    // Setup the frame with all required features
-    void TrackingFrame::SetupFrame()
+    // Constructor for sparse stereo tracking
+    TrackingFrame::TrackingFrame(const cv::Mat& cameraImage, std::shared_ptr<Pipeline::FrameFeatureExtractor> featureExtractor,
+                                 std::shared_ptr<Reconstruct::Reconstruct3D> reconstructor, const GPS& gps, const cv::Mat& rightImage)
+        : m_FeatureExtractor(std::move(featureExtractor)), m_3DReconstructor(std::move(reconstructor)), m_GPSLocation(gps)
     {
-        // prune the disparity and set the mask
-        m_Mask = cv::Mat(m_CameraImage.rows, m_CameraImage.cols, CV_8U);
-        PruneDisparityImage(m_Disparity, m_Mask);
+        BuildGreyPyramid(cameraImage);
         
-        // convert disparity to float range
-        m_Disparity.convertTo(m_Disparity, CV_32F, 1.0 / 16.0, 0.0);
+        if (rightImage.channels() == 1) {
+            m_RightGreyImage = rightImage.clone();
+        }
+        else {
+            cv::cvtColor(rightImage, m_RightGreyImage, cv::COLOR_BGR2GRAY);
+        }
+    }
+
+    // Greyscale pyramid for tracking, colour only at the resolution used for texturing
+    void TrackingFrame::BuildGreyPyramid(const cv::Mat& cameraImage)
+    {
+        cv::Mat grey;
+        cv::cvtColor(cameraImage, grey, cv::COLOR_BGR2GRAY);
+        cv::buildPyramid(grey, m_GreyPyramid, TRACKING_PYRAMID_LEVELS - 1);
         
-        // further update mask to only be valid where disparity is not zero
-        for (int row = 0; row < m_Mask.rows; row++)
+        cv::Mat colour;
+        m_3DReconstructor->ResizeToTextureScale(cameraImage, colour);
+        m_CameraImage = (colour.data == cameraImage.data) ? cameraImage.clone() : colour;
+    }
+
+    // Setup the frame with all required features
+    void TrackingFrame::SetupFrame(const cv::Mat& disparity, const cv::Mat& rightDisparity)
+    {
+        // the filter removes speckles in place, so work on a copy
+        cv::Mat disparityCopy = disparity.clone();
+        
+        // prune the disparity and set the mask in one pass over the valid region, keeping 16x fixed point
+        cv::Mat mask;
+        m_3DReconstructor->FilterDisparity(disparityCopy, rightDisparity, m_Disparity, mask, CV_16S);
+        m_PackedMask = PackMask(mask);
+    }
+
+    // Detect keypoints and descriptors on the tracking pyramid where the disparity is valid, and index the keypoints for windowed matching
+    void TrackingFrame::ComputeFeatures() const
+    {
+        if (m_RightGreyImage.empty()) {
+            m_FeatureExtractor->ComputeFeaturesFromPyramid(m_GreyPyramid, m_FeatureKeypoints, m_FeatureDescriptors, GetCameraImageMask());
+        }
+        else
         {
-            for (int col = 0; col < m_Mask.cols; col++)
-            {
-                if (m_Disparity.at<float>(row, col) <= 0.0f) {
-                    m_Mask.at<unsigned char>(row, col) = 0;
-                }
-            }
+            // sparse stereo frames have no disparity mask yet, detect on both images in one parallel pass
+            std::vector<cv::Mat> rightPyramid;
+            cv::buildPyramid(m_RightGreyImage, rightPyramid, TRACKING_PYRAMID_LEVELS - 1);
+            
+            std::vector<std::vector<cv::KeyPoint>> keypoints;
+            std::vector<cv::Mat> descriptors;
+            m_FeatureExtractor->ComputeFeaturesFromPyramids({ m_GreyPyramid, rightPyramid }, keypoints, descriptors);
+            
+            m_FeatureKeypoints = std::move(keypoints[0]);
+            m_FeatureDescriptors = descriptors[0];
+            m_RightFeatureKeypoints = std::move(keypoints[1]);
+            m_RightFeatureDescriptors = descriptors[1];
         }
+        
+        m_FeatureGrid = Pipeline::KeyPointGrid(m_FeatureKeypoints, m_GreyPyramid[0].size());
     }
 
-    // Prune disparity image
-    void TrackingFrame::PruneDisparityImage(cv::Mat& disparity, cv::Mat& mask) const
+    // Triangulate the cached keypoints by matching them with the right image features, or from the stored disparity
+    void TrackingFrame::ComputeFeaturePoints3D() const
     {
-        // compute std dev of disparity and threshold it
-        cv::Mat disp; cv::Mat mean; std::vector<double> std;
-        cv::normalize(disparity, disp, 0, 255, cv::NORM_MINMAX, CV_8U);
+        if (m_RightGreyImage.empty()) {
+            m_3DReconstructor->TriangulatePoints(m_Disparity, m_CameraImage, GetFeatureKeypoints(), m_FeaturePoints3D);
+            return;
+        }
+        
+        // the right features are computed together with the left ones
+        const std::vector<cv::KeyPoint>& keypoints = GetFeatureKeypoints();
+        
+        m_3DReconstructor->TriangulateStereoFeatures(m_GreyPyramid[0], m_RightGreyImage, m_CameraImage, keypoints, GetFeatureDescriptors(),
+                                                     m_RightFeatureKeypoints, m_RightFeatureDescriptors, m_FeaturePoints3D);
+        ReleaseRightImage();
+    }
 
-        cv::meanStdDev(disp, mean, std);
-        cv::threshold(disp, mask, std[0] * 1.3, 255, cv::THRESH_BINARY);
+    // Free the right image and its features
+    void TrackingFrame::ReleaseRightImage() const
+    {
+        m_RightGreyImage.release();
+        m_RightFeatureKeypoints = std::vector<cv::KeyPoint>();
+        m_RightFeatureDescriptors.release();
+    }
+
+    // Pack a 0/255 mask into 8 pixels per byte
+    cv::Mat TrackingFrame::PackMask(const cv::Mat& mask)
+    {
+        cv::Mat packedMask = cv::Mat::zeros(mask.rows, (mask.cols + 7) / 8, CV_8U);
+        
+        for (int row = 0; row < mask.rows; row++)
+        {
+            const uchar* m = mask.ptr<uchar>(row);
+            uchar* p = packedMask.ptr<uchar>(row);
+            
+            for (int col = 0; col < mask.cols; col++) {
+                p[col >> 3] |= static_cast<uchar>((m[col] != 0) << (col & 7));
+            }
+        }
+        
+        return packedMask;
+    }
 
-        // apply mask to disparity and prune
+    // Unpack a bit mask to 0/255
+    cv::Mat TrackingFrame::UnpackMask(const cv::Mat& packedMask, int cols)
+    {
+        cv::Mat mask(packedMask.rows, cols, CV_8U);
+        
         for (int row = 0; row < mask.rows; row++)
         {
-            for (int col = 0; col < mask.cols; col++)
-            {
-                int value = static_cast<int>(mask.at<unsigned char>(row, col));
-                if (value == 0) {
-                    disparity.at<short>(row, col) = 0;
-                }
+            const uchar* p = packedMask.ptr<uchar>(row);
+            uchar* m = mask.ptr<uchar>(row);
+            
+            for (int col = 0; col < cols; col++) {
+                m[col] = ((p[col >> 3] >> (col & 7)) & 1) ? 255 : 0;
             }
         }
+        
+        return mask;
     }
 
     float TrackingFrame::DistanceFrom(const TrackingFrame& other) {
@@ -71,10 +153,34 @@ namespace System
     }
 
     // Dense point cloud
-    pcl::PointCloud<pcl::PointXYZRGB>::Ptr TrackingFrame::GetDensePointCloud() const {
-        pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud { new pcl::PointCloud<pcl::PointXYZRGB>(m_3DReconstructor->Triangulate3D(m_Disparity, m_CameraImage, m_Mask)) };
-        //pcl::PointCloud<pcl::PointXYZRGB>::Ptr cloud { new pcl::PointCloud<pcl::PointXYZRGB>(m_3DReconstructor->GeneratePointCloud(m_Disparity, m_CameraImage)) };
-        return cloud;
+    pcl::PointCloud<pcl::PointXYZRGB>::ConstPtr TrackingFrame::GetDensePointCloud() const
+    {
+        std::lock_guard<std::mutex> lock(m_DenseCloudMutex);
+        
+        if (m_DenseCloud == nullptr)
+        {
+            // pixels used for the dense point cloud (only high gradient pixels in semi-dense mode)
+            cv::Mat triangulationMask = m_3DReconstructor->SelectSemiDensePixels(m_GreyPyramid[0], GetCameraImageMask());
+            m_DenseCloud.reset(new pcl::PointCloud<pcl::PointXYZRGB>(m_3DReconstructor->Triangulate3D(m_Disparity, m_CameraImage, triangulationMask)));
+        }
+        
+        return m_DenseCloud;
+    }
+
+    // Free the dense point cloud
+    void TrackingFrame::ReleaseDensePointCloud()
+    {
+        std::lock_guard<std::mutex> lock(m_DenseCloudMutex);
+        m_DenseCloud.reset();
+    }
+
+    // Dense disparity for a sparse tracking frame
+    void TrackingFrame::SetDisparity(const cv::Mat& disparity, const cv::Mat& rightDisparity) {
+        SetupFrame(disparity, rightDisparity);
+    }
+
+    bool TrackingFrame::HasDisparity() const {
+        return !m_Disparity.empty();
     }
 
     // Getters
@@ -83,17 +189,46 @@ namespace System
     }
 
     cv::Mat TrackingFrame::GetCameraImageMask() const {
-        return m_Mask;
+        return UnpackMask(m_PackedMask, m_Disparity.cols);
     }
 
     cv::Mat TrackingFrame::GetCameraImage() const {
         return m_CameraImage;
     }
 
+    cv::Mat TrackingFrame::GetGreyImage(int level) const {
+        return m_GreyPyramid[level];
+    }
+
+    const std::vector<cv::Mat>& TrackingFrame::GetGreyPyramid() const {
+        return m_GreyPyramid;
+    }
+
     cv::Mat TrackingFrame::GetDisparity() const {
         return m_Disparity;
     }
 
+    // Cached features
+    const std::vector<cv::KeyPoint>& TrackingFrame::GetFeatureKeypoints() const {
+        std::call_once(m_FeaturesComputed, &TrackingFrame::ComputeFeatures, this);
+        return m_FeatureKeypoints;
+    }
+
+    cv::Mat TrackingFrame::GetFeatureDescriptors() const {
+        std::call_once(m_FeaturesComputed, &TrackingFrame::ComputeFeatures, this);
+        return m_FeatureDescriptors;
+    }
+
+    const Pipeline::KeyPointGrid& TrackingFrame::GetFeatureGrid() const {
+        std::call_once(m_FeaturesComputed, &TrackingFrame::ComputeFeatures, this);
+        return m_FeatureGrid;
+    }
+
+    const std::vector<pcl::PointXYZRGB>& TrackingFrame::GetFeaturePoints3D() const {
+        std::call_once(m_FeaturePoints3DComputed, &TrackingFrame::ComputeFeaturePoints3D, this);
+        return m_FeaturePoints3D;
+    }
+
     // Set tracked pose
     void TrackingFrame::SetTrackedPose(const Eigen::Matrix4f& pose) {
         m_EstimatedPose = pose;
@@ -11,16 +11,39 @@
 #include <algorithm>
 
 #include <opencv2/core/core.hpp>
+#include <opencv2/core/utility.hpp>
 #include <opencv2/features2d/features2d.hpp>
 #include <opencv2/highgui/highgui.hpp>
 
 #include "pipeline/OpticalFlowEstimator.hpp"
+#include "pipeline/BinaryDescriptorMatcher.hpp"
 
 #define NUM_KEYFRAMES 4
 #define SAMPLE_SIZE 20
 #define IMAGE_FILE_PREFIX "keyframe_"
+#define NUM_MATCH_FEATURES 2000
+#define MATCH_RATIO 0.7f
 
-void RunOpticalFlowOnNImages(const std::string& prefix, const std::vector<cv::Mat>& images);
+void RunOpticalFlowOnNImages(const std::string& prefix, const std::vector<cv::Mat>& images, Features::OpticalFlowEstimator& opticalFlow);
+void RunOpticalFlowPairwise(const std::vector<cv::Mat>& images, Features::OpticalFlowEstimator& opticalFlow);
+void RunDescriptorMatching(const cv::Mat& image0, const cv::Mat& image1);
+
+// dense flow backends to time
+struct DenseFlowBenchmark
+{
+    std::string Name;
+    Features::DenseFlowBackend Backend;
+    float Scale;
+};
+
+const std::vector<DenseFlowBenchmark> DENSE_FLOW_BENCHMARKS {
+    { "farneback", Features::DENSE_FLOW_FARNEBACK, 1.0f },
+    { "farneback_half", Features::DENSE_FLOW_FARNEBACK, 0.5f },
+    { "dis_ultrafast", Features::DENSE_FLOW_DIS_ULTRAFAST, 1.0f },
+    { "dis_fast", Features::DENSE_FLOW_DIS_FAST, 1.0f },
+    { "dis_medium", Features::DENSE_FLOW_DIS_MEDIUM, 1.0f },
+    { "dis_medium_half", Features::DENSE_FLOW_DIS_MEDIUM, 0.5f }
+};
 
 int main(int argc, char** argv)
 {
@@ -35,23 +58,35 @@ int main(int argc, char** argv)
     
     // prepare vector of first 2 for test 1
     std::vector<cv::Mat> first2 { images[0], images[1] };
-    RunOpticalFlowOnNImages("two_images", first2);
     
-    // run on N images
-    RunOpticalFlowOnNImages("n_images", images);
+    // the N image estimate computes its pairs concurrently only with at least one pair per thread
+    std::cout << "\nThreads: " << cv::getNumThreads() << ", image pairs: " << images.size() - 1;
+    
+    // time each backend on 2 and on N images, and on the N - 1 pairs one at a time
+    for (const DenseFlowBenchmark& benchmark : DENSE_FLOW_BENCHMARKS)
+    {
+        Features::OpticalFlowEstimator opticalFlow(benchmark.Backend, benchmark.Scale);
+        
+        std::cout << "\n\nBackend: " << benchmark.Name;
+        RunOpticalFlowOnNImages(benchmark.Name + "_two_images", first2, opticalFlow);
+        RunOpticalFlowOnNImages(benchmark.Name + "_n_images", images, opticalFlow);
+        RunOpticalFlowPairwise(images, opticalFlow);
+    }
+    
+    // time descriptor matching between the first 2 keyframes
+    RunDescriptorMatching(images[0], images[1]);
     
     std::cout << std::endl;
     return 0;
 }
 
-void RunOpticalFlowOnNImages(const std::string& prefix, const std::vector<cv::Mat>& images)
+void RunOpticalFlowOnNImages(const std::string& prefix, const std::vector<cv::Mat>& images, Features::OpticalFlowEstimator& opticalFlow)
 {
     // read in frame 0 mask
     //cv::Mat mask = cv::imread("keyframe_mask.png", cv::IMREAD_GRAYSCALE);
     
     // prepare optical flow data
     std::vector<std::vector<cv::KeyPoint>> keypoints;
-    Features::OpticalFlowEstimator opticalFlow;
     
     // run optical flow on N images
     std::cout << "\nRunning Optical Flow";
@@ -85,3 +120,64 @@ void RunOpticalFlowOnNImages(const std::string& prefix, const std::vector<cv::Ma
         cv::imwrite(prefix + "_keypoints_" + std::to_string(i) + ".png", output);
     }
 }
+
+void RunOpticalFlowPairwise(const std::vector<cv::Mat>& images, Features::OpticalFlowEstimator& opticalFlow)
+{
+    std::cout << "\nRunning Optical Flow pair by pair";
+    
+    auto start = std::chrono::high_resolution_clock::now();
+    for (size_t i = 1; i < images.size(); i++)
+    {
+        std::vector<std::vector<cv::KeyPoint>> keypoints;
+        opticalFlow.EstimateCorrespondingPixels({ images[i - 1], images[i] }, keypoints);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    
+    std::cout << "\nDone";
+    std::cout << "\nTime Taken: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms" << std::endl;
+}
+
+void RunDescriptorMatching(const cv::Mat& image0, const cv::Mat& image1)
+{
+    // ORB features in both images
+    cv::Ptr<cv::ORB> orb = cv::ORB::create(NUM_MATCH_FEATURES);
+    std::vector<cv::KeyPoint> keypoints0, keypoints1;
+    cv::Mat descriptors0, descriptors1;
+    orb->detectAndCompute(image0, cv::noArray(), keypoints0, descriptors0);
+    orb->detectAndCompute(image1, cv::noArray(), keypoints1, descriptors1);
+    
+    std::cout << "\n\nDescriptor matching: " << descriptors0.rows << " x " << descriptors1.rows << " ORB descriptors";
+    
+    // brute force knn with ratio test and cross-check
+    auto start = std::chrono::high_resolution_clock::now();
+    cv::BFMatcher bruteForce(cv::NORM_HAMMING);
+    std::vector<std::vector<cv::DMatch>> knnMatches, reverseMatches;
+    bruteForce.knnMatch(descriptors0, descriptors1, knnMatches, 2);
+    bruteForce.knnMatch(descriptors1, descriptors0, reverseMatches, 1);
+    
+    size_t bruteForceMatches = 0;
+    for (const std::vector<cv::DMatch>& knn : knnMatches)
+    {
+        if (knn.size() == 2 && knn[0].distance < MATCH_RATIO * knn[1].distance &&
+            !reverseMatches[knn[0].trainIdx].empty() && reverseMatches[knn[0].trainIdx][0].trainIdx == knn[0].queryIdx) {
+            bruteForceMatches++;
+        }
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    
+    // every distance is computed in both directions
+    const size_t bruteForceDistances = 2 * static_cast<size_t>(descriptors0.rows) * descriptors1.rows;
+    
+    std::cout << "\nBrute force: " << bruteForceMatches << " matches, " << bruteForceDistances << " distances computed";
+    std::cout << "\nTime Taken: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms";
+    
+    // multi-index hashing with the same ratio test and cross-check
+    start = std::chrono::high_resolution_clock::now();
+    Pipeline::BinaryDescriptorMatcher matcher(MATCH_RATIO, true);
+    std::vector<cv::DMatch> matches;
+    const size_t distances = matcher.Match(descriptors0, descriptors1, matches);
+    end = std::chrono::high_resolution_clock::now();
+    
+    std::cout << "\nMulti-index hashing: " << matches.size() << " matches, " << distances << " distances computed";
+    std::cout << "\nTime Taken: " << std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count() << " ms" << std::endl;
+}
@@ -0,0 +1,176 @@
+//
+// test_binary_descriptor_matcher.cpp
+// Tests for the binary descriptor matcher
+//
+
+#define CATCH_CONFIG_MAIN
+
+#include "catch2/catch.hpp"
+#include "pipeline/BinaryDescriptorMatcher.hpp"
+
+#include <algorithm>
+#include <random>
+
+#include <opencv2/core/core.hpp>
+
+const int DESCRIPTOR_BYTES = 32;
+const int DESCRIPTOR_COUNT = 200;
+const int LARGE_DESCRIPTOR_COUNT = 2000;
+
+cv::Mat CreateRandomDescriptors(int count, std::mt19937& rng)
+{
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    cv::Mat descriptors(count, DESCRIPTOR_BYTES, CV_8U);
+    for (int row = 0; row < count; row++) {
+        for (int col = 0; col < DESCRIPTOR_BYTES; col++) {
+            descriptors.at<uchar>(row, col) = static_cast<uchar>(byte(rng));
+        }
+    }
+
+    return descriptors;
+}
+
+// copy of the descriptors in reverse order with the given number of random bits flipped in each
+cv::Mat CreateNoisyReversedCopy(const cv::Mat& descriptors, int flippedBits, std::mt19937& rng)
+{
+    std::uniform_int_distribution<int> bit(0, DESCRIPTOR_BYTES * 8 - 1);
+
+    cv::Mat copy(descriptors.rows, DESCRIPTOR_BYTES, CV_8U);
+    for (int row = 0; row < descriptors.rows; row++)
+    {
+        const uchar* source = descriptors.ptr<uchar>(descriptors.rows - 1 - row);
+        std::copy(source, source + DESCRIPTOR_BYTES, copy.ptr<uchar>(row));
+
+        for (int i = 0; i < flippedBits; i++) {
+            const int b = bit(rng);
+            copy.at<uchar>(row, b / 8) ^= static_cast<uchar>(1 << (b % 8));
+        }
+    }
+
+    return copy;
+}
+
+TEST_CASE("Binary descriptor matcher finds the nearest train descriptors", "[binary_descriptor_matcher]")
+{
+    std::mt19937 rng(2);
+    cv::Mat train = CreateRandomDescriptors(DESCRIPTOR_COUNT, rng);
+
+    std::vector<cv::DMatch> matches;
+
+    SECTION("Hamming distance counts differing bits")
+    {
+        int expected = 0;
+        for (int col = 0; col < DESCRIPTOR_BYTES; col++) {
+            const int x = train.at<uchar>(0, col) ^ train.at<uchar>(1, col);
+            for (int b = 0; b < 8; b++) {
+                expected += (x >> b) & 1;
+            }
+        }
+
+        REQUIRE(Pipeline::BinaryDescriptorMatcher::HammingDistance(train.ptr<uchar>(0), train.ptr<uchar>(1), DESCRIPTOR_BYTES) == expected);
+        REQUIRE(Pipeline::BinaryDescriptorMatcher::HammingDistance(train.ptr<uchar>(0), train.ptr<uchar>(0), DESCRIPTOR_BYTES) == 0);
+    }
+
+    SECTION("Noisy copies of the descriptors are matched to their originals")
+    {
+        // within the radius guaranteed by exact byte buckets, and beyond it (found in the buckets 1 bit away)
+        for (int flippedBits : { 8, 40 })
+        {
+            cv::Mat query = CreateNoisyReversedCopy(train, flippedBits, rng);
+
+            Pipeline::BinaryDescriptorMatcher matcher(0.7f, true);
+            matcher.Match(query, train, matches);
+
+            REQUIRE(matches.size() == DESCRIPTOR_COUNT);
+            for (const cv::DMatch& match : matches) {
+                REQUIRE(match.trainIdx == DESCRIPTOR_COUNT - 1 - match.queryIdx);
+                REQUIRE(match.distance <= flippedBits);
+            }
+        }
+    }
+
+    SECTION("Large sets hashed by 16 bit substrings compute far fewer distances than brute force")
+    {
+        cv::Mat largeTrain = CreateRandomDescriptors(LARGE_DESCRIPTOR_COUNT, rng);
+        cv::Mat query = CreateNoisyReversedCopy(largeTrain, 8, rng);
+
+        Pipeline::BinaryDescriptorMatcher matcher(0.7f, true);
+        const size_t distances = matcher.Match(query, largeTrain, matches);
+
+        REQUIRE(matches.size() == LARGE_DESCRIPTOR_COUNT);
+        for (const cv::DMatch& match : matches) {
+            REQUIRE(match.trainIdx == LARGE_DESCRIPTOR_COUNT - 1 - match.queryIdx);
+        }
+
+        // brute force with cross-check computes every distance in both directions
+        REQUIRE(distances * 100 < 2 * static_cast<size_t>(LARGE_DESCRIPTOR_COUNT) * LARGE_DESCRIPTOR_COUNT);
+    }
+
+    SECTION("Neighbours beyond the hashed radius are found by the linear fallback")
+    {
+        cv::Mat pair = train.rowRange(0, 2).clone();
+
+        // 100 bits from the first train descriptor, beyond the largest radius the hash guarantees
+        cv::Mat query = train.row(0).clone();
+        for (int b = 0; b < 100; b++) {
+            query.at<uchar>(0, b / 8) ^= static_cast<uchar>(1 << (b % 8));
+        }
+
+        Pipeline::BinaryDescriptorMatcher matcher(0.9f, false);
+        matcher.Match(query, pair, matches);
+
+        REQUIRE(matches.size() == 1);
+        REQUIRE(matches[0].trainIdx == 0);
+        REQUIRE(matches[0].distance == 100);
+    }
+
+    SECTION("Ambiguous matches fail the ratio test")
+    {
+        cv::Mat query = train.row(0).clone();
+
+        // 2 train descriptors at the same distance from the query
+        cv::Mat pair(2, DESCRIPTOR_BYTES, CV_8U);
+        std::copy(query.ptr<uchar>(0), query.ptr<uchar>(0) + DESCRIPTOR_BYTES, pair.ptr<uchar>(0));
+        std::copy(query.ptr<uchar>(0), query.ptr<uchar>(0) + DESCRIPTOR_BYTES, pair.ptr<uchar>(1));
+        pair.at<uchar>(0, 0) ^= 0x0F;
+        pair.at<uchar>(1, 5) ^= 0xF0;
+
+        Pipeline::BinaryDescriptorMatcher matcher(0.7f, false);
+        matcher.Match(query, pair, matches);
+
+        REQUIRE(matches.empty());
+    }
+
+    SECTION("A single train descriptor has no second neighbour and is not matched")
+    {
+        cv::Mat single = train.row(0).clone();
+
+        Pipeline::BinaryDescriptorMatcher matcher;
+        matcher.Match(single, single, matches);
+
+        REQUIRE(matches.empty());
+    }
+
+    SECTION("Candidate matching keeps single candidates within the distance and matches each train descriptor once")
+    {
+        cv::Mat query = CreateNoisyReversedCopy(train, 8, rng);
+
+        // each query's true match and its neighbour as candidates, the last 2 queries only see one train descriptor
+        std::vector<std::vector<int>> candidates(DESCRIPTOR_COUNT);
+        for (int q = 0; q < DESCRIPTOR_COUNT - 2; q++) {
+            const int t = DESCRIPTOR_COUNT - 1 - q;
+            candidates[q] = { t, (t + 1) % DESCRIPTOR_COUNT };
+        }
+        candidates[DESCRIPTOR_COUNT - 2] = { 1 };
+        candidates[DESCRIPTOR_COUNT - 1] = { 1 };
+
+        Pipeline::BinaryDescriptorMatcher matcher;
+        matcher.MatchCandidates(query, train, candidates, 64, matches);
+
+        REQUIRE(matches.size() == DESCRIPTOR_COUNT - 1);
+        for (const cv::DMatch& match : matches) {
+            REQUIRE(match.trainIdx == DESCRIPTOR_COUNT - 1 - match.queryIdx);
+        }
+    }
+}
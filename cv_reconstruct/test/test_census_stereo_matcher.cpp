@@ -0,0 +1,128 @@
+//
+// test_census_stereo_matcher.cpp
+// Tests for the census semi-global stereo matcher
+//
+
+#define CATCH_CONFIG_MAIN
+
+#include "catch2/catch.hpp"
+#include "reconstruct/CensusStereoMatcher.hpp"
+
+#include <cstdlib>
+
+#include <opencv2/core/core.hpp>
+
+// synthetic stereo pair size and its constant disparity
+const int IMAGE_WIDTH = 200;
+const int IMAGE_HEIGHT = 60;
+const int TRUE_DISPARITY = 12;
+const int NUM_DISPARITIES = 64;
+
+// fraction of pixels (right of the disparity search range) within half a pixel of the true disparity
+float FractionCorrect(const cv::Mat& disparity)
+{
+    int correct = 0;
+    int total = 0;
+
+    for (int row = 0; row < disparity.rows; row++) {
+        for (int col = NUM_DISPARITIES; col < disparity.cols; col++) {
+            short d = disparity.at<short>(row, col);
+            if (std::abs(d - TRUE_DISPARITY * cv::StereoMatcher::DISP_SCALE) <= cv::StereoMatcher::DISP_SCALE / 2) {
+                correct++;
+            }
+            total++;
+        }
+    }
+
+    return static_cast<float>(correct) / static_cast<float>(total);
+}
+
+TEST_CASE("Census stereo matcher recovers a constant disparity", "[census_stereo_matcher]")
+{
+    // synthetic stereo pair: random texture with the right image shifted by a constant disparity
+    std::srand(3);
+
+    cv::Mat texture(IMAGE_HEIGHT, IMAGE_WIDTH + NUM_DISPARITIES, CV_8U);
+    for (int row = 0; row < texture.rows; row++) {
+        for (int col = 0; col < texture.cols; col++) {
+            texture.at<unsigned char>(row, col) = static_cast<unsigned char>(std::rand() % 256);
+        }
+    }
+
+    const cv::Mat left = texture(cv::Rect(NUM_DISPARITIES / 2, 0, IMAGE_WIDTH, IMAGE_HEIGHT)).clone();
+    const cv::Mat right = texture(cv::Rect(NUM_DISPARITIES / 2 + TRUE_DISPARITY, 0, IMAGE_WIDTH, IMAGE_HEIGHT)).clone();
+
+    // narrow band around the true disparity
+    cv::Mat lowerBound(left.size(), CV_16S, cv::Scalar(TRUE_DISPARITY - 2));
+    cv::Mat upperBound(left.size(), CV_16S, cv::Scalar(TRUE_DISPARITY + 2));
+
+    cv::Mat disparity;
+
+    SECTION("SGM with 8 paths in 16x fixed point")
+    {
+        auto matcher = Reconstruct::CensusStereoMatcher::create(0, NUM_DISPARITIES, 10, 120, 8);
+        matcher->compute(left, right, disparity);
+
+        REQUIRE(disparity.type() == CV_16S);
+        REQUIRE(disparity.size() == left.size());
+        REQUIRE(FractionCorrect(disparity) > 0.95f);
+    }
+
+    SECTION("SGM with 4 paths")
+    {
+        auto matcher = Reconstruct::CensusStereoMatcher::create(0, NUM_DISPARITIES, 10, 120, 4);
+        matcher->compute(left, right, disparity);
+
+        REQUIRE(FractionCorrect(disparity) > 0.95f);
+    }
+
+    SECTION("Range search within a narrow band")
+    {
+        auto matcher = Reconstruct::CensusStereoMatcher::create(0, NUM_DISPARITIES);
+        matcher->ComputeInRange(left, right, lowerBound, upperBound, disparity);
+
+        REQUIRE(disparity.type() == CV_16S);
+        REQUIRE(FractionCorrect(disparity) > 0.95f);
+    }
+
+    SECTION("Range search leaves pixels with an empty range invalid")
+    {
+        // no estimate for the top half
+        for (int row = 0; row < IMAGE_HEIGHT / 2; row++) {
+            for (int col = 0; col < IMAGE_WIDTH; col++) {
+                lowerBound.at<short>(row, col) = NUM_DISPARITIES - 1;
+                upperBound.at<short>(row, col) = -1;
+            }
+        }
+
+        auto matcher = Reconstruct::CensusStereoMatcher::create(0, NUM_DISPARITIES);
+        matcher->ComputeInRange(left, right, lowerBound, upperBound, disparity);
+
+        const short invalid = -cv::StereoMatcher::DISP_SCALE;
+        REQUIRE(disparity.at<short>(0, IMAGE_WIDTH - 1) == invalid);
+        REQUIRE(disparity.at<short>(IMAGE_HEIGHT / 2 - 1, IMAGE_WIDTH / 2) == invalid);
+        REQUIRE(std::abs(disparity.at<short>(IMAGE_HEIGHT - 1, IMAGE_WIDTH - 1) - TRUE_DISPARITY * cv::StereoMatcher::DISP_SCALE) <= cv::StereoMatcher::DISP_SCALE / 2);
+    }
+
+    SECTION("Range search only evaluates the costs of the searched disparities")
+    {
+        // narrow band around a prior sloping across the full disparity range
+        for (int row = 0; row < IMAGE_HEIGHT; row++) {
+            for (int col = 0; col < IMAGE_WIDTH; col++) {
+                const int prior = col * (NUM_DISPARITIES - 4) / IMAGE_WIDTH + 2;
+                lowerBound.at<short>(row, col) = static_cast<short>(prior - 2);
+                upperBound.at<short>(row, col) = static_cast<short>(prior + 2);
+            }
+        }
+
+        cv::Mat fullLowerBound(left.size(), CV_16S, cv::Scalar(0));
+        cv::Mat fullUpperBound(left.size(), CV_16S, cv::Scalar(NUM_DISPARITIES - 1));
+
+        auto matcher = Reconstruct::CensusStereoMatcher::create(0, NUM_DISPARITIES);
+        const size_t bandCosts = matcher->ComputeInRange(left, right, lowerBound, upperBound, disparity);
+        const size_t fullCosts = matcher->ComputeInRange(left, right, fullLowerBound, fullUpperBound, disparity);
+
+        REQUIRE(bandCosts > 0);
+        REQUIRE(bandCosts * 3 < fullCosts);
+    }
+}
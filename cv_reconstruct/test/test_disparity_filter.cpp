@@ -0,0 +1,72 @@
+//
+// test_disparity_filter.cpp
+// Tests for the disparity filter
+//
+
+#define CATCH_CONFIG_MAIN
+
+#include "catch2/catch.hpp"
+#include "reconstruct/DisparityFilter.hpp"
+
+#include <opencv2/core/core.hpp>
+
+const int IMAGE_WIDTH = 40;
+const int IMAGE_HEIGHT = 10;
+
+TEST_CASE("Disparity filter rejects unreliable disparities", "[disparity_filter]")
+{
+    // disparity of 8 pixels on the right half, invalid (-16) on the left half
+    cv::Mat disparity(IMAGE_HEIGHT, IMAGE_WIDTH, CV_16S, -16.0);
+    for (int row = 0; row < IMAGE_HEIGHT; row++) {
+        for (int col = IMAGE_WIDTH / 2; col < IMAGE_WIDTH; col++) {
+            disparity.at<short>(row, col) = 8 * 16;
+        }
+    }
+
+    cv::Mat filtered, mask;
+
+    SECTION("Confidence threshold is minimum plus scaled std deviation")
+    {
+        Reconstruct::DisparityFilter filter(0, 1.0f);
+
+        // half at -16, half at 128: std is 72
+        REQUIRE(filter.ComputeConfidenceThreshold(disparity) == Approx(-16.0 + 72.0));
+    }
+
+    SECTION("Rejected pixels are masked and the result converted to float")
+    {
+        Reconstruct::DisparityFilter filter(0, 1.3f);
+        filter.Apply(disparity, cv::Mat(), cv::Rect(0, 0, IMAGE_WIDTH, IMAGE_HEIGHT), filtered, mask);
+
+        REQUIRE(filtered.type() == CV_32F);
+        REQUIRE(mask.at<unsigned char>(5, 5) == 0);
+        REQUIRE(filtered.at<float>(5, 5) == 0.0f);
+        REQUIRE(mask.at<unsigned char>(5, 30) == 255);
+        REQUIRE(filtered.at<float>(5, 30) == Approx(8.0f));
+    }
+
+    SECTION("Pixels outside the region of interest are rejected")
+    {
+        Reconstruct::DisparityFilter filter(0, 1.3f);
+        filter.Apply(disparity, cv::Mat(), cv::Rect(0, 0, 30, IMAGE_HEIGHT), filtered, mask, CV_16S);
+
+        REQUIRE(filtered.type() == CV_16S);
+        REQUIRE(filtered.at<short>(5, 25) == 8 * 16);
+        REQUIRE(filtered.at<short>(5, 35) == 0);
+        REQUIRE(mask.at<unsigned char>(5, 35) == 0);
+    }
+
+    SECTION("Left-right check rejects inconsistent disparities")
+    {
+        // right disparity agrees except at the right pixel matched by column 30
+        cv::Mat rightDisparity(IMAGE_HEIGHT, IMAGE_WIDTH, CV_16S, 8.0 * 16);
+        rightDisparity.at<short>(5, 22) = 2 * 16;
+
+        Reconstruct::DisparityFilter filter(0, 1.3f, 0, 2, 1);
+        filter.Apply(disparity, rightDisparity, cv::Rect(0, 0, IMAGE_WIDTH, IMAGE_HEIGHT), filtered, mask);
+
+        REQUIRE(mask.at<unsigned char>(5, 30) == 0);
+        REQUIRE(mask.at<unsigned char>(5, 31) == 255);
+        REQUIRE(mask.at<unsigned char>(4, 30) == 255);
+    }
+}
@@ -0,0 +1,82 @@
+//
+// test_flow_cache.cpp
+// Tests for the keyframe pair flow cache
+//
+
+#define CATCH_CONFIG_MAIN
+
+#include "catch2/catch.hpp"
+#include "pipeline/FlowCache.hpp"
+
+#include <opencv2/core/core.hpp>
+
+// a small flow field filled with one value so cached flows can be told apart
+cv::Mat CreateFlow(float value)
+{
+    cv::Mat flow(4, 6, CV_32FC2);
+    for (int row = 0; row < flow.rows; row++) {
+        for (int col = 0; col < flow.cols; col++) {
+            flow.at<cv::Point2f>(row, col) = cv::Point2f(value, -value);
+        }
+    }
+
+    return flow;
+}
+
+TEST_CASE("Flow cache holds the flows of recent frame pairs", "[flow_cache]")
+{
+    Features::FlowCache cache(2);
+    cache.Insert(1, 2, CreateFlow(1.0f));
+    cache.Insert(2, 3, CreateFlow(2.0f));
+
+    cv::Mat flow;
+
+    SECTION("Cached flows are returned by frame pair")
+    {
+        REQUIRE(cache.Get(1, 2, flow));
+        REQUIRE(flow.at<cv::Point2f>(0, 0).x == 1.0f);
+
+        REQUIRE(cache.Get(2, 3, flow));
+        REQUIRE(flow.at<cv::Point2f>(3, 5).y == -2.0f);
+
+        // the flow is directional
+        REQUIRE_FALSE(cache.Get(2, 1, flow));
+        REQUIRE(cache.Size() == 2);
+
+        // inserting an existing pair replaces its flow
+        cache.Insert(1, 2, CreateFlow(5.0f));
+        REQUIRE(cache.Size() == 2);
+        REQUIRE(cache.Get(1, 2, flow));
+        REQUIRE(flow.at<cv::Point2f>(0, 0).x == 5.0f);
+    }
+
+    SECTION("The least recently used flow is evicted when full")
+    {
+        // using (1, 2) leaves (2, 3) as the least recently used
+        REQUIRE(cache.Get(1, 2, flow));
+
+        cache.Insert(3, 4, CreateFlow(3.0f));
+        REQUIRE(cache.Size() == 2);
+        REQUIRE(cache.Get(1, 2, flow));
+        REQUIRE(cache.Get(3, 4, flow));
+        REQUIRE_FALSE(cache.Get(2, 3, flow));
+    }
+
+    SECTION("Flows of frames leaving the window are evicted")
+    {
+        cache.EvictFramesBefore(2);
+
+        REQUIRE(cache.Size() == 1);
+        REQUIRE_FALSE(cache.Get(1, 2, flow));
+        REQUIRE(cache.Get(2, 3, flow));
+    }
+
+    SECTION("A cache without capacity holds nothing")
+    {
+        Features::FlowCache emptyCache(0);
+        emptyCache.Insert(1, 2, CreateFlow(1.0f));
+
+        REQUIRE(emptyCache.Size() == 0);
+        REQUIRE_FALSE(emptyCache.Get(1, 2, flow));
+    }
+}
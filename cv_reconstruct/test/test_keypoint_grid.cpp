@@ -0,0 +1,90 @@
+//
+// test_keypoint_grid.cpp
+// Tests for the keypoint grid index
+//
+
+#define CATCH_CONFIG_MAIN
+
+#include "catch2/catch.hpp"
+#include "pipeline/KeyPointGrid.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include <opencv2/core/core.hpp>
+
+const int IMAGE_WIDTH = 100;
+const int IMAGE_HEIGHT = 60;
+
+// indices of the keypoints within the radius by checking every keypoint
+std::vector<int> FindInRadius(const std::vector<cv::KeyPoint>& keypoints, const cv::Point2f& pixel, float radius, int level)
+{
+    std::vector<int> indices;
+    for (size_t i = 0; i < keypoints.size(); i++)
+    {
+        const float dx = keypoints[i].pt.x - pixel.x;
+        const float dy = keypoints[i].pt.y - pixel.y;
+        if ((level < 0 || keypoints[i].octave == level) && dx * dx + dy * dy <= radius * radius) {
+            indices.push_back(static_cast<int>(i));
+        }
+    }
+
+    return indices;
+}
+
+TEST_CASE("Keypoint grid finds the keypoints around a pixel", "[keypoint_grid]")
+{
+    // a keypoint every 5 pixels, on alternating pyramid levels
+    std::vector<cv::KeyPoint> keypoints;
+    for (int y = 0; y < IMAGE_HEIGHT; y += 5) {
+        for (int x = 0; x < IMAGE_WIDTH; x += 5) {
+            cv::KeyPoint kp(static_cast<float>(x), static_cast<float>(y), 31.0f);
+            kp.octave = static_cast<int>(keypoints.size() % 2);
+            keypoints.push_back(kp);
+        }
+    }
+
+    Pipeline::KeyPointGrid grid(keypoints, cv::Size(IMAGE_WIDTH, IMAGE_HEIGHT), 16);
+    std::vector<int> indices;
+
+    SECTION("Radius queries find the same keypoints as a linear search")
+    {
+        REQUIRE(grid.Size() == keypoints.size());
+
+        const cv::Point2f pixels[] = { cv::Point2f(50.0f, 30.0f), cv::Point2f(0.0f, 0.0f), cv::Point2f(98.5f, 59.0f), cv::Point2f(-8.0f, 20.0f) };
+
+        for (const cv::Point2f& pixel : pixels)
+        {
+            for (float radius : { 0.0f, 4.0f, 12.5f, 40.0f })
+            {
+                for (int level : { -1, 0, 1 })
+                {
+                    grid.GetKeypointsInRadius(pixel, radius, indices, level);
+                    std::sort(indices.begin(), indices.end());
+
+                    REQUIRE(indices == FindInRadius(keypoints, pixel, radius, level));
+                }
+            }
+        }
+    }
+
+    SECTION("Pixels far outside the image or without a prediction find nothing")
+    {
+        indices = { 1, 2, 3 };
+        grid.GetKeypointsInRadius(cv::Point2f(1e12f, -1e12f), 20.0f, indices);
+        REQUIRE(indices.empty());
+
+        const float nan = std::numeric_limits<float>::quiet_NaN();
+        grid.GetKeypointsInRadius(cv::Point2f(nan, nan), 20.0f, indices);
+        REQUIRE(indices.empty());
+    }
+
+    SECTION("An empty grid finds nothing")
+    {
+        Pipeline::KeyPointGrid emptyGrid;
+
+        emptyGrid.GetKeypointsInRadius(cv::Point2f(10.0f, 10.0f), 20.0f, indices);
+        REQUIRE(indices.empty());
+    }
+}
@@ -0,0 +1,133 @@
+//
+// test_sparse_stereo_matcher.cpp
+// Tests for the sparse stereo matcher
+//
+
+#define CATCH_CONFIG_MAIN
+
+#include "catch2/catch.hpp"
+#include "reconstruct/SparseStereoMatcher.hpp"
+
+#include <cmath>
+#include <random>
+
+#include <opencv2/core/core.hpp>
+
+const int IMAGE_WIDTH = 160;
+const int IMAGE_HEIGHT = 60;
+const int DESCRIPTOR_BYTES = 32;
+const float TRUE_DISPARITY = 20.0f;
+
+// smooth texture so the patch costs are close to parabolic around the minimum
+float Texture(float x, float y)
+{
+    return 127.0f + 60.0f * std::sin(0.31f * x + 0.17f * y) + 50.0f * std::cos(0.23f * x - 0.29f * y);
+}
+
+// left image and a right image where the left pixel x is seen at x - disparity
+void CreateStereoPair(float disparity, cv::Mat& left, cv::Mat& right)
+{
+    left = cv::Mat(IMAGE_HEIGHT, IMAGE_WIDTH, CV_8U);
+    right = cv::Mat(IMAGE_HEIGHT, IMAGE_WIDTH, CV_8U);
+
+    for (int row = 0; row < IMAGE_HEIGHT; row++) {
+        for (int col = 0; col < IMAGE_WIDTH; col++) {
+            left.at<uchar>(row, col) = static_cast<uchar>(std::lround(Texture(static_cast<float>(col), static_cast<float>(row))));
+            right.at<uchar>(row, col) = static_cast<uchar>(std::lround(Texture(col + disparity, static_cast<float>(row))));
+        }
+    }
+}
+
+// matching left and right features with the same random descriptor
+void CreateFeatures(float disparity, std::vector<cv::KeyPoint>& leftKeypoints, cv::Mat& leftDescriptors, std::vector<cv::KeyPoint>& rightKeypoints, cv::Mat& rightDescriptors)
+{
+    std::mt19937 rng(1);
+    std::uniform_int_distribution<int> byte(0, 255);
+
+    for (int y = 15; y < IMAGE_HEIGHT - 15; y += 10) {
+        for (int x = 50; x < IMAGE_WIDTH - 20; x += 15) {
+            leftKeypoints.emplace_back(static_cast<float>(x), static_cast<float>(y), 31.0f);
+            rightKeypoints.emplace_back(std::round(x - disparity), static_cast<float>(y), 31.0f);
+        }
+    }
+
+    leftDescriptors = cv::Mat(static_cast<int>(leftKeypoints.size()), DESCRIPTOR_BYTES, CV_8U);
+    for (int row = 0; row < leftDescriptors.rows; row++) {
+        for (int col = 0; col < DESCRIPTOR_BYTES; col++) {
+            leftDescriptors.at<uchar>(row, col) = static_cast<uchar>(byte(rng));
+        }
+    }
+
+    rightDescriptors = leftDescriptors.clone();
+}
+
+TEST_CASE("Sparse stereo matcher finds the disparity of each left feature", "[sparse_stereo_matcher]")
+{
+    cv::Mat left, right;
+    CreateStereoPair(TRUE_DISPARITY, left, right);
+
+    std::vector<cv::KeyPoint> leftKeypoints, rightKeypoints;
+    cv::Mat leftDescriptors, rightDescriptors;
+    CreateFeatures(TRUE_DISPARITY, leftKeypoints, leftDescriptors, rightKeypoints, rightDescriptors);
+
+    std::vector<float> disparities;
+
+    SECTION("Features are matched along the scanline with sub-pixel disparity")
+    {
+        for (float disparity : { 12.0f, TRUE_DISPARITY + 0.4f, 31.7f })
+        {
+            std::vector<cv::KeyPoint> shiftedKeypoints;
+            CreateStereoPair(disparity, left, right);
+            for (const cv::KeyPoint& kp : leftKeypoints) {
+                shiftedKeypoints.emplace_back(std::round(kp.pt.x - disparity), kp.pt.y, kp.size);
+            }
+
+            Reconstruct::SparseStereoMatcher matcher(0, 48);
+            matcher.Compute(left, right, leftKeypoints, leftDescriptors, shiftedKeypoints, rightDescriptors, disparities);
+
+            REQUIRE(disparities.size() == leftKeypoints.size());
+            for (float d : disparities) {
+                REQUIRE(d == Approx(disparity).margin(0.25));
+            }
+        }
+    }
+
+    SECTION("Features below the disparity range are not matched")
+    {
+        Reconstruct::SparseStereoMatcher matcher(0, 16);
+        matcher.Compute(left, right, leftKeypoints, leftDescriptors, rightKeypoints, rightDescriptors, disparities);
+
+        REQUIRE(disparities.size() == leftKeypoints.size());
+        for (float d : disparities) {
+            REQUIRE(d == 0.0f);
+        }
+    }
+
+    SECTION("Features with distant descriptors are not matched")
+    {
+        cv::Mat invertedDescriptors = rightDescriptors.clone();
+        for (int row = 0; row < invertedDescriptors.rows; row++) {
+            for (int col = 0; col < DESCRIPTOR_BYTES; col++) {
+                invertedDescriptors.at<uchar>(row, col) = static_cast<uchar>(~invertedDescriptors.at<uchar>(row, col));
+            }
+        }
+
+        Reconstruct::SparseStereoMatcher matcher(0, 48);
+        matcher.Compute(left, right, leftKeypoints, leftDescriptors, rightKeypoints, invertedDescriptors, disparities);
+
+        for (float d : disparities) {
+            REQUIRE(d == 0.0f);
+        }
+    }
+
+    SECTION("No right features gives no disparities")
+    {
+        Reconstruct::SparseStereoMatcher matcher;
+        matcher.Compute(left, right, leftKeypoints, leftDescriptors, {}, cv::Mat(), disparities);
+
+        REQUIRE(disparities.size() == leftKeypoints.size());
+        for (float d : disparities) {
+            REQUIRE(d == 0.0f);
+        }
+    }
+}